@@ -0,0 +1,400 @@
+#include "aggregate.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Buckets allocated when a store first grows. */
+#define STORE_SLACK 64
+/* Ratio of consecutive bucket bounds. */
+#define GAMMA ((1 + AGGREGATE_QUANTILE_ERROR) / (1 - AGGREGATE_QUANTILE_ERROR))
+
+/* Counts of values whose magnitude falls in bucket i, that is, in
+ * (gamma^(i-1), gamma^i], for i from offset to offset + size - 1. */
+typedef struct {
+    uint64_t *counts;
+    long offset;
+    size_t size;
+    uint64_t total;
+} bucket_store;
+
+/* DDSketch: every value in bucket i is within the relative error of
+ * 2 gamma^i / (gamma + 1), so quantiles are too. Buckets of one sketch
+ * add up with those of another. Infinities are counted apart. */
+typedef struct {
+    bucket_store positive;
+    bucket_store negative;
+    uint64_t zeros;
+    uint64_t positive_infinities;
+    uint64_t negative_infinities;
+    double inverse_log_gamma;
+} quantile_sketch;
+
+struct aggregates {
+    uint64_t count;
+    bool has_nan;
+    uint64_t positive_infinities;
+    uint64_t negative_infinities;
+    double sum; /* Neumaier's compensated sum is sum + compensation */
+    double compensation;
+    /* Welford's running mean and sum of squared deviations, over the finite
+     * values only. Squared deviations of large doubles overflow a double,
+     * so these are kept in long double. */
+    uint64_t finite_count;
+    long double mean;
+    long double m2;
+    double min;
+    double max;
+    quantile_sketch *sketch;
+};
+
+static status parse_one(const char *s, const size_t length, aggregate_spec *out) {
+    static const struct {
+        const char *name;
+        aggregate_kind kind;
+    } names[] = {
+        {"count", AGGREGATE_COUNT}, {"sum", AGGREGATE_SUM}, {"mean", AGGREGATE_MEAN},
+        {"min", AGGREGATE_MIN}, {"max", AGGREGATE_MAX}, {"stddev", AGGREGATE_STDDEV},
+    };
+    if (length == 0 || length >= sizeof(out->name)) {
+        return INVALID_OPTION_ARGUMENT;
+    }
+    memcpy(out->name, s, length);
+    out->name[length] = '\0';
+    for (size_t q = 0; q < sizeof(names) / sizeof(names[0]); q++) {
+        if (strcmp(out->name, names[q].name) == 0) {
+            out->kind = names[q].kind;
+            return OK;
+        }
+    }
+    if (out->name[0] != 'p' || out->name[1] < '0' || out->name[1] > '9') {
+        return INVALID_OPTION_ARGUMENT;
+    }
+    char *end;
+    const double percentile = strtod(out->name + 1, &end);
+    if (*end != '\0' || !(percentile >= 0 && percentile <= 100)) {
+        return INVALID_OPTION_ARGUMENT;
+    }
+    out->kind = AGGREGATE_QUANTILE;
+    out->quantile = percentile / 100;
+    return OK;
+}
+
+status aggregate_parse(const char *list, aggregate_spec *specs, size_t *out_num_specs) {
+    size_t n = 0;
+    for (;;) {
+        const char *comma = strchr(list, ',');
+        const size_t length = comma != NULL ? (size_t) (comma - list) : strlen(list);
+        if (n == MAX_AGGREGATES) {
+            return INVALID_OPTION_ARGUMENT;
+        }
+        const status st = parse_one(list, length, &specs[n++]);
+        if (st != OK) {
+            return st;
+        }
+        if (comma == NULL) {
+            break;
+        }
+        list = comma + 1;
+    }
+    *out_num_specs = n;
+    return OK;
+}
+
+bool aggregate_needs_quantiles(const aggregate_spec *specs, const size_t num_specs) {
+    for (size_t q = 0; q < num_specs; q++) {
+        if (specs[q].kind == AGGREGATE_QUANTILE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Grows the store to cover buckets low to high, at least doubling it. */
+static status store_cover(bucket_store *store, long low, long high) {
+    if (store->size > 0) {
+        if (low >= store->offset && high < store->offset + (long) store->size) {
+            return OK;
+        }
+        const long old_high = store->offset + (long) store->size - 1;
+        low = low < store->offset ? low : store->offset;
+        high = high > old_high ? high : old_high;
+    }
+    size_t size = (size_t) (high - low + 1);
+    const size_t wanted = store->size * 2 > STORE_SLACK ? store->size * 2 : STORE_SLACK;
+    if (size < wanted) {
+        low -= (long) (wanted - size) / 2;
+        size = wanted;
+    }
+    uint64_t *counts = calloc(size, sizeof(uint64_t));
+    if (counts == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    if (store->size > 0) {
+        memcpy(counts + (store->offset - low), store->counts, store->size * sizeof(uint64_t));
+    }
+    free(store->counts);
+    store->counts = counts;
+    store->offset = low;
+    store->size = size;
+    return OK;
+}
+
+static status store_add(bucket_store *store, const long index, const uint64_t count) {
+    const status st = store_cover(store, index, index);
+    if (st != OK) {
+        return st;
+    }
+    store->counts[index - store->offset] += count;
+    store->total += count;
+    return OK;
+}
+
+static status store_merge(bucket_store *into, const bucket_store *from) {
+    if (from->total == 0) {
+        return OK;
+    }
+    const status st = store_cover(into, from->offset, from->offset + (long) from->size - 1);
+    if (st != OK) {
+        return st;
+    }
+    for (size_t q = 0; q < from->size; q++) {
+        into->counts[from->offset - into->offset + (long) q] += from->counts[q];
+    }
+    into->total += from->total;
+    return OK;
+}
+
+static long bucket_index(const quantile_sketch *sketch, const double magnitude) {
+    return (long) ceil(log(magnitude) * sketch->inverse_log_gamma);
+}
+
+static double bucket_value(const long index) {
+    return 2 * pow(GAMMA, (double) index) / (GAMMA + 1);
+}
+
+static status sketch_add(quantile_sketch *sketch, const double x) {
+    if (x == 0) {
+        sketch->zeros++;
+    } else if (isinf(x)) {
+        if (x > 0) {
+            sketch->positive_infinities++;
+        } else {
+            sketch->negative_infinities++;
+        }
+    } else if (x > 0) {
+        return store_add(&sketch->positive, bucket_index(sketch, x), 1);
+    } else {
+        return store_add(&sketch->negative, bucket_index(sketch, -x), 1);
+    }
+    return OK;
+}
+
+/* Walks the buckets from the most negative value up. */
+static double sketch_quantile(const quantile_sketch *sketch, const double quantile) {
+    const uint64_t total = sketch->negative_infinities + sketch->negative.total + sketch->zeros
+                           + sketch->positive.total + sketch->positive_infinities;
+    const double rank = quantile * (double) (total - 1);
+    uint64_t seen = sketch->negative_infinities;
+    if ((double) seen > rank) {
+        return -INFINITY;
+    }
+    for (size_t q = sketch->negative.size; q-- > 0;) {
+        seen += sketch->negative.counts[q];
+        if ((double) seen > rank) {
+            return -bucket_value(sketch->negative.offset + (long) q);
+        }
+    }
+    seen += sketch->zeros;
+    if ((double) seen > rank) {
+        return 0;
+    }
+    for (size_t q = 0; q < sketch->positive.size; q++) {
+        seen += sketch->positive.counts[q];
+        if ((double) seen > rank) {
+            return bucket_value(sketch->positive.offset + (long) q);
+        }
+    }
+    return INFINITY;
+}
+
+status aggregates_new(const bool quantiles, aggregates **out) {
+    aggregates *a = calloc(1, sizeof(aggregates));
+    if (a == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    if (quantiles) {
+        a->sketch = calloc(1, sizeof(quantile_sketch));
+        if (a->sketch == NULL) {
+            free(a);
+            return OUT_OF_MEMORY;
+        }
+        a->sketch->inverse_log_gamma = 1 / log(GAMMA);
+    }
+    aggregates_reset(a);
+    *out = a;
+    return OK;
+}
+
+void aggregates_free(aggregates *a) {
+    if (a == NULL) {
+        return;
+    }
+    if (a->sketch != NULL) {
+        free(a->sketch->positive.counts);
+        free(a->sketch->negative.counts);
+        free(a->sketch);
+    }
+    free(a);
+}
+
+bool aggregates_has_quantiles(const aggregates *a) {
+    return a->sketch != NULL;
+}
+
+static void reset_store(bucket_store *store) {
+    if (store->size > 0) {
+        memset(store->counts, 0, store->size * sizeof(uint64_t));
+    }
+    store->total = 0;
+}
+
+void aggregates_reset(aggregates *a) {
+    a->count = 0;
+    a->has_nan = false;
+    a->positive_infinities = 0;
+    a->negative_infinities = 0;
+    a->sum = 0;
+    a->compensation = 0;
+    a->finite_count = 0;
+    a->mean = 0;
+    a->m2 = 0;
+    a->min = INFINITY;
+    a->max = -INFINITY;
+    if (a->sketch != NULL) {
+        reset_store(&a->sketch->positive);
+        reset_store(&a->sketch->negative);
+        a->sketch->zeros = 0;
+        a->sketch->positive_infinities = 0;
+        a->sketch->negative_infinities = 0;
+    }
+}
+
+/* Neumaier's variant of Kahan summation, which also holds up when a term
+ * is larger than the running sum. Infinities skip the compensation, which
+ * they would turn into NaN. */
+static void add_compensated(aggregates *a, const double x) {
+    const double t = a->sum + x;
+    if (isfinite(t)) {
+        a->compensation += fabs(a->sum) >= fabs(x) ? (a->sum - t) + x : (x - t) + a->sum;
+    }
+    a->sum = t;
+}
+
+status aggregates_add(aggregates *a, const double *values, const size_t count) {
+    for (size_t q = 0; q < count; q++) {
+        const double x = values[q];
+        a->count++;
+        if (isnan(x)) {
+            a->has_nan = true;
+            continue;
+        }
+        add_compensated(a, x);
+        if (isinf(x)) {
+            if (x > 0) {
+                a->positive_infinities++;
+            } else {
+                a->negative_infinities++;
+            }
+        } else {
+            a->finite_count++;
+            const long double delta = x - a->mean;
+            a->mean += delta / (long double) a->finite_count;
+            a->m2 += delta * (x - a->mean);
+        }
+        a->min = x < a->min ? x : a->min;
+        a->max = x > a->max ? x : a->max;
+        if (a->sketch != NULL) {
+            const status st = sketch_add(a->sketch, x);
+            if (st != OK) {
+                return st;
+            }
+        }
+    }
+    return OK;
+}
+
+/* Welford's mean and m2 combine as shown by Chan, Golub and LeVeque. */
+status aggregates_merge(aggregates *into, const aggregates *from) {
+    if (from->count == 0) {
+        return OK;
+    }
+    if (from->finite_count > 0) {
+        const long double n_into = (long double) into->finite_count;
+        const long double n_from = (long double) from->finite_count;
+        const long double n = n_into + n_from;
+        const long double delta = from->mean - into->mean;
+        into->mean += delta * n_from / n;
+        into->m2 += from->m2 + delta * delta * n_into * n_from / n;
+        into->finite_count += from->finite_count;
+    }
+    into->count += from->count;
+    into->has_nan = into->has_nan || from->has_nan;
+    into->positive_infinities += from->positive_infinities;
+    into->negative_infinities += from->negative_infinities;
+    add_compensated(into, from->sum);
+    add_compensated(into, from->compensation);
+    into->min = from->min < into->min ? from->min : into->min;
+    into->max = from->max > into->max ? from->max : into->max;
+    if (into->sketch == NULL) {
+        return OK;
+    }
+    into->sketch->zeros += from->sketch->zeros;
+    into->sketch->positive_infinities += from->sketch->positive_infinities;
+    into->sketch->negative_infinities += from->sketch->negative_infinities;
+    const status st = store_merge(&into->sketch->positive, &from->sketch->positive);
+    return st != OK ? st : store_merge(&into->sketch->negative, &from->sketch->negative);
+}
+
+double aggregates_value(const aggregates *a, const aggregate_spec *spec) {
+    if (spec->kind == AGGREGATE_COUNT) {
+        return (double) a->count;
+    }
+    if (a->has_nan) {
+        return NAN;
+    }
+    switch (spec->kind) {
+        case AGGREGATE_SUM:
+            return isfinite(a->sum) ? a->sum + a->compensation : a->sum;
+        case AGGREGATE_MEAN:
+            /* infinities of one sign decide the mean, and of both make it NaN */
+            if (a->count == 0 || a->positive_infinities > 0 && a->negative_infinities > 0) {
+                return NAN;
+            }
+            if (a->positive_infinities > 0 || a->negative_infinities > 0) {
+                return a->positive_infinities > 0 ? INFINITY : -INFINITY;
+            }
+            return (double) a->mean;
+        case AGGREGATE_MIN:
+            return a->count > 0 ? a->min : NAN;
+        case AGGREGATE_MAX:
+            return a->count > 0 ? a->max : NAN;
+        case AGGREGATE_STDDEV:
+            /* an infinite value is infinitely far from any mean but its own */
+            if (a->count < 2 || a->positive_infinities > 0 || a->negative_infinities > 0) {
+                return NAN;
+            }
+            return (double) sqrtl(a->m2 / (long double) (a->count - 1));
+        case AGGREGATE_QUANTILE: {
+            if (a->count == 0 || a->sketch == NULL) {
+                return NAN;
+            }
+            /* the exact extremes are known, and bucket values may overshoot them */
+            const double value = sketch_quantile(a->sketch, spec->quantile);
+            return value < a->min ? a->min : value > a->max ? a->max : value;
+        }
+        default:
+            return NAN;
+    }
+}
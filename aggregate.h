@@ -0,0 +1,53 @@
+#ifndef CCALC_AGGREGATE_H
+#define CCALC_AGGREGATE_H
+
+#include <stddef.h>
+#include "status.h"
+
+/* Relative error of quantiles. */
+#define AGGREGATE_QUANTILE_ERROR 0.01
+/* Most aggregates in one --aggregate list. */
+#define MAX_AGGREGATES 32
+
+typedef enum {
+    AGGREGATE_COUNT,
+    AGGREGATE_SUM,
+    AGGREGATE_MEAN,
+    AGGREGATE_MIN,
+    AGGREGATE_MAX,
+    AGGREGATE_STDDEV,
+    AGGREGATE_QUANTILE,
+} aggregate_kind;
+
+typedef struct {
+    aggregate_kind kind;
+    double quantile; /* in [0, 1], for AGGREGATE_QUANTILE */
+    char name[16]; /* as given, e.g. "p99" */
+} aggregate_spec;
+
+/* Statistics over a stream of values, kept in one pass: a compensated sum,
+ * Welford's mean and variance, min and max, and optionally a DDSketch
+ * for quantiles. Aggregates over parts of a stream, e.g. one per thread,
+ * merge into the aggregates of the whole stream. */
+typedef struct aggregates aggregates;
+
+/* Parses a comma-separated list like "sum,mean,p99", of count, sum, mean,
+ * min, max, stddev, and pN for the N-th percentile. */
+status aggregate_parse(const char *list, aggregate_spec *specs, size_t *out_num_specs);
+bool aggregate_needs_quantiles(const aggregate_spec *specs, size_t num_specs);
+
+status aggregates_new(bool quantiles, aggregates **out);
+void aggregates_free(aggregates *a);
+bool aggregates_has_quantiles(const aggregates *a);
+/* Empties a, keeping its memory. */
+void aggregates_reset(aggregates *a);
+status aggregates_add(aggregates *a, const double *values, size_t count);
+/* Adds everything in from to into. Both must agree on quantiles. */
+status aggregates_merge(aggregates *into, const aggregates *from);
+/* Any NaN value makes everything but the count NaN. Infinite values make
+ * the mean infinite, or NaN when they have both signs. The standard
+ * deviation is that of a sample, and NaN for fewer than two values or any
+ * infinite one. */
+double aggregates_value(const aggregates *a, const aggregate_spec *spec);
+
+#endif
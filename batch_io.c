@@ -0,0 +1,600 @@
+#define _GNU_SOURCE
+
+#include "batch_io.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING 1
+#else
+#define HAVE_IO_URING 0
+#endif
+
+enum { CANCEL_TAG, READ_TAG, WRITE_TAG };
+
+/* Performs one read or write at a time for the thread backend. */
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int fd;
+    bool is_writer;
+    bool pending;
+    bool shutdown;
+    char *buffer;
+    size_t length;
+    ssize_t result; /* bytes read, or for writes, length or -1 */
+} io_worker;
+
+#if HAVE_IO_URING
+/* The parts of a ring set up by io_uring_setup(2) that are used here. */
+typedef struct {
+    int fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    _Atomic unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    int32_t results[3]; /* by tag, once completed */
+    bool completed[3];
+} io_ring;
+#endif
+
+struct batch_io {
+    batch_io_mode mode; /* as resolved, never BATCH_IO_AUTO */
+    int in_fd;
+    int out_fd;
+    bool write_lines;
+    char *in_buffers[2];
+    size_t in_current;
+    size_t in_length;
+    size_t in_position;
+    bool reading; /* into the other input buffer */
+    bool at_eof;
+    char *partial; /* a line that continues into the next block */
+    size_t partial_length;
+    size_t partial_capacity;
+    char *out_buffers[2];
+    size_t out_current;
+    size_t out_length;
+    bool writing; /* from the other output buffer */
+    char *write_buffer; /* what is being written */
+    size_t write_length;
+    char *sync_read_buffer; /* read when it is waited for, not ahead */
+    ssize_t sync_write_result;
+    io_worker reader;
+    io_worker writer;
+#if HAVE_IO_URING
+    io_ring ring;
+#endif
+};
+
+static ssize_t read_once(const int fd, char *buffer, const size_t length) {
+    ssize_t n;
+    do {
+        n = read(fd, buffer, length);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+static ssize_t write_fully(const int fd, const char *buffer, const size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        const ssize_t n = write(fd, buffer + done, length - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += (size_t) n;
+    }
+    return (ssize_t) length;
+}
+
+/* A reader blocked on a pipe is cancelled if reading stops early, so
+ * cancellation is enabled only while the lock is not held. */
+static ssize_t cancellable_read(const int fd, char *buffer, const size_t length) {
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, nullptr);
+    const ssize_t n = read_once(fd, buffer, length);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
+    return n;
+}
+
+static void *run_worker(void *context) {
+    io_worker *w = context;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->pending && !w->shutdown) {
+            pthread_cond_wait(&w->changed, &w->lock);
+        }
+        if (w->shutdown) {
+            break;
+        }
+        pthread_mutex_unlock(&w->lock);
+        const ssize_t result = w->is_writer ? write_fully(w->fd, w->buffer, w->length)
+                                            : cancellable_read(w->fd, w->buffer, w->length);
+        pthread_mutex_lock(&w->lock);
+        w->result = result;
+        w->pending = false;
+        pthread_cond_broadcast(&w->changed);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return nullptr;
+}
+
+static bool start_worker(io_worker *w, const int fd, const bool is_writer) {
+    w->fd = fd;
+    w->is_writer = is_writer;
+    w->pending = false;
+    w->shutdown = false;
+    pthread_mutex_init(&w->lock, nullptr);
+    pthread_cond_init(&w->changed, nullptr);
+    if (pthread_create(&w->thread, nullptr, run_worker, w) != 0) {
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->changed);
+        return false;
+    }
+    return true;
+}
+
+static void stop_worker(io_worker *w) {
+    pthread_mutex_lock(&w->lock);
+    w->shutdown = true;
+    pthread_cond_broadcast(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, nullptr);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->changed);
+}
+
+static void submit_to_worker(io_worker *w, char *buffer, const size_t length) {
+    pthread_mutex_lock(&w->lock);
+    w->buffer = buffer;
+    w->length = length;
+    w->pending = true;
+    pthread_cond_broadcast(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static ssize_t wait_for_worker(io_worker *w) {
+    pthread_mutex_lock(&w->lock);
+    while (w->pending) {
+        pthread_cond_wait(&w->changed, &w->lock);
+    }
+    const ssize_t result = w->result;
+    pthread_mutex_unlock(&w->lock);
+    return result;
+}
+
+#if HAVE_IO_URING
+/* Fails, leaving nothing to clean up, where io_uring is missing, disabled,
+ * or too old to read and write at the current file position. */
+static bool ring_open(io_ring *ring) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    const long fd = syscall(__NR_io_uring_setup, 4, &params);
+    if (fd < 0) {
+        return false;
+    }
+    ring->fd = (int) fd;
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(ring->fd);
+        return false;
+    }
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        ring->sq_ring_size = ring->cq_ring_size > ring->sq_ring_size ? ring->cq_ring_size : ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(nullptr, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd,
+                         IORING_OFF_SQ_RING);
+    ring->cq_ring = single_mmap ? ring->sq_ring
+                                : mmap(nullptr, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd,
+                                       IORING_OFF_CQ_RING);
+    ring->sqes = mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->sq_ring != MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+        }
+        if (!single_mmap && ring->cq_ring != MAP_FAILED) {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        if (ring->sqes != MAP_FAILED) {
+            munmap(ring->sqes, ring->sqes_size);
+        }
+        close(ring->fd);
+        return false;
+    }
+    char *sq = ring->sq_ring;
+    char *cq = ring->cq_ring;
+    ring->sq_tail = (_Atomic unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->cq_head = (_Atomic unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (_Atomic unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    memset(ring->completed, 0, sizeof(ring->completed));
+    return true;
+}
+
+static void ring_close(io_ring *ring) {
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    munmap(ring->sqes, ring->sqes_size);
+    close(ring->fd);
+}
+
+/* Reads and writes at the current file position, which is all that pipes
+ * support, so there is at most one of each in flight. */
+static bool ring_submit(io_ring *ring, const int opcode, const int fd, void *buffer, const size_t length,
+                        const int tag) {
+    const unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    const unsigned index = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (uint8_t) opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buffer;
+    sqe->len = (uint32_t) length;
+    if (opcode != IORING_OP_ASYNC_CANCEL) {
+        sqe->off = (uint64_t) -1;
+    }
+    sqe->user_data = (uint64_t) tag;
+    ring->sq_array[index] = index;
+    ring->completed[tag] = false;
+    atomic_store_explicit(ring->sq_tail, tail + 1, memory_order_release);
+    long submitted;
+    do {
+        submitted = syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, nullptr, 0);
+    } while (submitted < 0 && errno == EINTR);
+    return submitted == 1;
+}
+
+/* Completions come in any order, so the other one is kept for later. */
+static int32_t ring_wait(io_ring *ring, const int tag) {
+    while (!ring->completed[tag]) {
+        const unsigned head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+        if (head == atomic_load_explicit(ring->cq_tail, memory_order_acquire)) {
+            if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0
+                && errno != EINTR) {
+                return -errno;
+            }
+            continue;
+        }
+        const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+        ring->results[cqe->user_data] = cqe->res;
+        ring->completed[cqe->user_data] = true;
+        atomic_store_explicit(ring->cq_head, head + 1, memory_order_release);
+    }
+    return ring->results[tag];
+}
+#endif
+
+static bool start_read(batch_io *io, char *buffer) {
+    switch (io->mode) {
+#if HAVE_IO_URING
+        case BATCH_IO_URING:
+            return ring_submit(&io->ring, IORING_OP_READ, io->in_fd, buffer, BATCH_IO_BLOCK, READ_TAG);
+#endif
+        case BATCH_IO_THREADS:
+            submit_to_worker(&io->reader, buffer, BATCH_IO_BLOCK);
+            return true;
+        default:
+            io->sync_read_buffer = buffer;
+            return true;
+    }
+}
+
+static ssize_t finish_read(batch_io *io) {
+    switch (io->mode) {
+#if HAVE_IO_URING
+        case BATCH_IO_URING: {
+            const int32_t result = ring_wait(&io->ring, READ_TAG);
+            return result < 0 ? -1 : result;
+        }
+#endif
+        case BATCH_IO_THREADS:
+            return wait_for_worker(&io->reader);
+        default:
+            return read_once(io->in_fd, io->sync_read_buffer, BATCH_IO_BLOCK);
+    }
+}
+
+/* Stops a read that is in flight when reading ends early. */
+static void cancel_read(batch_io *io) {
+    switch (io->mode) {
+#if HAVE_IO_URING
+        case BATCH_IO_URING:
+            if (ring_submit(&io->ring, IORING_OP_ASYNC_CANCEL, -1, (void *) (uintptr_t) READ_TAG, 0, CANCEL_TAG)) {
+                ring_wait(&io->ring, CANCEL_TAG);
+            }
+            ring_wait(&io->ring, READ_TAG);
+            break;
+#endif
+        case BATCH_IO_THREADS:
+            pthread_cancel(io->reader.thread);
+            break;
+        default:
+            break;
+    }
+}
+
+static bool start_write(batch_io *io, char *buffer, const size_t length) {
+    io->write_buffer = buffer;
+    io->write_length = length;
+    switch (io->mode) {
+#if HAVE_IO_URING
+        case BATCH_IO_URING:
+            return ring_submit(&io->ring, IORING_OP_WRITE, io->out_fd, buffer, length, WRITE_TAG);
+#endif
+        case BATCH_IO_THREADS:
+            submit_to_worker(&io->writer, buffer, length);
+            return true;
+        default:
+            io->sync_write_result = write_fully(io->out_fd, buffer, length);
+            return true;
+    }
+}
+
+/* Short writes are resubmitted until everything is written. */
+static bool finish_write(batch_io *io) {
+    switch (io->mode) {
+#if HAVE_IO_URING
+        case BATCH_IO_URING:
+            for (;;) {
+                const int32_t result = ring_wait(&io->ring, WRITE_TAG);
+                if (result == -EINTR || result == -EAGAIN) {
+                    continue;
+                }
+                if (result <= 0) {
+                    return false;
+                }
+                if ((size_t) result == io->write_length) {
+                    return true;
+                }
+                if (!start_write(io, io->write_buffer + result, io->write_length - (size_t) result)) {
+                    return false;
+                }
+            }
+#endif
+        case BATCH_IO_THREADS:
+            return wait_for_worker(&io->writer) >= 0;
+        default:
+            return io->sync_write_result >= 0;
+    }
+}
+
+static batch_io_mode resolve_mode(batch_io *io, batch_io_mode mode) {
+    if (mode == BATCH_IO_AUTO) {
+        if (isatty(io->in_fd) || isatty(io->out_fd)) {
+            return BATCH_IO_SYNC;
+        }
+        mode = BATCH_IO_URING;
+    }
+#if HAVE_IO_URING
+    if (mode == BATCH_IO_URING && ring_open(&io->ring)) {
+        return BATCH_IO_URING;
+    }
+#endif
+    if (mode == BATCH_IO_SYNC) {
+        return BATCH_IO_SYNC;
+    }
+    if (!start_worker(&io->reader, io->in_fd, false)) {
+        return BATCH_IO_SYNC;
+    }
+    if (!start_worker(&io->writer, io->out_fd, true)) {
+        stop_worker(&io->reader);
+        return BATCH_IO_SYNC;
+    }
+    return BATCH_IO_THREADS;
+}
+
+static void free_io(batch_io *io) {
+    switch (io->mode) {
+#if HAVE_IO_URING
+        case BATCH_IO_URING:
+            ring_close(&io->ring);
+            break;
+#endif
+        case BATCH_IO_THREADS:
+            stop_worker(&io->reader);
+            stop_worker(&io->writer);
+            break;
+        default:
+            break;
+    }
+    for (size_t q = 0; q < 2; q++) {
+        free(io->in_buffers[q]);
+        free(io->out_buffers[q]);
+    }
+    free(io->partial);
+    free(io);
+}
+
+status batch_io_open(const int in_fd, const int out_fd, const batch_io_mode mode, batch_io **out) {
+    batch_io *io = calloc(1, sizeof(batch_io));
+    if (io == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    io->in_fd = in_fd;
+    io->out_fd = out_fd;
+    io->write_lines = isatty(out_fd);
+    io->mode = BATCH_IO_SYNC;
+    for (size_t q = 0; q < 2; q++) {
+        io->in_buffers[q] = malloc(BATCH_IO_BLOCK);
+        io->out_buffers[q] = malloc(BATCH_IO_BLOCK);
+        if (io->in_buffers[q] == NULL || io->out_buffers[q] == NULL) {
+            free_io(io);
+            return OUT_OF_MEMORY;
+        }
+    }
+    io->mode = resolve_mode(io, mode);
+    /* the first block goes to the buffer after the current one */
+    io->in_current = 1;
+    if (!start_read(io, io->in_buffers[0])) {
+        free_io(io);
+        return IO_ERROR;
+    }
+    io->reading = true;
+    *out = io;
+    return OK;
+}
+
+static status append_partial(batch_io *io, const char *s, const size_t length) {
+    if (io->partial_length + length + 1 > io->partial_capacity) {
+        size_t capacity = io->partial_capacity > 0 ? io->partial_capacity : 256;
+        while (io->partial_length + length + 1 > capacity) {
+            capacity *= 2;
+        }
+        char *partial = realloc(io->partial, capacity);
+        if (partial == NULL) {
+            return OUT_OF_MEMORY;
+        }
+        io->partial = partial;
+        io->partial_capacity = capacity;
+    }
+    memcpy(io->partial + io->partial_length, s, length);
+    io->partial_length += length;
+    io->partial[io->partial_length] = '\0';
+    return OK;
+}
+
+/* Waits for the block in flight, and starts reading the next one into
+ * the buffer just consumed. */
+static status next_block(batch_io *io) {
+    const ssize_t n = finish_read(io);
+    io->reading = false;
+    if (n < 0) {
+        return IO_ERROR;
+    }
+    io->in_current = 1 - io->in_current;
+    io->in_length = (size_t) n;
+    io->in_position = 0;
+    if (n == 0) {
+        io->at_eof = true;
+        return OK;
+    }
+    if (!start_read(io, io->in_buffers[1 - io->in_current])) {
+        return IO_ERROR;
+    }
+    io->reading = true;
+    return OK;
+}
+
+status batch_io_read_line(batch_io *io, char **out_line) {
+    io->partial_length = 0;
+    for (;;) {
+        if (io->in_position == io->in_length) {
+            if (io->at_eof) {
+                *out_line = io->partial_length > 0 ? io->partial : nullptr;
+                return OK;
+            }
+            const status st = next_block(io);
+            if (st != OK) {
+                return st;
+            }
+            continue;
+        }
+        char *start = io->in_buffers[io->in_current] + io->in_position;
+        const size_t available = io->in_length - io->in_position;
+        char *newline = memchr(start, '\n', available);
+        if (newline == NULL) {
+            /* the buffer is about to be read into again, so keep the tail */
+            const status st = append_partial(io, start, available);
+            if (st != OK) {
+                return st;
+            }
+            io->in_position = io->in_length;
+            continue;
+        }
+        *newline = '\0';
+        io->in_position += (size_t) (newline - start) + 1;
+        if (io->partial_length == 0) {
+            *out_line = start;
+            return OK;
+        }
+        const status st = append_partial(io, start, (size_t) (newline - start));
+        *out_line = io->partial;
+        return st;
+    }
+}
+
+/* Waits for the other buffer to be written, and starts writing this one. */
+static status flush(batch_io *io) {
+    if (io->writing && !finish_write(io)) {
+        io->writing = false;
+        return IO_ERROR;
+    }
+    io->writing = false;
+    if (io->out_length == 0) {
+        return OK;
+    }
+    if (!start_write(io, io->out_buffers[io->out_current], io->out_length)) {
+        return IO_ERROR;
+    }
+    io->writing = true;
+    io->out_current = 1 - io->out_current;
+    io->out_length = 0;
+    return OK;
+}
+
+status batch_io_write(batch_io *io, const char *s, size_t length) {
+    while (length > 0) {
+        if (io->out_length == BATCH_IO_BLOCK) {
+            const status st = flush(io);
+            if (st != OK) {
+                return st;
+            }
+        }
+        const size_t n = length < BATCH_IO_BLOCK - io->out_length ? length : BATCH_IO_BLOCK - io->out_length;
+        memcpy(io->out_buffers[io->out_current] + io->out_length, s, n);
+        io->out_length += n;
+        s += n;
+        length -= n;
+    }
+    if (!io->write_lines) {
+        return OK;
+    }
+    status st = flush(io);
+    if (st == OK && io->writing) {
+        st = finish_write(io) ? OK : IO_ERROR;
+        io->writing = false;
+    }
+    return st;
+}
+
+status batch_io_close(batch_io *io) {
+    status st = flush(io);
+    if (io->writing && !finish_write(io) && st == OK) {
+        st = IO_ERROR;
+    }
+    if (io->reading) {
+        cancel_read(io);
+    }
+    free_io(io);
+    return st;
+}
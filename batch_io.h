@@ -0,0 +1,32 @@
+#ifndef CCALC_BATCH_IO_H
+#define CCALC_BATCH_IO_H
+
+#include <stddef.h>
+#include "status.h"
+
+/* Bytes per read and per write. */
+#define BATCH_IO_BLOCK (1 << 20)
+
+typedef enum {
+    BATCH_IO_AUTO, /* io_uring, else threads; sync for terminals */
+    BATCH_IO_SYNC, /* read(2) and write(2) in turn with evaluation */
+    BATCH_IO_THREADS, /* a reader and a writer thread */
+    BATCH_IO_URING, /* io_uring, else threads */
+} batch_io_mode;
+
+/* Line input and output for batch mode, in blocks of BATCH_IO_BLOCK with
+ * two buffers each way: while the lines of one input block are evaluated,
+ * the next block is read into the other buffer, and while results fill
+ * one output buffer, the other one is written. Output to a terminal is
+ * written line by line. */
+typedef struct batch_io batch_io;
+
+status batch_io_open(int in_fd, int out_fd, batch_io_mode mode, batch_io **out);
+/* The next line, without its newline, valid until the next call. NULL at
+ * the end of input. */
+status batch_io_read_line(batch_io *io, char **out_line);
+status batch_io_write(batch_io *io, const char *s, size_t length);
+/* Writes out what is buffered, and frees io. */
+status batch_io_close(batch_io *io);
+
+#endif
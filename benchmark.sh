@@ -0,0 +1,192 @@
+#!/bin/sh
+
+# Times calc on generated workloads. Compare two builds by running this
+# script once with each, e.g. CMD=./calc-old ./benchmark.sh powers
+
+if test -z "${CMD}"
+then
+    CMD=./calc
+fi
+
+if test ! -x "${CMD}"
+then
+    echo "No executable '${CMD}' found. Build the program before running benchmarks."
+    exit 1
+fi
+
+if test -z "${ROWS}"
+then
+    ROWS=10000000
+fi
+
+if test -z "${BATCH_MB}"
+then
+    BATCH_MB=10240
+fi
+
+if test -z "${RUNS}"
+then
+    RUNS=5000
+fi
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "${WORK_DIR}"' EXIT
+
+now_ms() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+# time_command DESCRIPTION COMMAND...
+time_command() {
+    DESCRIPTION=$1
+    shift
+    START=$(now_ms)
+    "$@" > /dev/null
+    END=$(now_ms)
+    printf "%-50s %8d ms\n" "${DESCRIPTION}" $((END - START))
+}
+
+# run_repeatedly N COMMAND...
+run_repeatedly() {
+    N=$1
+    shift
+    while test "${N}" -gt 0
+    do
+        "$@"
+        N=$((N - 1))
+    done
+}
+
+# make_column FILE: ROWS doubles in [0, 1]
+make_column() {
+    head -c $((ROWS * 8)) /dev/urandom > "$1.bits"
+    "${CMD}" --input r="$1.bits" --raw-output "if(abs(r) < 1e300, abs(sin(r)), 0.5)" > "$1"
+    rm -f "$1.bits"
+}
+
+bench_powers() {
+    make_column "${WORK_DIR}/x.bin"
+    for EXPRESSION in "x^2" "x^3" "x^-1" "3*x^3 + 2*x^2 + x + 1" "x^7 - x^5 + x^3 - x" "x^2.5"
+    do
+        time_command "${EXPRESSION}" "${CMD}" --input x="${WORK_DIR}/x.bin" --raw-output "${EXPRESSION}"
+    done
+    EXPRESSION="1.0001^3 + 2.5^2 - 0.99^7"
+    yes "${EXPRESSION}" | head -n 100000 > "${WORK_DIR}/lines.txt"
+    time_command "100000 lines of ${EXPRESSION}" "${CMD}" --batch < "${WORK_DIR}/lines.txt"
+}
+
+# Fitted-model style polynomials, with and without -O
+bench_polynomials() {
+    make_column "${WORK_DIR}/x.bin"
+    for EXPRESSION in "3*x^3 + 2*x^2 + x + 1" \
+                      "0.5*x^5 - 1.25*x^4 + 2*x^3 - 0.75*x^2 + 3*x - 4" \
+                      "1 + x + x^2/2 + x^3/6 + x^4/24 + x^5/120 + x^6/720 + x^7/5040 + x^8/40320" \
+                      "(x + 1)^4 - 2*(x - 1)^3"
+    do
+        time_command "${EXPRESSION}" "${CMD}" --input x="${WORK_DIR}/x.bin" --raw-output "${EXPRESSION}"
+        time_command "-O ${EXPRESSION}" "${CMD}" -O --input x="${WORK_DIR}/x.bin" --raw-output "${EXPRESSION}"
+    done
+    EXPRESSION="0.5*x^5 - 1.25*x^4 + 2*x^3 - 0.75*x^2 + 3*x - 4"
+    printf 'def p(x) = %s\n' "${EXPRESSION}" > "${WORK_DIR}/lines.txt"
+    seq 1 100000 | sed 's/.*/p(&)/' >> "${WORK_DIR}/lines.txt"
+    time_command "100000 calls of p(x)" "${CMD}" --batch < "${WORK_DIR}/lines.txt"
+    time_command "-O 100000 calls of p(x)" "${CMD}" -O --batch < "${WORK_DIR}/lines.txt"
+}
+
+bench_sweep() {
+    EXPRESSION="sin(x)/x"
+    SWEEP="x=0:10:$(awk "BEGIN { print 10 / ${ROWS} }")"
+    time_command "${ROWS} rows of ${EXPRESSION}, raw" "${CMD}" --sweep "${SWEEP}" --raw-output "${EXPRESSION}"
+    time_command "${ROWS} rows of ${EXPRESSION}, raw, 1 thread" "${CMD}" --threads 1 --sweep "${SWEEP}" --raw-output "${EXPRESSION}"
+    time_command "${ROWS} rows of ${EXPRESSION}, text" "${CMD}" --sweep "${SWEEP}" "${EXPRESSION}"
+}
+
+bench_fast_math() {
+    make_column "${WORK_DIR}/x.bin"
+    for EXPRESSION in "sin(x)" "cos(x)" "exp(x)" "ln(x + 1)" "tanh(x)" \
+                      "sin(x) * exp(-x) + tanh(ln(x + 1))"
+    do
+        time_command "${EXPRESSION}" "${CMD}" --input x="${WORK_DIR}/x.bin" --raw-output "${EXPRESSION}"
+        time_command "--fast-math=4 ${EXPRESSION}" "${CMD}" --fast-math=4 --input x="${WORK_DIR}/x.bin" --raw-output "${EXPRESSION}"
+    done
+}
+
+bench_aggregate() {
+    EXPRESSION="sin(x)"
+    SWEEP="x=0:10:$(awk "BEGIN { print 10 / ${ROWS} }")"
+    time_command "${ROWS} rows of ${EXPRESSION}, summed by awk" sh -c \
+        "'${CMD}' --sweep '${SWEEP}' '${EXPRESSION}' | awk '{ s += \$1 } END { print s }'"
+    time_command "${ROWS} rows of ${EXPRESSION}, --aggregate sum" "${CMD}" --sweep "${SWEEP}" --aggregate-only \
+        --aggregate sum "${EXPRESSION}"
+    time_command "${ROWS} rows of ${EXPRESSION}, --aggregate all" "${CMD}" --sweep "${SWEEP}" --aggregate-only \
+        --aggregate count,sum,mean,min,max,stddev,p50,p99 "${EXPRESSION}"
+}
+
+# Element-wise expressions and reductions over vectors of ROWS doubles,
+# and the same work row by row through --input columns.
+bench_vectors() {
+    make_column "${WORK_DIR}/v"
+    make_column "${WORK_DIR}/w"
+    time_command "v * 2 + w, --input rows" "${CMD}" --raw-output --input v="${WORK_DIR}/v" \
+        --input w="${WORK_DIR}/w" "v * 2 + w"
+    time_command "v * 2 + w, --vector" "${CMD}" --raw-output --vector v="${WORK_DIR}/v" \
+        --vector w="${WORK_DIR}/w" "v * 2 + w"
+    time_command "v * w, --input rows, --aggregate sum" "${CMD}" --aggregate-only --aggregate sum \
+        --input v="${WORK_DIR}/v" --input w="${WORK_DIR}/w" "v * w"
+    time_command "dot(v, w), --vector" "${CMD}" --vector v="${WORK_DIR}/v" --vector w="${WORK_DIR}/w" "dot(v, w)"
+    time_command "norm(v * 2 + w), --vector" "${CMD}" --vector v="${WORK_DIR}/v" --vector w="${WORK_DIR}/w" \
+        "norm(v * 2 + w)"
+    rm -f "${WORK_DIR}/v" "${WORK_DIR}/w"
+}
+
+# File to file --batch runs of BATCH_MB of expressions, with reading,
+# evaluating and writing in turn, and overlapped by two kinds of I/O.
+bench_batch_io() {
+    awk 'BEGIN { for (i = 0; i < 16384; i++) printf "%d * 1.5 + sqrt(%d)\n", i, i }' > "${WORK_DIR}/chunk"
+    CHUNK_BYTES=$(wc -c < "${WORK_DIR}/chunk")
+    run_repeatedly $((BATCH_MB * 1048576 / CHUNK_BYTES + 1)) cat "${WORK_DIR}/chunk" > "${WORK_DIR}/input"
+    for MODE in sync threads io-uring
+    do
+        START=$(now_ms)
+        "${CMD}" --batch --io "${MODE}" < "${WORK_DIR}/input" > "${WORK_DIR}/output"
+        END=$(now_ms)
+        printf "%-50s %8d ms %8d MB/s\n" "${BATCH_MB} MB, --io ${MODE}" $((END - START)) \
+            $((BATCH_MB * 1000 / (END - START + 1)))
+    done
+    rm -f "${WORK_DIR}/input" "${WORK_DIR}/output"
+}
+
+# A Monte Carlo estimate of pi from ROWS samples, with the random inputs
+# fed in as literals, and drawn by calc with --repeat.
+bench_random() {
+    awk -v rows="${ROWS}" 'BEGIN { srand(1); for (i = 0; i < rows; i++) printf "4 * (%.17g^2 + %.17g^2 <= 1)\n", rand(), rand() }' \
+        > "${WORK_DIR}/samples"
+    time_command "${ROWS} samples, literals through --batch" "${CMD}" --batch < "${WORK_DIR}/samples"
+    time_command "${ROWS} samples, --repeat" "${CMD}" --seed 1 --repeat "${ROWS}" --raw-output \
+        "4 * (rand()^2 + rand()^2 <= 1)"
+    time_command "${ROWS} samples, --repeat, --aggregate mean" "${CMD}" --seed 1 --repeat "${ROWS}" \
+        --aggregate-only --aggregate mean "4 * (rand()^2 + rand()^2 <= 1)"
+    time_command "${ROWS} samples of randn(), --repeat" "${CMD}" --seed 1 --repeat "${ROWS}" --raw-output "randn()"
+    rm -f "${WORK_DIR}/samples"
+}
+
+# One process per expression, as in A=$(calc "3+1"), so that startup is
+# nearly all of the time. The total includes the shell forking each run.
+bench_startup() {
+    for EXPRESSION in "3+1" "sqrt(2) * pi"
+    do
+        time_command "${RUNS} runs of '${EXPRESSION}'" run_repeatedly "${RUNS}" "${CMD}" "${EXPRESSION}"
+    done
+    time_command "${RUNS} runs of -r '3 1 +'" run_repeatedly "${RUNS}" "${CMD}" -r "3 1 +"
+}
+
+if test $# -eq 0
+then
+    set -- powers
+fi
+
+for BENCHMARK in "$@"
+do
+    echo "== ${BENCHMARK} (${CMD})"
+    "bench_${BENCHMARK}"
+done
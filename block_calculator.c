@@ -0,0 +1,152 @@
+#include <float.h>
+#include <stdlib.h>
+#include <tgmath.h>
+
+#include "block_calculator.h"
+#include "fast_math.h"
+#include "power.h"
+#include "program.h"
+#include "random.h"
+#include "resource_limits.h"
+#include "stack_calculator.h"
+#include "tokenizer.h"
+
+#define PI_LONG_DOUBLE 3.14159265358979323846264338327950288L
+#define E_LONG_DOUBLE 2.71828182845904523536028747135266250L
+
+/* Rows per block. The scratch blocks of a whole stack fit in L1 for
+ * typical expressions. */
+#define BLOCK_SIZE 256
+
+/* Element i of a result depends on element i of the operands only, and
+ * the result is either one of the operands or apart from them, so the
+ * loops vectorize without checks for overlap. */
+#if defined(__clang__)
+#define INDEPENDENT_ITERATIONS _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+#define INDEPENDENT_ITERATIONS _Pragma("GCC ivdep")
+#else
+#define INDEPENDENT_ITERATIONS
+#endif
+
+#define UNARY_LOOP(expr) \
+    INDEPENDENT_ITERATIONS \
+    for (size_t i = 0; i < n; i++) { \
+        const NUMBER x = a[i]; \
+        dst[i] = (expr); \
+    }
+
+#define BINARY_LOOP(expr) \
+    INDEPENDENT_ITERATIONS \
+    for (size_t i = 0; i < n; i++) { \
+        const NUMBER x = a[i]; \
+        const NUMBER y = b[i]; \
+        dst[i] = (expr); \
+    }
+
+static bool is_straight_line(const dynamic_array *tokens) {
+    const token *t = tokens->elements;
+    for (size_t q = 0; q < tokens->size; q++) {
+        if (t[q].type == JUMP || t[q].type == JUMP_IF_FALSE || t[q].type == JUMP_IF_TRUE
+            || t[q].type == CALL || t[q].type == ARGUMENT) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#define NUMBER double
+#define TYPED(name) name
+#define LITERAL(token) ((token).value)
+#define RANDOM_BITS 52
+#define COLUMNS_ARE_NUMBERS 1
+#include "block_calculator_template.h"
+#undef NUMBER
+#undef TYPED
+#undef LITERAL
+#undef RANDOM_BITS
+#undef COLUMNS_ARE_NUMBERS
+
+#define NUMBER float
+#define TYPED(name) name##_float
+#define LITERAL(token) ((float) (token).value)
+#define RANDOM_BITS FLT_MANT_DIG
+#define COLUMNS_ARE_NUMBERS 0
+#include "block_calculator_template.h"
+#undef NUMBER
+#undef TYPED
+#undef LITERAL
+#undef RANDOM_BITS
+#undef COLUMNS_ARE_NUMBERS
+
+#define NUMBER long double
+#define TYPED(name) name##_long_double
+#define LITERAL(token) value_token_literal(&(token))
+#define RANDOM_BITS 52
+#define COLUMNS_ARE_NUMBERS 0
+#include "block_calculator_template.h"
+#undef NUMBER
+#undef TYPED
+#undef LITERAL
+#undef RANDOM_BITS
+#undef COLUMNS_ARE_NUMBERS
+
+/* Draws as the blocks do: row by row from the same first draw, after
+ * which the next evaluation starts past the most any row took. */
+static status calculate_rows(const precision precision, dynamic_array *tokens, const symbol_table *symbols,
+                             const double *const *columns, const size_t num_columns, const size_t count,
+                             double *out) {
+    double values[num_columns + 1];
+    const uint64_t first_row = random_row;
+    const uint64_t first_draw = random_draw;
+    uint64_t next_draw = first_draw;
+    status st = OK;
+    for (size_t row = 0; row < count && st == OK; row++) {
+        for (size_t k = 0; k < num_columns; k++) {
+            values[k] = columns[k][row];
+        }
+        random_row = first_row + row;
+        random_draw = first_draw;
+        long double result;
+        st = stack_calculate_at(precision, tokens, symbols, values, &result);
+        if (st == OK) {
+            out[row] = (double) result;
+        }
+        next_draw = random_draw > next_draw ? random_draw : next_draw;
+    }
+    random_row = first_row;
+    random_draw = next_draw;
+    return st;
+}
+
+status block_calculate(const precision precision, dynamic_array *tokens, const symbol_table *symbols,
+                       const double *const *columns, const size_t num_columns, const size_t count, double *out) {
+    if (!is_straight_line(tokens)) {
+        return calculate_rows(precision, tokens, symbols, columns, num_columns, count, out);
+    }
+    size_t max_depth;
+    const status st = program_verify(tokens->elements, tokens->size, num_columns, &max_depth);
+    if (st == INVALID_PROGRAM) {
+        /* let the scalar evaluator report exactly what is wrong */
+        return calculate_rows(precision, tokens, symbols, columns, num_columns, count, out);
+    }
+    if (st != OK) {
+        return st;
+    }
+    if (active_limits.max_stack_depth > 0 && max_depth > active_limits.max_stack_depth) {
+        return STACK_TOO_DEEP;
+    }
+    status block_status;
+    switch (precision) {
+        case SINGLE_PRECISION:
+            block_status = calculate_blocks_float(tokens, columns, count, max_depth, out);
+            break;
+        case EXTENDED_PRECISION:
+            block_status = calculate_blocks_long_double(tokens, columns, count, max_depth, out);
+            break;
+        default:
+            block_status = calculate_blocks(tokens, columns, count, max_depth, out);
+    }
+    random_draw += random_draws_in(tokens->elements, tokens->size);
+    return block_status;
+}
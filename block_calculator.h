@@ -0,0 +1,17 @@
+#ifndef CCALC_BLOCK_CALCULATOR_H
+#define CCALC_BLOCK_CALCULATOR_H
+
+#include "dynarr.h"
+#include "precision.h"
+#include "status.h"
+#include "symbols.h"
+
+/* Evaluates tokens once per row in the given precision, for count rows,
+ * where VARIABLE k reads columns[k][row]. Straight-line programs run one
+ * operator at a time over blocks of rows; anything else falls back to
+ * stack_calculate_at() per row. Row q draws random numbers for
+ * random_row + q, starting at random_draw. */
+status block_calculate(precision precision, dynamic_array *tokens, const symbol_table *symbols,
+                       const double *const *columns, size_t num_columns, size_t count, double *out);
+
+#endif
@@ -0,0 +1,329 @@
+/* The block kernels, instantiated by block_calculator.c once per
+ * precision. Before including this file, define NUMBER as the value type,
+ * TYPED(name) to name the instance's functions, LITERAL(token) to convert
+ * a VALUE token, RANDOM_BITS as for the stack evaluator, and
+ * COLUMNS_ARE_NUMBERS to 1 when NUMBER is double. Math functions come from
+ * <tgmath.h>, so they follow NUMBER. No include guard, on purpose. */
+
+static void TYPED(fill)(NUMBER *dst, const NUMBER value, const size_t n) {
+    INDEPENDENT_ITERATIONS
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = value;
+    }
+}
+
+static status TYPED(unary_kernel)(const token *t, const NUMBER *a, NUMBER *dst, const size_t n) {
+    if (t->type == OPERATOR) {
+        if (t->operator != NEGATION) {
+            return UNHANDLED_OPERATOR;
+        }
+        UNARY_LOOP(-x);
+        return OK;
+    }
+    switch (t->function) {
+        case ABS:
+            UNARY_LOOP(fabs(x));
+            break;
+        case ACOS:
+            UNARY_LOOP(acos(x));
+            break;
+        case ASIN:
+            UNARY_LOOP(asin(x));
+            break;
+        case ATAN:
+            UNARY_LOOP(atan(x));
+            break;
+        case COS:
+            UNARY_LOOP(cos(x));
+            break;
+        case COSH:
+            UNARY_LOOP(cosh(x));
+            break;
+        case EXP:
+            UNARY_LOOP(exp(x));
+            break;
+        case LN:
+            UNARY_LOOP(log(x));
+            break;
+        case LOG:
+            UNARY_LOOP(log10(x));
+            break;
+        case ROUND:
+            UNARY_LOOP(round(x));
+            break;
+        case SIN:
+            UNARY_LOOP(sin(x));
+            break;
+        case SINH:
+            UNARY_LOOP(sinh(x));
+            break;
+        case SQRT:
+            UNARY_LOOP(sqrt(x));
+            break;
+        case TAN:
+            UNARY_LOOP(tan(x));
+            break;
+        case TANH:
+            UNARY_LOOP(tanh(x));
+            break;
+        case TRUNC:
+            UNARY_LOOP(trunc(x));
+            break;
+        case NEG:
+            UNARY_LOOP(-x);
+            break;
+        case NORM:
+            UNARY_LOOP(fabs(x));
+            break;
+        case SUM:
+            UNARY_LOOP(x);
+            break;
+        case FAST_SIN:
+            UNARY_LOOP((NUMBER) fast_sin((double) x));
+            break;
+        case FAST_COS:
+            UNARY_LOOP((NUMBER) fast_cos((double) x));
+            break;
+        case FAST_EXP:
+            UNARY_LOOP((NUMBER) fast_exp((double) x));
+            break;
+        case FAST_LN:
+            UNARY_LOOP((NUMBER) fast_ln((double) x));
+            break;
+        case FAST_TANH:
+            UNARY_LOOP((NUMBER) fast_tanh((double) x));
+            break;
+        default:
+            return UNHANDLED_FUNCTION;
+    }
+    return OK;
+}
+
+static status TYPED(binary_kernel)(const operator_token ot, const NUMBER *a, const NUMBER *b, NUMBER *dst, const size_t n) {
+    switch (ot) {
+        case ADDITION:
+            BINARY_LOOP(x + y);
+            break;
+        case SUBTRACTION:
+            BINARY_LOOP(x - y);
+            break;
+        case MULTIPLICATION:
+            BINARY_LOOP(x * y);
+            break;
+        case DIVISION:
+            BINARY_LOOP(x / y);
+            break;
+        case MODULUS:
+            BINARY_LOOP(fmod(x, y));
+            break;
+        case EXPONENTIATION:
+            BINARY_LOOP(TYPED(power)(x, y));
+            break;
+        case LESS:
+            BINARY_LOOP(x < y ? 1.0 : 0.0);
+            break;
+        case LESS_OR_EQUAL:
+            BINARY_LOOP(x <= y ? 1.0 : 0.0);
+            break;
+        case GREATER:
+            BINARY_LOOP(x > y ? 1.0 : 0.0);
+            break;
+        case GREATER_OR_EQUAL:
+            BINARY_LOOP(x >= y ? 1.0 : 0.0);
+            break;
+        case EQUAL:
+            BINARY_LOOP(x == y ? 1.0 : 0.0);
+            break;
+        case NOT_EQUAL:
+            BINARY_LOOP(x != y ? 1.0 : 0.0);
+            break;
+        case AND:
+            BINARY_LOOP(x != 0.0 && y != 0.0 ? 1.0 : 0.0);
+            break;
+        case OR:
+            BINARY_LOOP(x != 0.0 || y != 0.0 ? 1.0 : 0.0);
+            break;
+        default:
+            return UNHANDLED_OPERATOR;
+    }
+    return OK;
+}
+
+static void TYPED(integer_power_kernel)(const NUMBER *a, const long exponent, NUMBER *dst, const size_t n) {
+    switch (exponent) {
+        case 2:
+            UNARY_LOOP(x * x);
+            break;
+        case 3:
+            UNARY_LOOP(x * x * x);
+            break;
+        case -1:
+            UNARY_LOOP(1.0 / x);
+            break;
+        default:
+            UNARY_LOOP(TYPED(integer_power)(x, exponent));
+    }
+}
+
+static void TYPED(select_kernel)(const NUMBER *c, const NUMBER *a, const NUMBER *b, NUMBER *dst, const size_t n) {
+    INDEPENDENT_ITERATIONS
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = c[i] != 0.0 ? a[i] : b[i];
+    }
+}
+
+static void TYPED(fma_kernel)(const NUMBER *a, const NUMBER *b, const NUMBER *c, NUMBER *dst, const size_t n) {
+    INDEPENDENT_ITERATIONS
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = fma(a[i], b[i], c[i]);
+    }
+}
+
+/* Element i is drawn for row first + i, so a block draws for all of its
+ * rows at once. */
+static void TYPED(uniform_kernel)(const uint64_t first, const uint64_t draw, NUMBER *dst, const size_t n) {
+    INDEPENDENT_ITERATIONS
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = (NUMBER) random_uniform(first + i, draw, RANDOM_BITS);
+    }
+}
+
+static void TYPED(normal_kernel)(const uint64_t first, const uint64_t draw, NUMBER *dst, const size_t n) {
+    INDEPENDENT_ITERATIONS
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = (NUMBER) random_normal(first + i, draw);
+    }
+}
+
+static void TYPED(integer_kernel)(const NUMBER *a, const NUMBER *b, const uint64_t first, const uint64_t draw,
+                                  NUMBER *dst, const size_t n) {
+    INDEPENDENT_ITERATIONS
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = (NUMBER) random_integer((double) a[i], (double) b[i], first + i, draw);
+    }
+}
+
+/* Each stack level owns a scratch block. When columns already hold
+ * NUMBERs, a level holding a variable points straight into the column
+ * instead, so inputs are never copied. */
+static status TYPED(calculate_block)(const token *program, const size_t size, const double *const *columns,
+                              const size_t first_row, const size_t n, NUMBER *scratch, const NUMBER **slots,
+                              double *out) {
+    status st = OK;
+    size_t depth = 0;
+    uint64_t draw = random_draw;
+    for (size_t q = 0; q < size && st == OK; q++) {
+        const token *t = &program[q];
+        NUMBER *dst;
+        switch (t->type) {
+            case VALUE:
+                dst = scratch + depth * BLOCK_SIZE;
+                TYPED(fill)(dst, LITERAL(*t), n);
+                slots[depth++] = dst;
+                break;
+            case CONSTANT:
+                dst = scratch + depth * BLOCK_SIZE;
+                TYPED(fill)(dst, (NUMBER) (t->constant == PI ? PI_LONG_DOUBLE : E_LONG_DOUBLE), n);
+                slots[depth++] = dst;
+                break;
+            case VARIABLE:
+#if COLUMNS_ARE_NUMBERS
+                slots[depth++] = columns[t->variable] + first_row;
+#else
+                dst = scratch + depth * BLOCK_SIZE;
+                for (size_t i = 0; i < n; i++) {
+                    dst[i] = (NUMBER) columns[t->variable][first_row + i];
+                }
+                slots[depth++] = dst;
+#endif
+                break;
+            case OPERATOR:
+                if (t->operator == NEGATION) {
+                    dst = scratch + (depth - 1) * BLOCK_SIZE;
+                    st = TYPED(unary_kernel)(t, slots[depth - 1], dst, n);
+                    slots[depth - 1] = dst;
+                } else {
+                    dst = scratch + (depth - 2) * BLOCK_SIZE;
+                    st = TYPED(binary_kernel)(t->operator, slots[depth - 2], slots[depth - 1], dst, n);
+                    slots[depth - 2] = dst;
+                    depth--;
+                }
+                break;
+            case INTEGER_POWER:
+                dst = scratch + (depth - 1) * BLOCK_SIZE;
+                TYPED(integer_power_kernel)(slots[depth - 1], t->exponent, dst, n);
+                slots[depth - 1] = dst;
+                break;
+            case FUNCTION:
+                if (t->function == RAND || t->function == RANDN) {
+                    dst = scratch + depth * BLOCK_SIZE;
+                    if (t->function == RAND) {
+                        TYPED(uniform_kernel)(random_row + first_row, draw++, dst, n);
+                    } else {
+                        TYPED(normal_kernel)(random_row + first_row, draw++, dst, n);
+                    }
+                    slots[depth++] = dst;
+                } else if (t->function == RANDINT) {
+                    dst = scratch + (depth - 2) * BLOCK_SIZE;
+                    TYPED(integer_kernel)(slots[depth - 2], slots[depth - 1], random_row + first_row, draw++, dst, n);
+                    slots[depth - 2] = dst;
+                    depth--;
+                } else if (t->function == IF || t->function == FMA) {
+                    dst = scratch + (depth - 3) * BLOCK_SIZE;
+                    if (t->function == IF) {
+                        TYPED(select_kernel)(slots[depth - 3], slots[depth - 2], slots[depth - 1], dst, n);
+                    } else {
+                        TYPED(fma_kernel)(slots[depth - 3], slots[depth - 2], slots[depth - 1], dst, n);
+                    }
+                    slots[depth - 3] = dst;
+                    depth -= 2;
+                } else if (t->function == DOT) {
+                    dst = scratch + (depth - 2) * BLOCK_SIZE;
+                    st = TYPED(binary_kernel)(MULTIPLICATION, slots[depth - 2], slots[depth - 1], dst, n);
+                    slots[depth - 2] = dst;
+                    depth--;
+                } else {
+                    dst = scratch + (depth - 1) * BLOCK_SIZE;
+                    st = TYPED(unary_kernel)(t, slots[depth - 1], dst, n);
+                    slots[depth - 1] = dst;
+                }
+                break;
+            case VECTOR:
+                st = UNEXPECTED_VECTOR;
+                break;
+            default:
+                st = UNHANDLED_TOKEN_TYPE;
+        }
+    }
+    if (st == OK) {
+        INDEPENDENT_ITERATIONS
+        for (size_t i = 0; i < n; i++) {
+            out[i] = (double) slots[0][i];
+        }
+    }
+    return st;
+}
+
+static status TYPED(calculate_blocks)(dynamic_array *tokens, const double *const *columns, const size_t count,
+                                      const size_t max_depth, double *out) {
+    NUMBER *scratch = malloc(max_depth * BLOCK_SIZE * sizeof(NUMBER));
+    const NUMBER **slots = malloc(max_depth * sizeof(NUMBER *));
+    if (scratch == NULL || slots == NULL) {
+        free(scratch);
+        free(slots);
+        return OUT_OF_MEMORY;
+    }
+    status st = OK;
+    for (size_t first_row = 0; first_row < count && st == OK; first_row += BLOCK_SIZE) {
+        const size_t n = count - first_row < BLOCK_SIZE ? count - first_row : BLOCK_SIZE;
+        st = limits_step(tokens->size * n);
+        if (st != OK) {
+            break;
+        }
+        st = TYPED(calculate_block)(tokens->elements, tokens->size, columns, first_row, n, scratch, slots,
+                                    out + first_row);
+    }
+    free(scratch);
+    free(slots);
+    return st;
+}
@@ -1,6 +1,6 @@
 #!/bin/sh
 
-gcc -O2 -std=c2x -o calc *.c -lm && strip calc
+gcc -O3 -std=c2x -o calc *.c -lm && strip calc
 if test "$?" = "0"
 then
     CMD=./calc ./regression-test.sh
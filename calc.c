@@ -1,12 +1,48 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <errno.h>
+#include <float.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "aggregate.h"
+#include "batch_io.h"
+#include "block_calculator.h"
+#include "columns.h"
+#include "definition.h"
+#include "fast_math.h"
+#include "parallel_calculator.h"
 #include "parser.h"
+#include "program.h"
+#include "random.h"
+#include "resource_limits.h"
+#include "rpn_stream.h"
+#include "sheet.h"
 #include "status.h"
 #include "stack_calculator.h"
+#include "sweep.h"
+#include "symbols.h"
 #include "tokenizer.h"
+#include "vector_calculator.h"
+#include "work_pool.h"
+
+/* Values per column handed to the evaluator at a time. */
+#define COLUMN_BLOCK_SIZE 65536
+/* Characters of a long line shown around an error in it. */
+#define SNIPPET_WIDTH 72
+
+typedef struct {
+    int raw_output;
+    precision precision;
+    const aggregate_spec *aggregate_specs;
+    size_t num_aggregates;
+    aggregates *aggregate; /* results are added here, unless NULL */
+    bool aggregate_only; /* print the aggregates, but not the results */
+} output_format;
 
 static void help(void) {
     printf("%s\n",
@@ -16,23 +52,116 @@ static void help(void) {
            "\n"
            "Options:\n"
            "\n"
-           "  -h, --help  show this help\n"
-           "  -r, --rpn   use \"Reverse Polish Notation\" (postfix)\n"
+           "  -h, --help   show this help\n"
+           "  -r, --rpn    use \"Reverse Polish Notation\" (postfix)\n"
+           "  -b, --batch  read expressions from stdin, one per line, and\n"
+           "               print one result per line\n"
+           "  --io auto|sync|threads|io-uring\n"
+           "               how --batch reads and writes: in blocks, with\n"
+           "               the next read and the previous write overlapping\n"
+           "               evaluation through io_uring or I/O threads, or\n"
+           "               in turn with it (default: auto, which is\n"
+           "               io-uring where available, and sync for\n"
+           "               terminals)\n"
+           "  --compile    compile the expression to a binary program file\n"
+           "               given by -o, instead of evaluating it\n"
+           "  -o FILE      output file for --compile\n"
+           "  --load FILE  evaluate a program written by --compile\n"
+           "  --input NAME=FILE\n"
+           "               bind variable NAME to a column of raw little-endian\n"
+           "               doubles read from FILE (- for stdin), and evaluate\n"
+           "               once per row. Files are memory-mapped.\n"
+           "  --vector NAME=FILE\n"
+           "               bind variable NAME to all the raw doubles of FILE\n"
+           "               as one vector, for expressions like v * 2 + w\n"
+           "  -O, --optimize\n"
+           "               rewrite polynomials in one variable to Horner\n"
+           "               form with fused multiply-adds. Faster and\n"
+           "               usually more accurate, so results may differ\n"
+           "               in the last digits.\n"
+           "  --aggregate LIST\n"
+           "               also print aggregates of the results, from a\n"
+           "               comma-separated list of count, sum, mean, min,\n"
+           "               max, stddev and pN, the N-th percentile, which\n"
+           "               is within 1%. Computed as results come out.\n"
+           "  --aggregate-only\n"
+           "               print the aggregates, but not the results\n"
+           "  --fast-math=ULP\n"
+           "               use faster approximations of sin, cos, exp, ln\n"
+           "               and tanh, each where its maximum error is at\n"
+           "               most ULP units in the last place of a double\n"
+           "  --check-fast-math\n"
+           "               sample the approximations across their domains,\n"
+           "               and print the largest error found for each\n"
+           "  --raw-output write results as raw doubles instead of text\n"
+           "  --precision float|double|long-double\n"
+           "               evaluate in the given floating-point type\n"
+           "               (default: double). Raw input and output stay\n"
+           "               doubles.\n"
+           "  --sheet FILE evaluate a file of named formulas, one\n"
+           "               \"name = expression\" per line, then read changed\n"
+           "               formulas from stdin and recompute what they affect\n"
+           "  --sweep NAME=START:STOP:STEP\n"
+           "               evaluate once for each NAME from START to STOP,\n"
+           "               inclusive. Repeat for a grid; the last sweep\n"
+           "               varies fastest.\n"
+           "  --repeat N   evaluate N times, with new random numbers each\n"
+           "               time. With --sweep, N times for each point.\n"
+           "  --seed N     seed for rand(), randn() and randint(), to make\n"
+           "               runs reproducible (default: differs per run)\n"
+           "  --threads N  worker threads for --sheet, --sweep and very\n"
+           "               large expressions (default: one per CPU)\n"
+           "\n"
+           "Resource limits, for untrusted input (0 means unlimited, except\n"
+           "for --max-nesting, which never goes beyond 5000):\n"
+           "\n"
+           "  --max-input-bytes N  longest expression accepted\n"
+           "  --max-tokens N       most tokens in one expression\n"
+           "  --max-nesting N      deepest nesting of parentheses, brackets\n"
+           "                       and arguments in one expression\n"
+           "                       (default 1000, at most 5000)\n"
+           "  --max-stack N        deepest evaluation stack\n"
+           "  --max-steps N        most evaluation steps per row\n"
+           "  --timeout MS         wall-clock limit per row\n"
            "\n"
-           "Operators: - * / % ^\n"
-           "Functions: abs, acos, asin, atan, cos, cosh, exp, ln, log, neg,\n"
-           "           round, sin, sinh, sqrt, tan, tanh, trunc\n"
+           "A row is one evaluation: of the expression, a batch line, a sheet\n"
+           "cell, or one row of --input, --sweep or --repeat. Rows evaluated\n"
+           "together in a block share the block's total.\n"
+           "\n"
+           "Operators: + - * / % ^ < <= > >= == != and or\n"
+           "Functions: abs, acos, asin, atan, cos, cosh, exp, fma, ln, log,\n"
+           "           neg, round, sin, sinh, sqrt, tan, tanh, trunc, if\n"
+           "Vectors:   [1, 2, 3], with operators and functions applied to\n"
+           "           each element, numbers broadcast, and the reductions\n"
+           "           dot(v, w), norm(v) and sum(v)\n"
+           "Random:    rand() in [0, 1), randn() standard normal, and\n"
+           "           randint(a, b) from a to b inclusive\n"
            "Constants: e, pi\n"
            "\n"
            "For default infix expressions, function arguments must be given\n"
-           "in parenthesis. For RPN, parenthesis are illegal.\n"
+           "in parenthesis. For RPN, parenthesis are illegal. RPN read from\n"
+           "stdin is evaluated as it streams in, in constant memory.\n"
+           "\n"
+           "Comparisons, and, or yield 1 or 0. if(c, a, b) evaluates only\n"
+           "the branch taken, and and/or short-circuit.\n"
+           "\n"
+           "In batch mode, a line like \"def f(x, y) = x * y + 1\" defines a\n"
+           "function for the following lines. \"def memo f(x) = ...\" also\n"
+           "caches results, which pays off for recursive definitions. Calls\n"
+           "nest at most 10000 deep, whatever --max-nesting says. Names of\n"
+           "built-in functions and constants, dot, norm and sum among them,\n"
+           "cannot be defined or bound as variables. A syntax error is\n"
+           "printed as \"error: LINE:COLUMN: message\", and the line is shown\n"
+           "on stderr with a caret under the part at fault.\n"
            "\n"
            "Examples:\n"
            "  calc \"sin(3.1415926)\"\n"
-           "  calc \"(5 3) * 7\"\n"
+           "  calc \"(5 + 3) * 7\"\n"
            "  calc \"2^3\"\n"
+           "  calc \"if(2 > 1, 5, sqrt(-1))\"\n"
+           "  calc \"dot([1, 2, 3], [4, 5, 6])\"\n"
            "  calc -r \"pi sin\"\n"
-           "  calc -r \"5 3 7 *\"\n"
+           "  calc -r \"5 3 + 7 *\"\n"
            "  calc -r \"2 3 ^\"\n"
            "  for Unix sh: A=`calc \"3+1\"`; B=`calc \"$A*4\"`\n");
 }
@@ -59,11 +188,16 @@ static void print_error(const status st) {
 }
 
 static status read_from_stdin(char **s) {
-    int c;
-    char cs[] = {'\0', '\0'};
-    while ((c = fgetc(stdin)) != EOF) {
-        cs[0] = (char) c;
-        const status st = add_to_string(s, cs);
+    char chunk[4096];
+    size_t n;
+    size_t total = 0;
+    while ((n = fread(chunk, 1, sizeof(chunk) - 1, stdin)) > 0) {
+        total += n;
+        if (active_limits.max_input_bytes > 0 && total > active_limits.max_input_bytes) {
+            return INPUT_TOO_LARGE;
+        }
+        chunk[n] = '\0';
+        const status st = add_to_string(s, chunk);
         if (st != OK) {
             return st;
         }
@@ -71,37 +205,633 @@ static status read_from_stdin(char **s) {
     return OK;
 }
 
-static status calculate(const char *expression, const int rpn, double *out) {
+static status calculate(const char *expression, const compile_options *options, const precision precision,
+                        const symbol_table *symbols, const vector_bindings *vectors, const result_writer write,
+                        void *write_context, vector_result *out, source_span *out_span) {
+    dynamic_array *tokens;
+    limits_start();
+    out->is_vector = false;
+    status st = compile_expression(expression, options, symbols, &tokens, out_span);
+    if (st != OK) {
+        return st;
+    }
+    if (has_vectors(tokens, vectors)) {
+        st = vector_calculate(precision, tokens, symbols, vectors, write, write_context, out);
+    } else {
+        st = stack_calculate_at(precision, tokens, symbols, nullptr, &out->number);
+    }
+    dynarr_free(tokens);
+    return st;
+}
+
+/* Significant digits that survive a round trip through the type. */
+static int printed_digits(const precision precision) {
+    switch (precision) {
+        case SINGLE_PRECISION:
+            return FLT_DIG;
+        case EXTENDED_PRECISION:
+            return LDBL_DIG;
+        default:
+            return 15;
+    }
+}
+
+static status aggregate_result(const long double result, const output_format *format) {
+    if (format->aggregate == NULL) {
+        return OK;
+    }
+    const double value = (double) result;
+    return aggregates_add(format->aggregate, &value, 1);
+}
+
+static status print_result(const long double result, const output_format *format) {
+    const status st = aggregate_result(result, format);
+    if (st != OK || format->aggregate_only) {
+        return st;
+    }
+    if (format->raw_output) {
+        double value = (double) result;
+        return column_write(STDOUT_FILENO, &value, 1);
+    }
+    printf("%.*LG\n", printed_digits(format->precision), result);
+    return OK;
+}
+
+static status parse_precision(const char *arg, precision *out) {
+    if (strcmp(arg, "float") == 0) {
+        *out = SINGLE_PRECISION;
+    } else if (strcmp(arg, "double") == 0) {
+        *out = DOUBLE_PRECISION;
+    } else if (strcmp(arg, "long-double") == 0) {
+        *out = EXTENDED_PRECISION;
+    } else {
+        return INVALID_OPTION_ARGUMENT;
+    }
+    return OK;
+}
+
+static status parse_io_mode(const char *arg, batch_io_mode *out) {
+    if (strcmp(arg, "auto") == 0) {
+        *out = BATCH_IO_AUTO;
+    } else if (strcmp(arg, "sync") == 0) {
+        *out = BATCH_IO_SYNC;
+    } else if (strcmp(arg, "threads") == 0) {
+        *out = BATCH_IO_THREADS;
+    } else if (strcmp(arg, "io-uring") == 0) {
+        *out = BATCH_IO_URING;
+    } else {
+        return INVALID_OPTION_ARGUMENT;
+    }
+    return OK;
+}
+
+/* A positive number of units in the last place. */
+static status parse_ulps(const char *arg, double *out) {
+    char *end;
+    *out = strtod(arg, &end);
+    return end != arg && *end == '\0' && *out > 0 && isfinite(*out) ? OK : INVALID_OPTION_ARGUMENT;
+}
+
+static status parse_count(const char *arg, uint64_t *out) {
+    char *end;
+    if (!isdigit((unsigned char) *arg)) {
+        return INVALID_OPTION_ARGUMENT;
+    }
+    *out = strtoull(arg, &end, 10);
+    return *end == '\0' ? OK : INVALID_OPTION_ARGUMENT;
+}
+
+static status set_limit(const char *option, const char *arg) {
+    uint64_t value;
+    const status st = parse_count(arg, &value);
+    if (st != OK) {
+        return st;
+    }
+    if (strcmp(option, "--max-input-bytes") == 0) {
+        active_limits.max_input_bytes = value;
+    } else if (strcmp(option, "--max-tokens") == 0) {
+        active_limits.max_tokens = value;
+    } else if (strcmp(option, "--max-nesting") == 0) {
+        active_limits.max_nesting_depth = value;
+    } else if (strcmp(option, "--max-stack") == 0) {
+        active_limits.max_stack_depth = value;
+    } else if (strcmp(option, "--max-steps") == 0) {
+        active_limits.max_steps = value;
+    } else {
+        active_limits.timeout_ms = value;
+    }
+    return OK;
+}
+
+static bool is_limit_option(const char *arg) {
+    return strcmp(arg, "--max-input-bytes") == 0 || strcmp(arg, "--max-tokens") == 0
+           || strcmp(arg, "--max-nesting") == 0 || strcmp(arg, "--max-stack") == 0
+           || strcmp(arg, "--max-steps") == 0 || strcmp(arg, "--timeout") == 0;
+}
+
+/* results are rounded to double, so long double digits would be noise */
+static int double_digits(const precision precision) {
+    return precision == SINGLE_PRECISION ? FLT_DIG : 15;
+}
+
+static status write_results(double *results, const size_t count, void *context) {
+    const output_format *format = context;
+    if (format->raw_output) {
+        return column_write(STDOUT_FILENO, results, count);
+    }
+    const int digits = double_digits(format->precision);
+    for (size_t q = 0; q < count; q++) {
+        printf("%.*G\n", digits, results[q]);
+    }
+    return OK;
+}
+
+/* Where the elements of a vector result go as they are computed: to the
+ * aggregates, and out as "[1, 2, 3]", the way vector literals are written,
+ * or as raw doubles. Text goes to io, or to stdout when io is NULL. */
+typedef struct {
+    const output_format *format;
+    batch_io *io;
+    size_t written;
+} vector_output;
+
+static status put_text(const vector_output *out, const char *text, const size_t length) {
+    if (out->io != NULL) {
+        return batch_io_write(out->io, text, length);
+    }
+    return fwrite(text, 1, length, stdout) == length ? OK : IO_ERROR;
+}
+
+static status write_elements(double *elements, const size_t count, void *context) {
+    vector_output *out = context;
+    const output_format *format = out->format;
+    status st = format->aggregate != NULL ? aggregates_add(format->aggregate, elements, count) : OK;
+    if (st != OK || format->aggregate_only) {
+        return st;
+    }
+    if (format->raw_output && out->io == NULL) {
+        return column_write(STDOUT_FILENO, elements, count);
+    }
+    const int digits = double_digits(format->precision);
+    for (size_t q = 0; q < count && st == OK; q++) {
+        char text[64];
+        const int length = snprintf(text, sizeof(text), out->written++ > 0 ? ", %.*G" : "[%.*G", digits, elements[q]);
+        st = put_text(out, text, length);
+    }
+    return st;
+}
+
+/* Closes the brackets, once all elements are written. */
+static status end_vector(const vector_output *out) {
+    if (out->format->aggregate_only || out->format->raw_output && out->io == NULL) {
+        return OK;
+    }
+    return out->written > 0 ? put_text(out, "]\n", 2) : put_text(out, "[]\n", 3);
+}
+
+/* As "name = value" lines, or as raw doubles in the order asked for. */
+static status print_aggregates(const output_format *format) {
+    for (size_t q = 0; q < format->num_aggregates; q++) {
+        double value = aggregates_value(format->aggregate, &format->aggregate_specs[q]);
+        if (format->raw_output) {
+            const status st = column_write(STDOUT_FILENO, &value, 1);
+            if (st != OK) {
+                return st;
+            }
+        } else {
+            printf("%s = %.*G\n", format->aggregate_specs[q].name, double_digits(format->precision), value);
+        }
+    }
+    return OK;
+}
+
+/* Adds the variable NAME of a NAME=FILE option, and points to FILE. */
+static status bind_variable(const char *spec, symbol_table *symbols, const char **out_path) {
+    const char *eq = strchr(spec, '=');
+    if (eq == NULL || eq == spec || eq[1] == '\0') {
+        return INVALID_OPTION_ARGUMENT;
+    }
+    char *name = strndup(spec, eq - spec);
+    if (name == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    size_t idx;
+    const status st = is_reserved_identifier(name) ? RESERVED_NAME : symbols_add_variable(symbols, name, &idx);
+    free(name);
+    *out_path = eq + 1;
+    return st;
+}
+
+static status bind_input(const char *spec, const size_t block_size, symbol_table *symbols, column_input *out) {
+    const char *path;
+    const status st = bind_variable(spec, symbols, &path);
+    if (st != OK) {
+        return st;
+    }
+    return column_open(path, block_size, out);
+}
+
+/* A whole column, bound to NAME as a vector. */
+static status bind_vector(const char *spec, symbol_table *symbols, column_input *out) {
+    const char *path;
+    const status st = bind_variable(spec, symbols, &path);
+    if (st != OK) {
+        return st;
+    }
+    return column_load(path, out);
+}
+
+/* Pulls one block from every column at a time; mapped columns hand out
+ * pointers into the mapping, so the evaluator reads the files in place. */
+static status run_columns(dynamic_array *tokens, const symbol_table *symbols, column_input *columns,
+                          const size_t num_columns, const output_format *format) {
+    double *results = malloc(COLUMN_BLOCK_SIZE * sizeof(double));
+    if (results == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    const double *blocks[num_columns];
     status st = OK;
-    dynamic_array *tokens = nullptr;
-    st = tokenize(expression, &tokens);
+    size_t row = 0;
+    for (;;) {
+        size_t count = 0;
+        for (size_t k = 0; k < num_columns && st == OK; k++) {
+            size_t column_count;
+            st = column_next_block(&columns[k], &blocks[k], &column_count);
+            if (st == OK && k > 0 && column_count != count) {
+                st = COLUMN_LENGTH_MISMATCH;
+            }
+            count = column_count;
+        }
+        if (st != OK || count == 0) {
+            break;
+        }
+        limits_start_rows(count);
+        random_start(row);
+        row += count;
+        st = block_calculate(format->precision, tokens, symbols, blocks, num_columns, count, results);
+        if (st == OK && format->aggregate != NULL) {
+            st = aggregates_add(format->aggregate, results, count);
+        }
+        if (st == OK && !format->aggregate_only) {
+            st = write_results(results, count, (void *) format);
+        }
+        if (st != OK) {
+            break;
+        }
+    }
+    free(results);
+    return st;
+}
+
+static void print_sheet(const sheet *sheet, const size_t recomputed) {
+    sheet_print(sheet, stdout);
+    printf("# recomputed %zu of %zu cells\n", recomputed, sheet->num_cells);
+}
+
+/* Evaluates every cell once, then applies one changed formula per line
+ * of stdin, printing the cells each change recomputed. */
+static status run_sheet(const char *path, const compile_options *options, const precision precision,
+                        const size_t num_threads) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        return IO_ERROR;
+    }
+    sheet *sheet = nullptr;
+    work_pool *pool = nullptr;
+    char *line = nullptr;
+    size_t line_capacity = 0;
+    status st = sheet_load(in, options, precision, &sheet);
+    fclose(in);
+    if (st != OK) {
+        return st;
+    }
+    st = pool_new(num_threads, &pool);
     if (st != OK) {
         goto end;
     }
-    if (!rpn) {
-        dynamic_array *out_tokens = nullptr;
-        st = convert_infix_to_postfix(tokens, &out_tokens);
-        if (st != OK) {
+    size_t recomputed;
+    st = sheet_recompute_all(sheet, pool, &recomputed);
+    if (st != OK) {
+        goto end;
+    }
+    print_sheet(sheet, recomputed);
+    while (getline(&line, &line_capacity, stdin) != -1) {
+        if (is_sheet_comment(line)) {
+            continue;
+        }
+        st = sheet_update(sheet, line, pool, &recomputed);
+        if (st == OUT_OF_MEMORY) {
             goto end;
         }
-        dynarr_free(tokens);
-        tokens = out_tokens;
+        if (st != OK) {
+            print_error(st);
+            st = OK;
+            continue;
+        }
+        print_sheet(sheet, recomputed);
     }
-    st = stack_calculate(tokens, out);
 end:
-    dynarr_free(tokens);
+    free(line);
+    if (pool != NULL) {
+        pool_free(pool);
+    }
+    sheet_free(sheet);
     return st;
 }
 
+/* Shows where in line an error was found, on stderr, so that results stay
+ * one line per input line: the text around it, cut to fit a terminal, and
+ * carets under the part at fault. */
+static void print_error_snippet(const char *line, const size_t line_number, const source_span span) {
+    const size_t length = strlen(line);
+    const size_t first = span.offset > SNIPPET_WIDTH / 2 ? span.offset - SNIPPET_WIDTH / 2 : 0;
+    const size_t last = first + SNIPPET_WIDTH < length ? first + SNIPPET_WIDTH : length;
+    const int indent = fprintf(stderr, "%zu:%zu: %s", line_number, span.offset + 1, first > 0 ? "..." : "");
+    for (size_t i = first; i < last; i++) {
+        fputc(isprint((unsigned char) line[i]) ? line[i] : ' ', stderr);
+    }
+    fputs(last < length ? "...\n" : "\n", stderr);
+    const size_t carets = span.offset < last && span.length < last - span.offset ? span.length
+                          : span.offset < last                                 ? last - span.offset
+                                                                               : 1;
+    fprintf(stderr, "%*s", indent + (int) (span.offset - first), "");
+    for (size_t i = 0; i < carets; i++) {
+        fputc('^', stderr);
+    }
+    fputc('\n', stderr);
+}
+
+static bool is_blank(const char *s) {
+    while (*s != '\0') {
+        if (!isspace(*s)) {
+            return false;
+        }
+        s++;
+    }
+    return true;
+}
+
+/* Lines are read and results written in blocks, through batch_io, so
+ * that with io_uring or I/O threads the I/O overlaps with evaluation. */
+static status run_batch(const compile_options *options, const output_format *format, const batch_io_mode io_mode,
+                        const vector_bindings *vectors, symbol_table *symbols) {
+    batch_io *io;
+    status st = batch_io_open(STDIN_FILENO, STDOUT_FILENO, io_mode, &io);
+    if (st != OK) {
+        return st;
+    }
+    char *line;
+    size_t line_number = 0;
+    while ((st = batch_io_read_line(io, &line)) == OK && line != NULL) {
+        line_number++;
+        if (is_blank(line)) {
+            continue;
+        }
+        status line_status;
+        source_span span;
+        vector_result result = {.is_vector = false, .number = NAN};
+        vector_output output = {.format = format, .io = io, .written = 0};
+        char text[128];
+        int length = 0;
+        if (is_definition(line)) {
+            line_status = define_function(line, options, symbols, &span);
+        } else {
+            line_status = calculate(line, options, format->precision, symbols, vectors, write_elements, &output,
+                                    &result, &span);
+            if (line_status == OK && result.is_vector) {
+                line_status = end_vector(&output);
+            } else if (line_status == OK) {
+                line_status = aggregate_result(result.number, format);
+            }
+            if (line_status == OK && !format->aggregate_only && !result.is_vector) {
+                length = snprintf(text, sizeof(text), "%.*LG\n", printed_digits(format->precision), result.number);
+            }
+        }
+        if (line_status == OUT_OF_MEMORY) {
+            st = line_status;
+            break;
+        }
+        if (line_status != OK && span.length > 0) {
+            length = snprintf(text, sizeof(text), "error: %zu:%zu: %s\n", line_number, span.offset + 1,
+                              status_messages[line_status]);
+            print_error_snippet(line, line_number, span);
+        } else if (line_status != OK) {
+            length = snprintf(text, sizeof(text), "error: %s\n", status_messages[line_status]);
+        }
+        st = batch_io_write(io, text, length < (int) sizeof(text) ? (size_t) length : sizeof(text) - 1);
+        if (st != OK) {
+            break;
+        }
+    }
+    const status close_status = batch_io_close(io);
+    return st != OK ? st : close_status;
+}
+
+static void write_text(const int fd, const char *s, size_t size) {
+    while (size > 0) {
+        const ssize_t written = write(fd, s, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        s += written;
+        size -= written;
+    }
+}
+
+/* "calc EXPRESSION", the way shell scripts call it, where startup is most
+ * of the time. Skips option parsing and stdio, and writes the result or
+ * error with a single write(2). Returns false, having written nothing,
+ * when any argument may be an option, or when the expression is large
+ * enough for threads, so that the general path applies. */
+static bool run_simple(const int argc, const char *argv[]) {
+    if (argc < 2) {
+        return false;
+    }
+    for (int q = 1; q < argc; q++) {
+        if (argv[q][0] == '-') {
+            return false;
+        }
+    }
+    const compile_options options = {.rpn = false, .optimize = false, .fast_math_ulps = 0};
+    char *expression = nullptr;
+    symbol_table *symbols = nullptr;
+    dynamic_array *tokens = nullptr;
+    long double result = NAN;
+    bool handled = true;
+    status st = OK;
+    for (int q = 1; q < argc && st == OK; q++) {
+        st = add_to_string(&expression, " ");
+        if (st == OK) {
+            st = add_to_string(&expression, argv[q]);
+        }
+    }
+    if (st == OK) {
+        st = symbols_new(&symbols);
+    }
+    if (st == OK) {
+        limits_start();
+        st = compile_expression(expression, &options, symbols, &tokens, nullptr);
+    }
+    if (st == OK && (is_parallel_worthwhile(tokens) || has_vectors(tokens, nullptr))) {
+        handled = false;
+    } else if (st == OK) {
+        st = stack_calculate_at(DOUBLE_PRECISION, tokens, symbols, nullptr, &result);
+    }
+    if (handled) {
+        char line[256];
+        const int n = st == OK ? snprintf(line, sizeof(line), "%.*LG\n", printed_digits(DOUBLE_PRECISION), result)
+                               : snprintf(line, sizeof(line), "error: %s\n", status_messages[st]);
+        write_text(STDOUT_FILENO, line, n < (int) sizeof(line) ? (size_t) n : sizeof(line) - 1);
+    }
+    if (tokens != NULL) {
+        dynarr_free(tokens);
+    }
+    if (symbols != NULL) {
+        symbols_free(symbols);
+    }
+    free(expression);
+    return handled;
+}
+
 int main(const int argc, const char *argv[]) {
+    random_seed = random_default_seed();
+    if (run_simple(argc, argv)) {
+        return 0;
+    }
     status st = OK;
-    int rpn = false;
+    compile_options options = {.rpn = false, .optimize = false, .fast_math_ulps = 0};
+    int batch = false;
+    int compile_only = false;
+    output_format format = {.raw_output = false, .precision = DOUBLE_PRECISION, .aggregate = nullptr};
+    aggregate_spec aggregate_specs[MAX_AGGREGATES];
+    batch_io_mode io_mode = BATCH_IO_AUTO;
+    const char *output_path = nullptr;
+    const char *load_path = nullptr;
+    const char *sheet_path = nullptr;
+    uint64_t num_threads = 0;
+    uint64_t repeat = 0;
+    const char *input_specs[argc];
+    column_input columns[argc];
+    size_t num_inputs = 0;
+    size_t num_columns = 0;
+    const char *vector_specs[argc];
+    column_input vector_columns[argc];
+    const double *vector_elements[argc];
+    size_t vector_lengths[argc];
+    size_t num_vector_specs = 0;
+    vector_bindings vectors = {.elements = vector_elements, .lengths = vector_lengths, .count = 0};
+    const char *sweep_specs[argc];
+    sweep_range sweeps[argc];
+    size_t num_sweeps = 0;
+    work_pool *pool = nullptr;
     char *expression = nullptr;
+    symbol_table *symbols = nullptr;
+    dynamic_array *tokens = nullptr;
+    loaded_program program;
+    program.mapping = nullptr;
 
     for (int q = 1; q < argc; q++) {
         const char *arg = argv[q];
         if (strcmp(arg, "-r") == 0 || strcmp(arg, "--rpn") == 0) {
-            rpn = true;
+            options.rpn = true;
+        } else if (strcmp(arg, "-O") == 0 || strcmp(arg, "--optimize") == 0) {
+            options.optimize = true;
+        } else if (strncmp(arg, "--fast-math=", strlen("--fast-math=")) == 0) {
+            st = parse_ulps(arg + strlen("--fast-math="), &options.fast_math_ulps);
+            if (st != OK) {
+                goto end;
+            }
+        } else if (strcmp(arg, "--check-fast-math") == 0) {
+            return fast_math_check(stdout) ? 0 : 1;
+        } else if (strcmp(arg, "-b") == 0 || strcmp(arg, "--batch") == 0) {
+            batch = true;
+        } else if (strcmp(arg, "--compile") == 0) {
+            compile_only = true;
+        } else if (strcmp(arg, "--raw-output") == 0) {
+            format.raw_output = true;
+        } else if (strcmp(arg, "--aggregate-only") == 0) {
+            format.aggregate_only = true;
+        } else if (strcmp(arg, "--aggregate") == 0) {
+            if (q + 1 >= argc) {
+                st = MISSING_OPTION_ARGUMENT;
+                goto end;
+            }
+            st = aggregate_parse(argv[++q], aggregate_specs, &format.num_aggregates);
+            if (st != OK) {
+                goto end;
+            }
+            format.aggregate_specs = aggregate_specs;
+        } else if (strcmp(arg, "--threads") == 0) {
+            if (q + 1 >= argc) {
+                st = MISSING_OPTION_ARGUMENT;
+                goto end;
+            }
+            st = parse_count(argv[++q], &num_threads);
+            if (st != OK) {
+                goto end;
+            }
+        } else if (strcmp(arg, "--seed") == 0 || strcmp(arg, "--repeat") == 0) {
+            if (q + 1 >= argc) {
+                st = MISSING_OPTION_ARGUMENT;
+                goto end;
+            }
+            st = parse_count(argv[++q], strcmp(arg, "--seed") == 0 ? &random_seed : &repeat);
+            if (st == OK && strcmp(arg, "--repeat") == 0 && repeat == 0) {
+                st = INVALID_OPTION_ARGUMENT;
+            }
+            if (st != OK) {
+                goto end;
+            }
+        } else if (strcmp(arg, "--io") == 0) {
+            if (q + 1 >= argc) {
+                st = MISSING_OPTION_ARGUMENT;
+                goto end;
+            }
+            st = parse_io_mode(argv[++q], &io_mode);
+            if (st != OK) {
+                goto end;
+            }
+        } else if (strcmp(arg, "--precision") == 0) {
+            if (q + 1 >= argc) {
+                st = MISSING_OPTION_ARGUMENT;
+                goto end;
+            }
+            st = parse_precision(argv[++q], &format.precision);
+            if (st != OK) {
+                goto end;
+            }
+            options.precision = format.precision;
+        } else if (strcmp(arg, "-o") == 0 || strcmp(arg, "--load") == 0 || strcmp(arg, "--input") == 0
+                   || strcmp(arg, "--sheet") == 0 || strcmp(arg, "--sweep") == 0 || strcmp(arg, "--vector") == 0) {
+            if (q + 1 >= argc) {
+                st = MISSING_OPTION_ARGUMENT;
+                goto end;
+            }
+            if (strcmp(arg, "-o") == 0) {
+                output_path = argv[++q];
+            } else if (strcmp(arg, "--load") == 0) {
+                load_path = argv[++q];
+            } else if (strcmp(arg, "--sheet") == 0) {
+                sheet_path = argv[++q];
+            } else if (strcmp(arg, "--sweep") == 0) {
+                sweep_specs[num_sweeps++] = argv[++q];
+            } else if (strcmp(arg, "--vector") == 0) {
+                vector_specs[num_vector_specs++] = argv[++q];
+            } else {
+                input_specs[num_inputs++] = argv[++q];
+            }
+        } else if (is_limit_option(arg)) {
+            if (q + 1 >= argc) {
+                st = MISSING_OPTION_ARGUMENT;
+                goto end;
+            }
+            st = set_limit(arg, argv[++q]);
+            if (st != OK) {
+                goto end;
+            }
         } else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
             help();
             return 0;
@@ -116,20 +846,160 @@ int main(const int argc, const char *argv[]) {
             }
         }
     }
-    if (expression == NULL || expression[0] == '\0') {
-        st = read_from_stdin(&expression);
+    st = symbols_new(&symbols);
+    if (st != OK) {
+        goto end;
+    }
+    if (format.num_aggregates > 0) {
+        if (sheet_path != NULL || compile_only) {
+            st = INVALID_OPTION_ARGUMENT;
+            goto end;
+        }
+        st = aggregates_new(aggregate_needs_quantiles(aggregate_specs, format.num_aggregates), &format.aggregate);
         if (st != OK) {
             goto end;
         }
+    } else if (format.aggregate_only) {
+        st = INVALID_OPTION_ARGUMENT;
+        goto end;
     }
-    double result = NAN;
-    st = calculate(expression, rpn, &result);
-end:
-    if (st == OK) {
-        printf("%.15G\n", result);
+    if (num_vector_specs > 0 && (sheet_path != NULL || num_inputs > 0 || num_sweeps > 0 || repeat > 0)
+        || repeat > 0 && (sheet_path != NULL || batch)) {
+        st = INVALID_OPTION_ARGUMENT;
+        goto end;
+    }
+    for (; vectors.count < num_vector_specs; vectors.count++) {
+        st = bind_vector(vector_specs[vectors.count], symbols, &vector_columns[vectors.count]);
+        if (st != OK) {
+            goto end;
+        }
+        vector_elements[vectors.count] = column_values(&vector_columns[vectors.count]);
+        vector_lengths[vectors.count] = vector_columns[vectors.count].count;
+    }
+    limits_start();
+    if (sheet_path != NULL) {
+        st = run_sheet(sheet_path, &options, format.precision, num_threads);
+        goto end;
+    }
+    if (batch) {
+        st = run_batch(&options, &format, io_mode, &vectors, symbols);
+        goto end;
+    }
+    if ((num_sweeps > 0 || repeat > 0) && num_inputs > 0) {
+        st = INVALID_OPTION_ARGUMENT;
+        goto end;
+    }
+    for (size_t q = 0; q < num_sweeps; q++) {
+        st = sweep_parse(sweep_specs[q], symbols, &sweeps[q]);
+        if (st != OK) {
+            goto end;
+        }
+    }
+    for (; num_columns < num_inputs; num_columns++) {
+        st = bind_input(input_specs[num_columns], COLUMN_BLOCK_SIZE, symbols, &columns[num_columns]);
+        if (st != OK) {
+            goto end;
+        }
+    }
+    if (load_path != NULL) {
+        st = program_load(load_path, num_columns + num_sweeps + vectors.count, &program);
+        if (st != OK) {
+            goto end;
+        }
+        tokens = &program.tokens;
+    } else {
+        if (compile_only && output_path == NULL) {
+            st = MISSING_OPTION_ARGUMENT;
+            goto end;
+        }
+        const bool from_stdin = expression == NULL || expression[0] == '\0';
+        if (from_stdin && options.rpn && !options.optimize && options.fast_math_ulps == 0 && !compile_only && num_columns == 0 && num_sweeps == 0
+            && vectors.count == 0 && format.precision == DOUBLE_PRECISION) {
+            double result = NAN;
+            st = rpn_stream_calculate(stdin, symbols, &result);
+            if (st == OK) {
+                st = print_result(result, &format);
+            }
+            goto end;
+        }
+        if (from_stdin) {
+            st = read_from_stdin(&expression);
+            if (st != OK) {
+                goto end;
+            }
+        }
+        st = compile_expression(expression, &options, symbols, &tokens, nullptr);
+        if (st != OK) {
+            goto end;
+        }
+        if (compile_only) {
+            st = program_save(tokens, num_columns + num_sweeps + vectors.count, output_path);
+            goto end;
+        }
+    }
+    if (num_sweeps > 0 || repeat > 0) {
+        /* --repeat is one more sweep, varying fastest, that nothing reads */
+        size_t num_ranges = num_sweeps;
+        if (repeat > 0) {
+            sweeps[num_ranges++] = (sweep_range) {.start = 0, .step = 1, .count = repeat};
+        }
+        st = pool_new(num_threads, &pool);
+        if (st == OK) {
+            st = sweep_run(format.precision, tokens, symbols, sweeps, num_ranges, pool, format.aggregate,
+                           format.aggregate_only ? nullptr : write_results, &format);
+        }
+    } else if (num_columns > 0) {
+        st = run_columns(tokens, symbols, columns, num_columns, &format);
+    } else if (has_vectors(tokens, &vectors)) {
+        vector_output output = {.format = &format, .io = nullptr, .written = 0};
+        vector_result result;
+        st = vector_calculate(format.precision, tokens, symbols, &vectors, write_elements, &output, &result);
+        if (st == OK && result.is_vector) {
+            st = end_vector(&output);
+        } else if (st == OK) {
+            st = print_result(result.number, &format);
+        }
     } else {
+        long double result = NAN;
+        if (format.precision == DOUBLE_PRECISION && is_parallel_worthwhile(tokens)) {
+            double value = NAN;
+            st = pool_new(num_threads, &pool);
+            if (st == OK) {
+                st = parallel_calculate(tokens, symbols, nullptr, 0, pool, &value);
+            }
+            result = value;
+        } else {
+            st = stack_calculate_at(format.precision, tokens, symbols, nullptr, &result);
+        }
+        if (st == OK) {
+            st = print_result(result, &format);
+        }
+    }
+end:
+    if (st == OK && format.aggregate != NULL) {
+        st = print_aggregates(&format);
+    }
+    if (st != OK) {
         print_error(st);
     }
+    aggregates_free(format.aggregate);
+    if (program.mapping != NULL) {
+        program_unload(&program);
+    } else if (tokens != NULL) {
+        dynarr_free(tokens);
+    }
+    for (size_t q = 0; q < num_columns; q++) {
+        column_close(&columns[q]);
+    }
+    for (size_t q = 0; q < vectors.count; q++) {
+        column_close(&vector_columns[q]);
+    }
+    if (pool != NULL) {
+        pool_free(pool);
+    }
+    if (symbols != NULL) {
+        symbols_free(symbols);
+    }
     free(expression);
     return 0;
 }
@@ -0,0 +1,175 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "columns.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Doubles per read when loading a whole column from a pipe. */
+#define COLUMN_LOAD_BLOCK 65536
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define COLUMN_SWAP_BYTES 1
+#else
+#define COLUMN_SWAP_BYTES 0
+#endif
+
+static void swap_bytes(double *values, const size_t count) {
+    for (size_t q = 0; q < count; q++) {
+        unsigned char *b = (unsigned char *) &values[q];
+        for (size_t w = 0; w < sizeof(double) / 2; w++) {
+            const unsigned char t = b[w];
+            b[w] = b[sizeof(double) - 1 - w];
+            b[sizeof(double) - 1 - w] = t;
+        }
+    }
+}
+
+status column_open(const char *path, const size_t block_size, column_input *out) {
+    memset(out, 0, sizeof(*out));
+    out->buffer_capacity = block_size;
+    if (strcmp(path, "-") == 0) {
+        out->fd = STDIN_FILENO;
+    } else {
+        out->fd = open(path, O_RDONLY);
+        if (out->fd < 0) {
+            return IO_ERROR;
+        }
+    }
+    struct stat sb;
+    if (!COLUMN_SWAP_BYTES && fstat(out->fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        if (sb.st_size % sizeof(double) != 0) {
+            column_close(out);
+            return INVALID_COLUMN_DATA;
+        }
+        void *mapping = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, out->fd, 0);
+        if (mapping != MAP_FAILED) {
+            posix_madvise(mapping, sb.st_size, POSIX_MADV_SEQUENTIAL);
+            out->mapping = mapping;
+            out->mapping_size = sb.st_size;
+            out->count = sb.st_size / sizeof(double);
+            return OK;
+        }
+    }
+    out->buffer = malloc(block_size * sizeof(double));
+    if (out->buffer == NULL) {
+        column_close(out);
+        return OUT_OF_MEMORY;
+    }
+    return OK;
+}
+
+static status read_block(column_input *column, size_t *out_count) {
+    char *p = (char *) column->buffer;
+    const size_t capacity = column->buffer_capacity * sizeof(double);
+    size_t filled = 0;
+    while (filled < capacity) {
+        const ssize_t n = read(column->fd, p + filled, capacity - filled);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return IO_ERROR;
+        }
+        if (n == 0) {
+            break;
+        }
+        filled += n;
+    }
+    if (filled % sizeof(double) != 0) {
+        return INVALID_COLUMN_DATA;
+    }
+    *out_count = filled / sizeof(double);
+    if (COLUMN_SWAP_BYTES) {
+        swap_bytes(column->buffer, *out_count);
+    }
+    return OK;
+}
+
+status column_next_block(column_input *column, const double **out_values, size_t *out_count) {
+    if (column->mapping != NULL) {
+        size_t count = column->count - column->position;
+        if (count > column->buffer_capacity) {
+            count = column->buffer_capacity;
+        }
+        *out_values = column->mapping + column->position;
+        *out_count = count;
+        column->position += count;
+        return OK;
+    }
+    *out_values = column->buffer;
+    return read_block(column, out_count);
+}
+
+status column_load(const char *path, column_input *out) {
+    status st = column_open(path, COLUMN_LOAD_BLOCK, out);
+    if (st != OK || out->mapping != NULL) {
+        return st;
+    }
+    double *values = nullptr;
+    size_t capacity = 0;
+    for (;;) {
+        size_t n;
+        st = read_block(out, &n);
+        if (st != OK || n == 0) {
+            break;
+        }
+        if (out->count + n > capacity) {
+            capacity = capacity * 2 > out->count + n ? capacity * 2 : out->count + n;
+            double *grown = realloc(values, capacity * sizeof(double));
+            if (grown == NULL) {
+                st = OUT_OF_MEMORY;
+                break;
+            }
+            values = grown;
+        }
+        memcpy(values + out->count, out->buffer, n * sizeof(double));
+        out->count += n;
+    }
+    free(out->buffer);
+    out->buffer = values;
+    if (st != OK) {
+        column_close(out);
+    }
+    return st;
+}
+
+const double *column_values(const column_input *column) {
+    return column->mapping != NULL ? column->mapping : column->buffer;
+}
+
+void column_close(column_input *column) {
+    if (column->mapping != NULL) {
+        munmap((void *) column->mapping, column->mapping_size);
+    }
+    free(column->buffer);
+    if (column->fd != STDIN_FILENO && column->fd >= 0) {
+        close(column->fd);
+    }
+    column->fd = -1;
+}
+
+status column_write(const int fd, double *values, const size_t count) {
+    if (COLUMN_SWAP_BYTES) {
+        swap_bytes(values, count);
+    }
+    const char *p = (const char *) values;
+    size_t size = count * sizeof(double);
+    while (size > 0) {
+        const ssize_t written = write(fd, p, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return IO_ERROR;
+        }
+        p += written;
+        size -= written;
+    }
+    return OK;
+}
@@ -0,0 +1,30 @@
+#ifndef CCALC_COLUMNS_H
+#define CCALC_COLUMNS_H
+
+#include <stddef.h>
+#include "status.h"
+
+/* A column of raw little-endian doubles. Regular files are memory-mapped
+ * and handed out in place; pipes are read into a block buffer. */
+typedef struct {
+    int fd;
+    const double *mapping;
+    size_t mapping_size;
+    size_t count;
+    size_t position;
+    double *buffer;
+    size_t buffer_capacity;
+} column_input;
+
+status column_open(const char *path, size_t block_size, column_input *out);
+/* Sets out_count to 0 at end of input. */
+status column_next_block(column_input *column, const double **out_values, size_t *out_count);
+/* Reads all of a column at once, into column_values() and count: regular
+ * files stay mapped, anything else is read into one buffer. */
+status column_load(const char *path, column_input *out);
+const double *column_values(const column_input *column);
+void column_close(column_input *column);
+/* On big-endian hosts, values are byte-swapped in place. */
+status column_write(int fd, double *values, size_t count);
+
+#endif
@@ -0,0 +1,189 @@
+#include "definition.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "parser.h"
+#include "tokenizer.h"
+
+#define MEMO_CAPACITY 4096
+
+static const char *skip_whitespace(const char *s) {
+    while (isspace(*s)) {
+        s++;
+    }
+    return s;
+}
+
+static bool is_identifier_start(const char c) {
+    return c == '_' || isalpha(c);
+}
+
+static status scan_name(const char **s, char **out_name) {
+    const char *start = *s;
+    if (!is_identifier_start(*start)) {
+        return INVALID_DEFINITION;
+    }
+    const char *end = start + 1;
+    while (*end == '_' || isalnum(*end)) {
+        end++;
+    }
+    *out_name = strndup(start, end - start);
+    if (*out_name == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    *s = end;
+    return OK;
+}
+
+static bool is_keyword(const char *s, const char *keyword) {
+    const size_t len = strlen(keyword);
+    return strncasecmp(s, keyword, len) == 0 && isspace(s[len]);
+}
+
+bool is_definition(const char *line) {
+    return is_keyword(skip_whitespace(line), "def");
+}
+
+static void free_names(dynamic_array *names) {
+    for (size_t q = 0; q < names->size; q++) {
+        char *name;
+        dynarr_copy(names, q, &name);
+        free(name);
+    }
+    dynarr_free(names);
+}
+
+static bool contains_name(dynamic_array *names, const char *name) {
+    for (size_t q = 0; q < names->size; q++) {
+        const char *other;
+        dynarr_copy(names, q, &other);
+        if (strcasecmp(other, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static status scan_parameters(const char **s, dynamic_array *params) {
+    const char *p = skip_whitespace(*s);
+    if (*p != '(') {
+        return INVALID_DEFINITION;
+    }
+    p = skip_whitespace(p + 1);
+    while (*p != ')') {
+        char *param;
+        status st = scan_name(&p, &param);
+        if (st != OK) {
+            return st;
+        }
+        if (is_reserved_identifier(param)) {
+            free(param);
+            return RESERVED_NAME;
+        }
+        if (contains_name(params, param)) {
+            free(param);
+            return INVALID_DEFINITION;
+        }
+        st = dynarr_append(params, &param);
+        if (st != OK) {
+            free(param);
+            return st;
+        }
+        p = skip_whitespace(p);
+        if (*p == ',') {
+            p = skip_whitespace(p + 1);
+        } else if (*p != ')') {
+            return INVALID_DEFINITION;
+        }
+    }
+    *s = p + 1;
+    return OK;
+}
+
+status define_function(const char *definition, const compile_options *options, symbol_table *symbols,
+                       source_span *out_span) {
+    if (out_span != NULL) {
+        *out_span = (source_span) {.offset = 0, .length = 0};
+    }
+    const char *s = skip_whitespace(definition) + strlen("def");
+    s = skip_whitespace(s);
+    bool memo = false;
+    if (is_keyword(s, "memo") && is_identifier_start(*skip_whitespace(s + strlen("memo")))) {
+        memo = true;
+        s = skip_whitespace(s + strlen("memo"));
+    }
+    user_function function;
+    function.body = nullptr;
+    function.memo = nullptr;
+    const char *name_start = s;
+    status st = scan_name(&s, &function.name);
+    if (st != OK) {
+        return st;
+    }
+    dynamic_array *params = nullptr;
+    size_t idx;
+    if (is_reserved_identifier(function.name)) {
+        /* like sum, which scripts written before it was built in may define */
+        st = RESERVED_NAME;
+        if (out_span != NULL) {
+            out_span->offset = (size_t) (name_start - definition);
+            out_span->length = (size_t) (s - name_start);
+        }
+        goto end;
+    }
+    if (symbols_find_function(symbols, function.name, &idx) || symbols_find_variable(symbols, function.name, &idx)) {
+        st = FUNCTION_ALREADY_DEFINED;
+        goto end;
+    }
+    st = dynarr_new(sizeof(char *), 4, &params);
+    if (st != OK) {
+        goto end;
+    }
+    st = scan_parameters(&s, params);
+    if (st != OK) {
+        goto end;
+    }
+    s = skip_whitespace(s);
+    if (*s != '=') {
+        st = INVALID_DEFINITION;
+        goto end;
+    }
+    function.num_params = params->size;
+    if (memo) {
+        st = memo_new(function.num_params, MEMO_CAPACITY, &function.memo);
+        if (st != OK) {
+            goto end;
+        }
+    }
+    /* registered before the body is compiled, so the body may recurse */
+    st = dynarr_append(symbols->functions, &function);
+    if (st != OK) {
+        goto end;
+    }
+    symbols->parameters = params;
+    dynamic_array *body;
+    st = compile_expression(s + 1, options, symbols, &body, out_span);
+    symbols->parameters = nullptr;
+    if (st != OK) {
+        if (out_span != NULL && out_span->length > 0) {
+            out_span->offset += (size_t) (s + 1 - definition);
+        }
+        symbols->functions->size--;
+        goto end;
+    }
+    ((user_function *) symbols->functions->elements)[symbols->functions->size - 1].body = body;
+end:
+    if (params != NULL) {
+        free_names(params);
+    }
+    if (st != OK) {
+        free(function.name);
+        if (function.memo != NULL) {
+            memo_free(function.memo);
+        }
+    }
+    return st;
+}
@@ -0,0 +1,15 @@
+#ifndef CCALC_DEFINITION_H
+#define CCALC_DEFINITION_H
+
+#include "parser.h"
+#include "status.h"
+#include "symbols.h"
+
+/* Definitions look like "def f(x, y) = x * y + 1", or "def memo f(x) = ..."
+ * to cache results. The body is compiled once, with the given options. An
+ * error in the body sets *out_span, when given, within definition. */
+bool is_definition(const char *line);
+status define_function(const char *definition, const compile_options *options, symbol_table *symbols,
+                       source_span *out_span);
+
+#endif
@@ -8,7 +8,8 @@ static status dynarr_pre_alloc(dynamic_array *arr) {
         arr->capacity = arr->pre_alloc_size;
         arr->elements = malloc(arr->element_size * arr->capacity);
     } else {
-        arr->capacity += arr->pre_alloc_size;
+        /* grow geometrically, so appending n elements copies O(n) in total */
+        arr->capacity += arr->capacity > arr->pre_alloc_size ? arr->capacity : arr->pre_alloc_size;
         void *new_ptr = realloc(arr->elements, arr->element_size * arr->capacity);
         if (new_ptr == NULL) {
             free(arr->elements);
@@ -39,6 +40,14 @@ status dynarr_new(const size_t element_size, const size_t initial_capacity, dyna
     return OK;
 }
 
+void dynarr_wrap(void *elements, const size_t element_size, const size_t size, dynamic_array *out) {
+    out->size = size;
+    out->element_size = element_size;
+    out->pre_alloc_size = 0;
+    out->capacity = size;
+    out->elements = elements;
+}
+
 void dynarr_free(dynamic_array *arr) {
     free(arr->elements);
     free(arr);
@@ -57,4 +66,8 @@ status dynarr_append(dynamic_array *arr, const void *element) {
 
 void dynarr_copy(dynamic_array *arr, const size_t idx, void *dest) {
     memcpy(dest, arr->elements + idx * arr->element_size, arr->element_size);
+}
+
+void dynarr_set(dynamic_array *arr, const size_t idx, const void *element) {
+    memcpy(arr->elements + idx * arr->element_size, element, arr->element_size);
 }
\ No newline at end of file
@@ -13,8 +13,12 @@ typedef struct {
 } dynamic_array;
 
 status dynarr_new(size_t element_size, size_t initial_capacity, dynamic_array **out);
+/* Makes a read-only view of existing elements. The view does not own them,
+ * and must neither be appended to nor freed. */
+void dynarr_wrap(void *elements, size_t element_size, size_t size, dynamic_array *out);
 void dynarr_free(dynamic_array *arr);
 status dynarr_append(dynamic_array *arr, const void *element);
 void dynarr_copy(dynamic_array *arr, size_t idx, void *dest);
+void dynarr_set(dynamic_array *arr, size_t idx, const void *element);
 
 #endif
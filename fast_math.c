@@ -0,0 +1,219 @@
+#include "fast_math.h"
+
+#include "tokenizer.h"
+
+/* Samples per function and distribution in fast_math_check(). */
+#define CHECK_SAMPLES 200000
+
+const double fast_exp_table[64] = {
+    0x1.0000000000000p+0, 0x1.02c9a3e778061p+0, 0x1.059b0d3158574p+0, 0x1.0874518759bc8p+0,
+    0x1.0b5586cf9890fp+0, 0x1.0e3ec32d3d1a2p+0, 0x1.11301d0125b51p+0, 0x1.1429aaea92de0p+0,
+    0x1.172b83c7d517bp+0, 0x1.1a35beb6fcb75p+0, 0x1.1d4873168b9aap+0, 0x1.2063b88628cd6p+0,
+    0x1.2387a6e756238p+0, 0x1.26b4565e27cddp+0, 0x1.29e9df51fdee1p+0, 0x1.2d285a6e4030bp+0,
+    0x1.306fe0a31b715p+0, 0x1.33c08b26416ffp+0, 0x1.371a7373aa9cbp+0, 0x1.3a7db34e59ff7p+0,
+    0x1.3dea64c123422p+0, 0x1.4160a21f72e2ap+0, 0x1.44e086061892dp+0, 0x1.486a2b5c13cd0p+0,
+    0x1.4bfdad5362a27p+0, 0x1.4f9b2769d2ca7p+0, 0x1.5342b569d4f82p+0, 0x1.56f4736b527dap+0,
+    0x1.5ab07dd485429p+0, 0x1.5e76f15ad2148p+0, 0x1.6247eb03a5585p+0, 0x1.6623882552225p+0,
+    0x1.6a09e667f3bcdp+0, 0x1.6dfb23c651a2fp+0, 0x1.71f75e8ec5f74p+0, 0x1.75feb564267c9p+0,
+    0x1.7a11473eb0187p+0, 0x1.7e2f336cf4e62p+0, 0x1.82589994cce13p+0, 0x1.868d99b4492edp+0,
+    0x1.8ace5422aa0dbp+0, 0x1.8f1ae99157736p+0, 0x1.93737b0cdc5e5p+0, 0x1.97d829fde4e50p+0,
+    0x1.9c49182a3f090p+0, 0x1.a0c667b5de565p+0, 0x1.a5503b23e255dp+0, 0x1.a9e6b5579fdbfp+0,
+    0x1.ae89f995ad3adp+0, 0x1.b33a2b84f15fbp+0, 0x1.b7f76f2fb5e47p+0, 0x1.bcc1e904bc1d2p+0,
+    0x1.c199bdd85529cp+0, 0x1.c67f12e57d14bp+0, 0x1.cb720dcef9069p+0, 0x1.d072d4a07897cp+0,
+    0x1.d5818dcfba487p+0, 0x1.da9e603db3285p+0, 0x1.dfc97337b9b5fp+0, 0x1.e502ee78b3ff6p+0,
+    0x1.ea4afa2a490dap+0, 0x1.efa1bee615a27p+0, 0x1.f50765b6e4540p+0, 0x1.fa7c1819e90d8p+0,
+};
+
+const double fast_tanh_table[10] = {
+    0x0.0p+0, 0x1.ff55997e030d7p-5, 0x1.fd5992bc4b835p-4, 0x1.7b8ff903bf776p-3, 0x1.f597ea69a1c86p-3,
+    0x1.35f98a0ea650ep-2, 0x1.6ef53de8c8fb0p-2, 0x1.a5729ee488037p-2, 0x1.d9353d7568af3p-2, 0x1.05086f2f6d4b7p-1,
+};
+
+const double fast_ln_inverse_table[64] = {
+    0x1.0000000000000p+0, 0x1.f81f81f81f820p-1, 0x1.f07c1f07c1f08p-1, 0x1.e9131abf0b767p-1,
+    0x1.e1e1e1e1e1e1ep-1, 0x1.dae6076b981dbp-1, 0x1.d41d41d41d41dp-1, 0x1.cd85689039b0bp-1,
+    0x1.c71c71c71c71cp-1, 0x1.c0e070381c0e0p-1, 0x1.bacf914c1bad0p-1, 0x1.b4e81b4e81b4fp-1,
+    0x1.af286bca1af28p-1, 0x1.a98ef606a63bep-1, 0x1.a41a41a41a41ap-1, 0x1.9ec8e951033d9p-1,
+    0x1.999999999999ap-1, 0x1.948b0fcd6e9e0p-1, 0x1.8f9c18f9c18fap-1, 0x1.8acb90f6bf3aap-1,
+    0x1.8618618618618p-1, 0x1.8181818181818p-1, 0x1.7d05f417d05f4p-1, 0x1.78a4c8178a4c8p-1,
+    0x1.745d1745d1746p-1, 0x1.702e05c0b8170p-1, 0x1.6c16c16c16c17p-1, 0x1.6816816816817p-1,
+    0x1.642c8590b2164p-1, 0x1.6058160581606p-1, 0x1.5c9882b931057p-1, 0x1.58ed2308158edp-1,
+    0x1.5555555555555p-1, 0x1.51d07eae2f815p-1, 0x1.4e5e0a72f0539p-1, 0x1.4afd6a052bf5bp-1,
+    0x1.47ae147ae147bp-1, 0x1.446f86562d9fbp-1, 0x1.4141414141414p-1, 0x1.3e22cbce4a902p-1,
+    0x1.3b13b13b13b14p-1, 0x1.3813813813814p-1, 0x1.3521cfb2b78c1p-1, 0x1.323e34a2b10bfp-1,
+    0x1.2f684bda12f68p-1, 0x1.2c9fb4d812ca0p-1, 0x1.29e4129e4129ep-1, 0x1.27350b8812735p-1,
+    0x1.2492492492492p-1, 0x1.21fb78121fb78p-1, 0x1.1f7047dc11f70p-1, 0x1.1cf06ada2811dp-1,
+    0x1.1a7b9611a7b96p-1, 0x1.1811811811812p-1, 0x1.15b1e5f75270dp-1, 0x1.135c81135c811p-1,
+    0x1.1111111111111p-1, 0x1.0ecf56be69c90p-1, 0x1.0c9714fbcda3bp-1, 0x1.0a6810a6810a7p-1,
+    0x1.0842108421084p-1, 0x1.0624dd2f1a9fcp-1, 0x1.0410410410410p-1, 0x1.0204081020408p-1,
+};
+
+const double fast_ln_table[64] = {
+    0x0.0p+0, 0x1.fc0a8b0fc03e4p-7, 0x1.f829b0e783300p-6, 0x1.77458f632dcfcp-5,
+    0x1.f0a30c01162a6p-5, 0x1.341d7961bd1d1p-4, 0x1.6f0d28ae56b4cp-4, 0x1.a926d3a4ad563p-4,
+    0x1.e27076e2af2e6p-4, 0x1.0d77e7cd08e59p-3, 0x1.29552f81ff523p-3, 0x1.44d2b6ccb7d1ep-3,
+    0x1.5ff3070a793d4p-3, 0x1.7ab890210d909p-3, 0x1.9525a9cf456b4p-3, 0x1.af3c94e80bff3p-3,
+    0x1.c8ff7c79a9a22p-3, 0x1.e27076e2af2e6p-3, 0x1.fb9186d5e3e2bp-3, 0x1.0a324e27390e3p-2,
+    0x1.1675cababa60ep-2, 0x1.22941fbcf7966p-2, 0x1.2e8e2bae11d31p-2, 0x1.3a64c556945eap-2,
+    0x1.4618bc21c5ec2p-2, 0x1.51aad872df82dp-2, 0x1.5d1bdbf5809cap-2, -0x1.5d5bddf595f30p-2,
+    -0x1.522ae0738a3d8p-2, -0x1.4718dc271c41bp-2, -0x1.3c25277333184p-2, -0x1.314f1e1d35ce4p-2,
+    -0x1.269621134db92p-2, -0x1.1bf99635a6b95p-2, -0x1.1178e8227e47cp-2, -0x1.07138604d5862p-2,
+    -0x1.f991c6cb3b379p-3, -0x1.e530effe71012p-3, -0x1.d1037f2655e7bp-3, -0x1.bd087383bd8adp-3,
+    -0x1.a93ed3c8ad9e3p-3, -0x1.95a5adcf7017fp-3, -0x1.823c16551a3c2p-3, -0x1.6f0128b756abcp-3,
+    -0x1.5bf406b543db2p-3, -0x1.4913d8333b561p-3, -0x1.365fcb0159016p-3, -0x1.23d712a49c202p-3,
+    -0x1.1178e8227e47cp-3, -0x1.fe89139dbd566p-4, -0x1.da727638446a2p-4, -0x1.b6ac88dad5b1cp-4,
+    -0x1.9335e5d594989p-4, -0x1.700d30aeac0e1p-4, -0x1.4d3115d207eacp-4, -0x1.2aa04a44717a5p-4,
+    -0x1.08598b59e3a07p-4, -0x1.ccb73cdddb2ccp-5, -0x1.894aa149fb343p-5, -0x1.466aed42de3eap-5,
+    -0x1.0415d89e74444p-5, -0x1.8492528c8cabfp-6, -0x1.0205658935847p-6, -0x1.010157588de71p-7,
+};
+
+void use_fast_math(dynamic_array *tokens, const double max_ulps) {
+    token *t = tokens->elements;
+    for (size_t q = 0; q < tokens->size; q++) {
+        if (t[q].type != FUNCTION) {
+            continue;
+        }
+        switch (t[q].function) {
+            case SIN:
+                t[q].function = max_ulps >= FAST_SIN_ULPS ? FAST_SIN : SIN;
+                break;
+            case COS:
+                t[q].function = max_ulps >= FAST_COS_ULPS ? FAST_COS : COS;
+                break;
+            case EXP:
+                t[q].function = max_ulps >= FAST_EXP_ULPS ? FAST_EXP : EXP;
+                break;
+            case LN:
+                t[q].function = max_ulps >= FAST_LN_ULPS ? FAST_LN : LN;
+                break;
+            case TANH:
+                t[q].function = max_ulps >= FAST_TANH_ULPS ? FAST_TANH : TANH;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+typedef struct {
+    const char *name;
+    double (*fast)(double);
+    long double (*exact)(long double);
+    double bound;
+    double low; /* uniform samples are taken from [low, high] */
+    double high;
+    bool positive; /* whether log-uniform samples are positive only */
+} approximation;
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* in [0, 1) */
+static double next_uniform(uint64_t *state) {
+    return (double) (next_random(state) >> 11) * 0x1p-53;
+}
+
+static double ulp_of(const double x) {
+    const double ax = fabs(x);
+    return ax < 0x1p-1022 ? 0x1p-1074 : ldexp(1.0, ilogb(ax) - 52);
+}
+
+/* Results beyond the range of double must round to infinity. */
+static double ulp_error(const double approx, const long double exact) {
+    const double rounded = (double) exact;
+    if (isnan(exact) || isinf(rounded)) {
+        return approx == rounded || isnan(approx) && isnan(exact) ? 0 : INFINITY;
+    }
+    const double error = (double) (fabsl(approx - exact) / ulp_of(rounded));
+    return isnan(error) ? INFINITY : error;
+}
+
+static void record(const approximation *a, const double x, double *max_error, double *worst_x) {
+    const double error = ulp_error(a->fast(x), a->exact(x));
+    if (!(error <= *max_error)) {
+        *max_error = error;
+        *worst_x = x;
+    }
+}
+
+static double wrap_sin(const double x) {
+    return fast_sin(x);
+}
+
+static double wrap_cos(const double x) {
+    return fast_cos(x);
+}
+
+static double wrap_exp(const double x) {
+    return fast_exp(x);
+}
+
+static double wrap_ln(const double x) {
+    return fast_ln(x);
+}
+
+static double wrap_tanh(const double x) {
+    return fast_tanh(x);
+}
+
+/* Uniform samples cover the bulk of the domain, log-uniform ones small
+ * and large magnitudes, and a few arguments sit right on the edges. The
+ * trigonometric functions also get the doubles nearest to multiples of
+ * pi/2, where reduction is hardest. */
+static double check_one(const approximation *a, double *out_worst_x) {
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    double max_error = 0;
+    *out_worst_x = 0;
+    for (size_t q = 0; q < CHECK_SAMPLES; q++) {
+        record(a, a->low + (a->high - a->low) * next_uniform(&state), &max_error, out_worst_x);
+        const double magnitude = ldexp(1.0 + next_uniform(&state), (int) (next_uniform(&state) * 2040) - 1020);
+        const double x = a->positive || (next_random(&state) & 1) ? magnitude : -magnitude;
+        record(a, x, &max_error, out_worst_x);
+    }
+    if (a->positive) {
+        for (size_t q = 0; q < CHECK_SAMPLES; q++) {
+            record(a, 1.0 + (next_uniform(&state) - 0.5) * 0x1p-3, &max_error, out_worst_x);
+        }
+    }
+    if (a->fast == wrap_sin || a->fast == wrap_cos) {
+        for (size_t q = 1; q < CHECK_SAMPLES; q++) {
+            const double k = q < CHECK_SAMPLES / 2 ? (double) q : floor(next_uniform(&state) * FAST_TRIG_LIMIT);
+            const double x = (double) (k * 1.57079632679489661923132169163975144L);
+            record(a, x, &max_error, out_worst_x);
+            record(a, nextafter(x, 0), &max_error, out_worst_x);
+            record(a, nextafter(x, INFINITY), &max_error, out_worst_x);
+        }
+    }
+    const double edges[] = {0.0, -0.0, a->low, a->high, 0x1p-1022, 0x1p-1074, 1e300, -1e300, INFINITY, -INFINITY, NAN};
+    for (size_t q = 0; q < sizeof(edges) / sizeof(edges[0]); q++) {
+        record(a, edges[q], &max_error, out_worst_x);
+        record(a, nextafter(edges[q], 0), &max_error, out_worst_x);
+    }
+    return max_error;
+}
+
+bool fast_math_check(FILE *out) {
+    const approximation approximations[] = {
+        {"sin", wrap_sin, sinl, FAST_SIN_ULPS, -FAST_TRIG_LIMIT, FAST_TRIG_LIMIT, false},
+        {"cos", wrap_cos, cosl, FAST_COS_ULPS, -FAST_TRIG_LIMIT, FAST_TRIG_LIMIT, false},
+        {"exp", wrap_exp, expl, FAST_EXP_ULPS, -708.4, 709.8, false},
+        {"ln", wrap_ln, logl, FAST_LN_ULPS, 0, 1e6, true},
+        {"tanh", wrap_tanh, tanhl, FAST_TANH_ULPS, -20, 20, false},
+    };
+    bool ok = true;
+    for (size_t q = 0; q < sizeof(approximations) / sizeof(approximations[0]); q++) {
+        const approximation *a = &approximations[q];
+        double worst_x;
+        const double max_error = check_one(a, &worst_x);
+        const bool within = max_error <= a->bound;
+        fprintf(out, "%-5s max error %.3f ulp at %.17G, bound %G ulp%s\n", a->name, max_error, worst_x, a->bound,
+                within ? "" : ": EXCEEDED");
+        ok = ok && within;
+    }
+    fprintf(out, "%s\n", ok ? "all approximations within bounds" : "some approximations out of bounds");
+    return ok;
+}
@@ -0,0 +1,198 @@
+#ifndef CCALC_FAST_MATH_H
+#define CCALC_FAST_MATH_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "dynarr.h"
+
+/* Approximations of sin, cos, exp, ln and tanh for --fast-math. Each one
+ * is within FAST_*_ULPS units in the last place of the exact result, for
+ * doubles, as checked by fast_math_check(). Arguments outside the range an
+ * approximation handles, and NaN and infinities, go to libm. */
+#define FAST_SIN_ULPS 2
+#define FAST_COS_ULPS 2
+#define FAST_EXP_ULPS 2
+#define FAST_LN_ULPS 2
+#define FAST_TANH_ULPS 3
+
+/* Largest argument reduced by sin and cos. Below it, k * (pi/2) splits
+ * into three exact parts; above it, libm does the reduction. */
+#define FAST_TRIG_LIMIT 0x1p19
+
+extern const double fast_exp_table[64]; /* 2^(j/64) */
+extern const double fast_tanh_table[10]; /* tanh(j/16) */
+/* Entries of fast_ln_table from FAST_LN_HALVED on are for c = (1 + j/64) / 2. */
+#define FAST_LN_HALVED 27
+extern const double fast_ln_inverse_table[64]; /* 1 / (1 + j/64) */
+extern const double fast_ln_table[64]; /* ln(c) */
+
+static inline double fast_double_from_bits(const uint64_t bits) {
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+static inline uint64_t fast_bits_from_double(const double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return bits;
+}
+
+/* The nearest integer, ties to even, for |x| < 2^51. */
+static inline double fast_round(const double x) {
+    return x + 0x1.8p52 - 0x1.8p52;
+}
+
+/* sin and cos of |r| <= pi/4, with the minimax polynomials of fdlibm. */
+static inline double fast_sin_kernel(const double r) {
+    const double z = r * r;
+    const double w = z * z;
+    const double p = 0x1.111111110f8a6p-7 + z * (-0x1.a01a019c161d5p-13 + z * 0x1.71de357b1fe7dp-19)
+                     + z * w * (-0x1.ae5e68a2b9cebp-26 + z * 0x1.5d93a5acfd57cp-33);
+    return r + z * r * (-0x1.5555555555549p-3 + z * p);
+}
+
+static inline double fast_cos_kernel(const double r) {
+    const double z = r * r;
+    const double w = z * z;
+    const double p = z * (0x1.555555555554cp-5 + z * (-0x1.6c16c16c15177p-10 + z * 0x1.a01a019cb159p-16))
+                     + w * w * (-0x1.27e4f809c52adp-22 + z * (0x1.1ee9ebdb4b1c4p-29 + z * -0x1.8fae9be8838d4p-37));
+    const double half_z = 0.5 * z;
+    const double one_minus = 1.0 - half_z;
+    return one_minus + (((1.0 - one_minus) - half_z) + z * p);
+}
+
+/* Reduces x to r in [-pi/4, pi/4] and the quadrant k, or returns false
+ * when that loses accuracy: for large x, and when x is so close to a
+ * multiple of pi/2 that r cancels. */
+static inline bool fast_reduce(const double x, double *out_r, long *out_k) {
+    const double k = fast_round(x * 0x1.45f306dc9c883p-1);
+    if (!(fabs(k) < FAST_TRIG_LIMIT)) {
+        return false;
+    }
+    /* the first step is exact, the second keeps its rounding error */
+    const double r1 = x - k * 0x1.921fb544p0;
+    const double w = -k * 0x1.0b4611a6p-34;
+    const double r2 = r1 + w;
+    const double w_rounded = r2 - r1;
+    const double error = (r1 - (r2 - w_rounded)) + (w - w_rounded);
+    const double r = r2 + (error - k * 0x1.3198a2ep-69);
+    if (k != 0 && fabs(r) < 0x1p-17) {
+        return false;
+    }
+    *out_r = r;
+    *out_k = (long) k;
+    return true;
+}
+
+/* Both kernels are evaluated, and the quadrant picks one and its sign
+ * without branching, as quadrants are unpredictable. */
+static inline double fast_sin_cos(const double r, const long quadrant) {
+    const double s = fast_sin_kernel(r);
+    const double c = fast_cos_kernel(r);
+    const double v = quadrant & 1 ? c : s;
+    return fast_double_from_bits(fast_bits_from_double(v) ^ (uint64_t) (quadrant & 2) << 62);
+}
+
+static inline double fast_sin(const double x) {
+    if (fabs(x) <= 0x1.921fb54442d18p-1) {
+        return fast_sin_kernel(x);
+    }
+    double r;
+    long k;
+    if (!fast_reduce(x, &r, &k)) {
+        return sin(x);
+    }
+    return fast_sin_cos(r, k);
+}
+
+static inline double fast_cos(const double x) {
+    if (fabs(x) <= 0x1.921fb54442d18p-1) {
+        return fast_cos_kernel(x);
+    }
+    double r;
+    long k;
+    if (!fast_reduce(x, &r, &k)) {
+        return cos(x);
+    }
+    return fast_sin_cos(r, k + 1);
+}
+
+/* x = (64m + j) ln2/64 + r, so exp(x) = 2^m 2^(j/64) exp(r), with
+ * |r| <= ln2/128 where a degree 5 polynomial suffices. Results that are
+ * subnormal or overflow go to libm. */
+static inline double fast_exp(const double x) {
+    if (!(x > -0x1.6232bdd7abcd2p9 && x < 0x1.62e42fefa39efp9)) {
+        return exp(x);
+    }
+    const double k = fast_round(x * 0x1.71547652b82fep6);
+    const double r = (x - k * 0x1.62e42feep-7) - k * 0x1.a39ef35793c76p-39;
+    const long n = (long) k;
+    const double t = fast_exp_table[n & 63];
+    const double q = r + r * r * (0.5 + r * (0x1.5555555555555p-3 + r * (0x1.5555555555555p-5
+                                                                             + r * 0x1.1111111111111p-7)));
+    const long m = (n - (n & 63)) / 64;
+    const double y = t + t * q;
+    if (m > 1000) {
+        return ldexp(y, (int) m);
+    }
+    return y * fast_double_from_bits((uint64_t) (m + 1023) << 52);
+}
+
+/* x = 2^k m, and m = c (1 + r) with c the nearest 1 + j/64, so
+ * ln(x) = k ln2 + ln(c) + ln(1 + r), with |r| <= 1/128 where a degree 8
+ * series suffices. From sqrt(2) up, c is halved and k raised, so that
+ * ln(c) is small near x = 1 and nothing cancels there. Zero, subnormals,
+ * negative numbers and infinities go to libm. */
+static inline double fast_ln(const double x) {
+    if (!(x >= 0x1p-1022 && x <= 0x1.fffffffffffffp1023)) {
+        return log(x);
+    }
+    const uint64_t bits = fast_bits_from_double(x);
+    /* adding 2^45 rounds the mantissa to 6 bits, carrying into k near 2 */
+    const uint64_t rounded = bits + (1ULL << 45);
+    const int j = (int) (rounded >> 46) & 63;
+    const long k = (long) (rounded >> 52) - 1023 + (j >= FAST_LN_HALVED);
+    const double m = fast_double_from_bits((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+    /* m - c is exact, and so is m - 2 when m rounded up to the next binade */
+    const double d = rounded >> 52 == bits >> 52 ? m - (1.0 + j * 0x1p-6) : 0.5 * (m - 2.0);
+    const double r = d * fast_ln_inverse_table[j];
+    const double z = r * r;
+    const double p = z * (-0.5 + r * (0x1.5555555555555p-2 + r * -0.25))
+                     + z * z * r * (0x1.999999999999ap-3 + r * -0x1.5555555555555p-3
+                                    + z * (0x1.2492492492492p-3 + r * -0.125));
+    const double dk = (double) k;
+    return dk * 0x1.62e42fefa3800p-1 + (fast_ln_table[j] + (dk * 0x1.ef35793c7673p-45 + (r + p)));
+}
+
+/* Below 0.55, tanh(a + r) = (tanh a + tanh r) / (1 + tanh a tanh r), with
+ * a the nearest sixteenth and a series for tanh r. Above, it is
+ * 1 - 2 / (exp(2x) + 1), which rounds to 1 from about 19.1. */
+static inline double fast_tanh(const double x) {
+    const double ax = fabs(x);
+    if (!(ax < 0x1.4p4)) {
+        return isnan(x) ? x : copysign(1.0, x);
+    }
+    if (ax >= 0.55) {
+        return copysign(1.0 - 2.0 / (fast_exp(2.0 * ax) + 1.0), x);
+    }
+    const double a = fast_round(ax * 16.0);
+    const double r = ax - a * 0.0625;
+    const double z = r * r;
+    const double tr = r + r * z * (-0x1.5555555555555p-2 + z * (0x1.1111111111111p-3 + z * (-0x1.ba1ba1ba1ba1cp-5
+        + z * (0x1.664f4882c10fap-6 + z * -0x1.226e355e6c23dp-7))));
+    const double ta = fast_tanh_table[(int) a];
+    return copysign((ta + tr) / (1.0 + ta * tr), x);
+}
+
+/* Replaces sin, cos, exp, ln and tanh in a program by their approximations
+ * where those are within max_ulps. */
+void use_fast_math(dynamic_array *tokens, double max_ulps);
+/* Samples each approximation across its domain and compares it with libm
+ * in long double, printing the largest error found. False if an error
+ * bound is exceeded. */
+bool fast_math_check(FILE *out);
+
+#endif
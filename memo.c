@@ -0,0 +1,92 @@
+#include "memo.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMO_PROBES 4
+
+static uint64_t hash_args(const uint64_t *bits, const size_t num_args) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t q = 0; q < num_args; q++) {
+        h ^= bits[q];
+        h *= 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+static void to_bits(const double *args, const size_t num_args, uint64_t *out_bits) {
+    memcpy(out_bits, args, num_args * sizeof(uint64_t));
+}
+
+status memo_new(const size_t num_args, const size_t capacity, memo_table **out) {
+    *out = malloc(sizeof(memo_table));
+    if (*out == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    memo_table *memo = *out;
+    memo->num_args = num_args;
+    memo->capacity = capacity;
+    memo->clock = 0;
+    memo->stamps = calloc(capacity, sizeof(uint64_t));
+    memo->keys = malloc(capacity * (num_args > 0 ? num_args : 1) * sizeof(uint64_t));
+    memo->results = malloc(capacity * sizeof(double));
+    if (memo->stamps == NULL || memo->keys == NULL || memo->results == NULL) {
+        memo_free(memo);
+        *out = nullptr;
+        return OUT_OF_MEMORY;
+    }
+    return OK;
+}
+
+void memo_free(memo_table *memo) {
+    free(memo->stamps);
+    free(memo->keys);
+    free(memo->results);
+    free(memo);
+}
+
+/* capacity is a power of two, so the slot index is a mask of the hash.
+ * A stamp of 0 marks an empty slot. */
+static bool find_slot(const memo_table *memo, const uint64_t *bits, size_t *out_slot) {
+    const size_t mask = memo->capacity - 1;
+    const size_t home = hash_args(bits, memo->num_args) & mask;
+    size_t oldest = home;
+    for (size_t q = 0; q < MEMO_PROBES; q++) {
+        const size_t slot = (home + q) & mask;
+        if (memo->stamps[slot] == 0) {
+            *out_slot = slot;
+            return false;
+        }
+        if (memcmp(memo->keys + slot * memo->num_args, bits, memo->num_args * sizeof(uint64_t)) == 0) {
+            *out_slot = slot;
+            return true;
+        }
+        if (memo->stamps[slot] < memo->stamps[oldest]) {
+            oldest = slot;
+        }
+    }
+    *out_slot = oldest;
+    return false;
+}
+
+bool memo_lookup(const memo_table *memo, const double *args, double *out_result) {
+    uint64_t bits[memo->num_args + 1];
+    to_bits(args, memo->num_args, bits);
+    size_t slot;
+    if (!find_slot(memo, bits, &slot)) {
+        return false;
+    }
+    *out_result = memo->results[slot];
+    return true;
+}
+
+void memo_store(memo_table *memo, const double *args, const double result) {
+    uint64_t bits[memo->num_args + 1];
+    to_bits(args, memo->num_args, bits);
+    size_t slot;
+    find_slot(memo, bits, &slot);
+    memcpy(memo->keys + slot * memo->num_args, bits, memo->num_args * sizeof(uint64_t));
+    memo->results[slot] = result;
+    memo->stamps[slot] = ++memo->clock;
+}
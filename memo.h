@@ -0,0 +1,26 @@
+#ifndef CCALC_MEMO_H
+#define CCALC_MEMO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "status.h"
+
+/* A bounded cache of function results, keyed by the bit patterns of the
+ * arguments. When a probe sequence is full, the oldest slot in it is
+ * overwritten, so memory use never grows beyond the initial allocation. */
+typedef struct {
+    size_t num_args;
+    size_t capacity;
+    uint64_t clock;
+    uint64_t *stamps;
+    uint64_t *keys;
+    double *results;
+} memo_table;
+
+/* capacity must be a power of two. */
+status memo_new(size_t num_args, size_t capacity, memo_table **out);
+void memo_free(memo_table *memo);
+bool memo_lookup(const memo_table *memo, const double *args, double *out_result);
+void memo_store(memo_table *memo, const double *args, double result);
+
+#endif
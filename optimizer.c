@@ -0,0 +1,423 @@
+#include "optimizer.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "power.h"
+#include "tokenizer.h"
+
+#define PI_LONG_DOUBLE 3.14159265358979323846264338327950288L
+#define E_LONG_DOUBLE 2.71828182845904523536028747135266250L
+
+/* Highest degree tracked. Anything beyond it is left as written. */
+#define MAX_DEGREE 16
+/* Horner form takes at most four tokens per coefficient, plus a trailing
+ * power of the variable. */
+#define MAX_HORNER_TOKENS (4 * (MAX_DEGREE + 1) + 3)
+
+/* What the subtree closed by a token computes: either a polynomial in at
+ * most one variable, or something else. */
+typedef struct {
+    size_t start; /* first token of the subtree */
+    bool is_polynomial;
+    bool has_variable;
+    token variable; /* VARIABLE or ARGUMENT */
+    size_t degree;
+    long double coefficients[MAX_DEGREE + 1];
+} term;
+
+/* The Horner form of the subtree in[start..end]. */
+typedef struct {
+    size_t start;
+    size_t end;
+    size_t size;
+    token tokens[MAX_HORNER_TOKENS];
+} replacement;
+
+/* Collects replacements lazily, so that programs without anything to
+ * rewrite are never copied. */
+typedef struct {
+    const token *in;
+    size_t size;
+    precision precision;
+    dynamic_array *replacements;
+} rewriter;
+
+static bool has_jumps(const token *tokens, const size_t size) {
+    for (size_t q = 0; q < size; q++) {
+        if (tokens[q].type == JUMP || tokens[q].type == JUMP_IF_FALSE || tokens[q].type == JUMP_IF_TRUE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool count_pops(const token *t, const symbol_table *symbols, size_t *out_pops) {
+    switch (t->type) {
+        case VALUE:
+        case CONSTANT:
+        case VARIABLE:
+        case ARGUMENT:
+            *out_pops = 0;
+            return true;
+        case OPERATOR:
+            *out_pops = t->operator == NEGATION ? 1 : 2;
+            return true;
+        case INTEGER_POWER:
+            *out_pops = 1;
+            return true;
+        case FUNCTION:
+            *out_pops = (size_t) function_arity(t->function);
+            return true;
+        case CALL:
+            *out_pops = symbols_function(symbols, t->user_function)->num_params;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void set_constant(term *t, const long double value) {
+    t->is_polynomial = true;
+    t->has_variable = false;
+    t->degree = 0;
+    t->coefficients[0] = value;
+}
+
+static void set_variable(term *t, const token *variable) {
+    t->is_polynomial = true;
+    t->has_variable = true;
+    t->variable = *variable;
+    t->degree = 1;
+    t->coefficients[0] = 0;
+    t->coefficients[1] = 1;
+}
+
+static bool is_constant(const term *t) {
+    return t->is_polynomial && t->degree == 0;
+}
+
+static bool same_variable(const term *a, const term *b) {
+    if (!a->has_variable || !b->has_variable) {
+        return true;
+    }
+    if (a->variable.type != b->variable.type) {
+        return false;
+    }
+    return a->variable.type == VARIABLE ? a->variable.variable == b->variable.variable
+                                        : a->variable.argument == b->variable.argument;
+}
+
+static void take_variable(term *a, const term *b) {
+    if (b->has_variable) {
+        a->has_variable = true;
+        a->variable = b->variable;
+    }
+}
+
+/* Terms that cancel leave zero leading coefficients behind. */
+static void trim(term *t) {
+    while (t->degree > 0 && t->coefficients[t->degree] == 0) {
+        t->degree--;
+    }
+}
+
+static void add(term *a, const term *b, const long double sign) {
+    for (size_t i = a->degree + 1; i <= b->degree; i++) {
+        a->coefficients[i] = 0;
+    }
+    if (b->degree > a->degree) {
+        a->degree = b->degree;
+    }
+    for (size_t i = 0; i <= b->degree; i++) {
+        a->coefficients[i] += sign * b->coefficients[i];
+    }
+    take_variable(a, b);
+    trim(a);
+}
+
+static bool multiply(term *a, const term *b) {
+    if (a->degree + b->degree > MAX_DEGREE) {
+        return false;
+    }
+    long double product[MAX_DEGREE + 1] = {0};
+    for (size_t i = 0; i <= a->degree; i++) {
+        for (size_t k = 0; k <= b->degree; k++) {
+            product[i + k] += a->coefficients[i] * b->coefficients[k];
+        }
+    }
+    a->degree += b->degree;
+    memcpy(a->coefficients, product, (a->degree + 1) * sizeof(long double));
+    take_variable(a, b);
+    trim(a);
+    return true;
+}
+
+static bool raise(term *a, const long exponent) {
+    if (exponent < 0 || a->degree * exponent > MAX_DEGREE) {
+        return false;
+    }
+    const term base = *a;
+    set_constant(a, 1);
+    for (long k = 0; k < exponent; k++) {
+        multiply(a, &base);
+    }
+    return true;
+}
+
+static void negate(term *a) {
+    for (size_t i = 0; i <= a->degree; i++) {
+        a->coefficients[i] = -a->coefficients[i];
+    }
+}
+
+/* Folds the children of t, first to last, into what t computes. */
+static void combine(const token *t, const term *children, const size_t num_children, term *out) {
+    out->is_polynomial = false;
+    for (size_t k = 0; k < num_children; k++) {
+        if (!children[k].is_polynomial) {
+            return;
+        }
+    }
+    term *a = out;
+    const term *b = num_children > 1 ? &children[1] : nullptr;
+    if (num_children > 0) {
+        const size_t start = out->start;
+        *a = children[0];
+        a->start = start;
+        a->is_polynomial = false;
+    }
+    switch (t->type) {
+        case VALUE:
+            set_constant(out, value_token_literal(t));
+            break;
+        case CONSTANT:
+            set_constant(out, t->constant == PI ? PI_LONG_DOUBLE : E_LONG_DOUBLE);
+            break;
+        case VARIABLE:
+        case ARGUMENT:
+            set_variable(out, t);
+            break;
+        case INTEGER_POWER:
+            a->is_polynomial = raise(a, t->exponent);
+            break;
+        case FUNCTION:
+            if (t->function == NEG) {
+                negate(a);
+                a->is_polynomial = true;
+            }
+            break;
+        case OPERATOR:
+            if (t->operator == NEGATION) {
+                negate(a);
+                a->is_polynomial = true;
+            } else if (!same_variable(a, b)) {
+                break;
+            } else if (t->operator == ADDITION || t->operator == SUBTRACTION) {
+                add(a, b, t->operator == ADDITION ? 1 : -1);
+                a->is_polynomial = true;
+            } else if (t->operator == MULTIPLICATION) {
+                a->is_polynomial = multiply(a, b);
+            } else if (t->operator == DIVISION && is_constant(b) && b->coefficients[0] != 0) {
+                for (size_t i = 0; i <= a->degree; i++) {
+                    a->coefficients[i] /= b->coefficients[0];
+                }
+                a->is_polynomial = true;
+            } else if (t->operator == EXPONENTIATION && is_constant(b)
+                       && is_small_integer_long_double(b->coefficients[0])) {
+                a->is_polynomial = raise(a, (long) b->coefficients[0]);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void append_value(token *out, size_t *n, const long double value) {
+    out[(*n)++] = value_token(value);
+}
+
+static void append_operation(token *out, size_t *n, const token_type type, const int which) {
+    token t;
+    t.type = type;
+    if (type == OPERATOR) {
+        t.operator = which;
+    } else {
+        t.function = which;
+    }
+    out[(*n)++] = t;
+}
+
+/* x^exponent, for exponent >= 1 */
+static void append_power(token *out, size_t *n, const token *variable, const size_t exponent) {
+    out[(*n)++] = *variable;
+    if (exponent > 1) {
+        token pt;
+        pt.type = INTEGER_POWER;
+        pt.exponent = (long) exponent;
+        out[(*n)++] = pt;
+    }
+}
+
+/* Horner's scheme, skipping zero coefficients by raising x to the size
+ * of the gap: c_n x^(n-j) c_j fma, and so on down to the lowest nonzero
+ * coefficient c_k, then x^k *. A leading 1 is left out. */
+static size_t horner(const term *p, token *out) {
+    size_t n = 0;
+    size_t i = p->degree;
+    const bool implicit_one = p->coefficients[i] == 1;
+    if (!implicit_one) {
+        append_value(out, &n, p->coefficients[i]);
+    }
+    for (;;) {
+        size_t j = i;
+        while (j > 0 && p->coefficients[j - 1] == 0) {
+            j--;
+        }
+        const bool first = i == p->degree;
+        if (j == 0) {
+            if (i > 0) {
+                append_power(out, &n, &p->variable, i);
+                if (!(first && implicit_one)) {
+                    append_operation(out, &n, OPERATOR, MULTIPLICATION);
+                }
+            }
+            return n;
+        }
+        j--;
+        append_power(out, &n, &p->variable, i - j);
+        append_value(out, &n, p->coefficients[j]);
+        if (first && implicit_one) {
+            append_operation(out, &n, OPERATOR, ADDITION);
+        } else {
+            append_operation(out, &n, FUNCTION, FMA);
+        }
+        i = j;
+    }
+}
+
+/* Whether every coefficient of p stays finite as a literal evaluated in
+ * the given precision. One that overflows would turn into NaN where it is
+ * multiplied by 0, though the plain program folds it step by step. */
+static bool has_finite_coefficients(const term *p, const precision precision) {
+    for (size_t i = 0; i <= p->degree; i++) {
+        const token vt = value_token(p->coefficients[i]);
+        const long double c = precision == SINGLE_PRECISION     ? (float) vt.value
+                              : precision == EXTENDED_PRECISION ? value_token_literal(&vt)
+                                                                : vt.value;
+        if (!isfinite(c)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Notes that the subtree p, ending at token end, is to be rewritten if
+ * Horner form is shorter. Subtrees never overlap, but can come here out of
+ * program order: a polynomial waits for its parent, while a later sibling
+ * may already have had a part rewritten. */
+static status rewrite(rewriter *rw, const term *p, const size_t end) {
+    if (!p->is_polynomial || !p->has_variable || p->degree == 0 || !has_finite_coefficients(p, rw->precision)) {
+        return OK;
+    }
+    replacement r = {.start = p->start, .end = end};
+    r.size = horner(p, r.tokens);
+    if (r.size >= end - p->start + 1) {
+        return OK;
+    }
+    if (rw->replacements == NULL) {
+        const status st = dynarr_new(sizeof(replacement), 4, &rw->replacements);
+        if (st != OK) {
+            return st;
+        }
+    }
+    return dynarr_append(rw->replacements, &r);
+}
+
+static int compare_starts(const void *a, const void *b) {
+    const size_t x = ((const replacement *) a)->start;
+    const size_t y = ((const replacement *) b)->start;
+    return (x > y) - (x < y);
+}
+
+/* The program with every replacement made, in program order. */
+static status apply_replacements(rewriter *rw, dynamic_array **out) {
+    replacement *replacements = rw->replacements->elements;
+    const size_t count = rw->replacements->size;
+    qsort(replacements, count, sizeof(replacement), compare_starts);
+    status st = dynarr_new(sizeof(token), rw->size, out);
+    size_t q = 0;
+    for (size_t k = 0; k <= count && st == OK; k++) {
+        const size_t end = k < count ? replacements[k].start : rw->size;
+        for (; q < end && st == OK; q++) {
+            st = dynarr_append(*out, &rw->in[q]);
+        }
+        if (k < count) {
+            for (size_t i = 0; i < replacements[k].size && st == OK; i++) {
+                st = dynarr_append(*out, &replacements[k].tokens[i]);
+            }
+            q = replacements[k].end + 1;
+        }
+    }
+    if (st != OK && *out != NULL) {
+        dynarr_free(*out);
+    }
+    return st;
+}
+
+/* Tracks what each subtree computes with a stack of terms, like the
+ * evaluator tracks values. A polynomial is rewritten once its parent turns
+ * out not to be one, so only the largest polynomials are rewritten. */
+status optimize_program(dynamic_array **tokens, const symbol_table *symbols, const precision precision) {
+    const token *in = (*tokens)->elements;
+    const size_t size = (*tokens)->size;
+    if (size == 0 || has_jumps(in, size)) {
+        return OK;
+    }
+    dynamic_array *terms;
+    status st = dynarr_new(sizeof(term), 16, &terms);
+    if (st != OK) {
+        return st;
+    }
+    rewriter rw = {.in = in, .size = size, .precision = precision, .replacements = nullptr};
+    bool valid = true;
+    for (size_t q = 0; q < size && st == OK; q++) {
+        size_t pops;
+        if (!count_pops(&in[q], symbols, &pops) || terms->size < pops) {
+            valid = false;
+            break;
+        }
+        const term *children = (term *) terms->elements + terms->size - pops;
+        term result;
+        result.start = pops > 0 ? children[0].start : q;
+        combine(&in[q], children, pops, &result);
+        for (size_t k = 0; k < pops && !result.is_polynomial && st == OK; k++) {
+            st = rewrite(&rw, &children[k], k + 1 < pops ? children[k + 1].start - 1 : q - 1);
+        }
+        terms->size -= pops;
+        if (st == OK) {
+            st = dynarr_append(terms, &result);
+        }
+    }
+    if (st == OK && valid && terms->size == 1) {
+        term root;
+        dynarr_copy(terms, 0, &root);
+        st = rewrite(&rw, &root, size - 1);
+    } else {
+        valid = false;
+    }
+    if (st == OK && valid && rw.replacements != NULL) {
+        dynamic_array *out = nullptr;
+        st = apply_replacements(&rw, &out);
+        if (st == OK) {
+            dynarr_free(*tokens);
+            *tokens = out;
+        }
+    }
+    if (rw.replacements != NULL) {
+        dynarr_free(rw.replacements);
+    }
+    dynarr_free(terms);
+    return st;
+}
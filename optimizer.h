@@ -0,0 +1,19 @@
+#ifndef CCALC_OPTIMIZER_H
+#define CCALC_OPTIMIZER_H
+
+#include "dynarr.h"
+#include "precision.h"
+#include "status.h"
+#include "symbols.h"
+
+/* Rewrites polynomials in one variable or function argument, like
+ * a*x^3 + b*x^2 + c*x + d, to Horner form with fused multiply-adds,
+ * wherever that takes fewer tokens. Coefficients are folded in long
+ * double, so results may differ from the plain program in the last
+ * digits, and where terms cancel for infinite inputs. Polynomials with a
+ * coefficient that overflows the precision they are evaluated in, and
+ * programs with jumps, are left as they are. Replaces *tokens when
+ * anything was rewritten. */
+status optimize_program(dynamic_array **tokens, const symbol_table *symbols, precision precision);
+
+#endif
@@ -0,0 +1,209 @@
+#include "parallel_calculator.h"
+
+#include <stdlib.h>
+
+#include "program.h"
+#include "random.h"
+#include "resource_limits.h"
+#include "stack_calculator.h"
+
+/* Below this many tokens, splitting costs more than it saves. */
+#define PARALLEL_MIN_TOKENS 65536
+/* Work items per thread, so that uneven subtrees still balance out. */
+#define ITEMS_PER_THREAD 4
+
+/* Units are subtrees evaluated ahead of the rest of the program. Each
+ * work item evaluates a run of consecutive units. */
+typedef struct {
+    dynamic_array *tokens;
+    const symbol_table *symbols;
+    const double *variables;
+    size_t num_units;
+    size_t *unit_starts;
+    size_t *unit_ends;
+    double *unit_results;
+    size_t num_items;
+    size_t *first_units; /* num_items + 1 entries */
+    status *statuses;
+} parallel_job;
+
+bool is_parallel_worthwhile(const dynamic_array *tokens) {
+    return tokens->size >= PARALLEL_MIN_TOKENS;
+}
+
+/* Postfix order is post-order, so each token closes a subtree, and
+ * starts[q] is where the subtree closed by token q begins. Fails for
+ * programs that are not straight-line. */
+static bool find_subtrees(const token *tokens, const size_t size, const size_t num_variables, size_t *starts) {
+    size_t *open = malloc(size * sizeof(size_t));
+    if (open == NULL) {
+        return false;
+    }
+    size_t depth = 0;
+    bool ok = true;
+    for (size_t q = 0; q < size && ok; q++) {
+        size_t pops, pushes;
+        ok = program_stack_effect(&tokens[q], num_variables, &pops, &pushes) && pushes == 1 && depth >= pops;
+        if (ok) {
+            depth -= pops;
+            starts[q] = pops > 0 ? open[depth] : q;
+            open[depth++] = starts[q];
+        }
+    }
+    free(open);
+    return ok && depth == 1;
+}
+
+/* Walks down from the root, taking every subtree of at most target tokens
+ * as a unit, leftmost first, so units come out in program order. Single
+ * tokens are left alone, as there is nothing to gain from them. */
+static status select_units(const size_t *starts, const size_t size, const size_t target, parallel_job *job) {
+    size_t *pending = malloc(size * sizeof(size_t));
+    if (pending == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    size_t depth = 0;
+    pending[depth++] = size - 1;
+    job->num_units = 0;
+    while (depth > 0) {
+        const size_t node = pending[--depth];
+        const size_t node_size = node - starts[node] + 1;
+        if (node_size <= target) {
+            if (node_size > 1) {
+                job->unit_starts[job->num_units] = starts[node];
+                job->unit_ends[job->num_units] = node;
+                job->num_units++;
+            }
+            continue;
+        }
+        /* children right to left, so the leftmost is taken next */
+        for (size_t child = node; child > starts[node];) {
+            child--;
+            pending[depth++] = child;
+            child = starts[child];
+        }
+    }
+    free(pending);
+    return OK;
+}
+
+static void group_units(const size_t target, parallel_job *job) {
+    size_t tokens_in_item = 0;
+    job->num_items = 0;
+    for (size_t u = 0; u < job->num_units; u++) {
+        if (tokens_in_item == 0) {
+            job->first_units[job->num_items++] = u;
+        }
+        tokens_in_item += job->unit_ends[u] - job->unit_starts[u] + 1;
+        if (tokens_in_item >= target) {
+            tokens_in_item = 0;
+        }
+    }
+    job->first_units[job->num_items] = job->num_units;
+}
+
+static void evaluate_item(work_pool *pool, const size_t item, void *context) {
+    (void) pool;
+    parallel_job *job = context;
+    const size_t first = job->first_units[item];
+    job->statuses[item] = stack_calculate_spans(job->tokens, job->symbols, job->variables, job->unit_starts + first,
+                                                job->unit_ends + first, job->first_units[item + 1] - first,
+                                                job->unit_results + first);
+}
+
+/* The program with every unit replaced by a VALUE token holding its result. */
+static status substitute_units(const parallel_job *job, dynamic_array **out) {
+    const token *tokens = job->tokens->elements;
+    size_t size = job->tokens->size;
+    for (size_t u = 0; u < job->num_units; u++) {
+        size -= job->unit_ends[u] - job->unit_starts[u];
+    }
+    status st = dynarr_new(sizeof(token), size, out);
+    size_t u = 0;
+    for (size_t q = 0; q < job->tokens->size && st == OK;) {
+        if (u < job->num_units && q == job->unit_starts[u]) {
+            token value;
+            value.type = VALUE;
+            value.residual = 0;
+            value.value = job->unit_results[u];
+            st = dynarr_append(*out, &value);
+            q = job->unit_ends[u++] + 1;
+        } else {
+            st = dynarr_append(*out, &tokens[q++]);
+        }
+    }
+    if (st != OK && *out != NULL) {
+        dynarr_free(*out);
+        *out = nullptr;
+    }
+    return st;
+}
+
+status parallel_calculate(dynamic_array *tokens, const symbol_table *symbols, const double *variables,
+                          const size_t num_variables, work_pool *pool, double *out) {
+    /* step and time budgets are kept per thread, for one evaluation, and
+     * random numbers are drawn in token order */
+    if (!is_parallel_worthwhile(tokens) || pool_num_threads(pool) < 2
+        || active_limits.max_steps > 0 || active_limits.timeout_ms > 0
+        || random_draws_in(tokens->elements, tokens->size) > 0) {
+        return stack_calculate(tokens, symbols, variables, out);
+    }
+    const size_t size = tokens->size;
+    const size_t target = size / (pool_num_threads(pool) * ITEMS_PER_THREAD);
+    const size_t max_units = size / 2 + 1;
+    parallel_job job = {
+        .tokens = tokens,
+        .symbols = symbols,
+        .variables = variables,
+        .unit_starts = malloc(max_units * sizeof(size_t)),
+        .unit_ends = malloc(max_units * sizeof(size_t)),
+        .unit_results = malloc(max_units * sizeof(double)),
+        .first_units = malloc((max_units + 1) * sizeof(size_t)),
+        .statuses = malloc(max_units * sizeof(status)),
+    };
+    size_t *starts = malloc(size * sizeof(size_t));
+    dynamic_array *rest = nullptr;
+    status st = OK;
+    if (job.unit_starts == NULL || job.unit_ends == NULL || job.unit_results == NULL || job.first_units == NULL
+        || job.statuses == NULL || starts == NULL) {
+        st = OUT_OF_MEMORY;
+        goto end;
+    }
+    if (!find_subtrees(tokens->elements, size, num_variables, starts)) {
+        /* let the serial evaluator deal with it, and report any errors */
+        st = stack_calculate(tokens, symbols, variables, out);
+        goto end;
+    }
+    st = select_units(starts, size, target, &job);
+    if (st != OK) {
+        goto end;
+    }
+    group_units(target, &job);
+    size_t *items = starts; /* no longer needed, and at least num_items long */
+    for (size_t q = 0; q < job.num_items; q++) {
+        items[q] = q;
+    }
+    st = pool_run(pool, items, job.num_items, job.num_items, evaluate_item, &job);
+    for (size_t q = 0; q < job.num_items && st == OK; q++) {
+        st = job.statuses[q];
+    }
+    if (st != OK) {
+        goto end;
+    }
+    st = substitute_units(&job, &rest);
+    if (st != OK) {
+        goto end;
+    }
+    st = stack_calculate(rest, symbols, variables, out);
+end:
+    if (rest != NULL) {
+        dynarr_free(rest);
+    }
+    free(job.unit_starts);
+    free(job.unit_ends);
+    free(job.unit_results);
+    free(job.first_units);
+    free(job.statuses);
+    free(starts);
+    return st;
+}
@@ -0,0 +1,19 @@
+#ifndef CCALC_PARALLEL_CALCULATOR_H
+#define CCALC_PARALLEL_CALCULATOR_H
+
+#include "dynarr.h"
+#include "status.h"
+#include "symbols.h"
+#include "work_pool.h"
+
+/* Whether a program is big enough to be worth splitting across threads. */
+bool is_parallel_worthwhile(const dynamic_array *tokens);
+/* Evaluates independent subtrees of a straight-line program concurrently,
+ * then the rest of the program with their results in place. Every
+ * operation sees the same operands in the same order as in
+ * stack_calculate(), so the result is bit-identical. Programs with jumps
+ * or user function calls are evaluated serially. */
+status parallel_calculate(dynamic_array *tokens, const symbol_table *symbols, const double *variables,
+                          size_t num_variables, work_pool *pool, double *out);
+
+#endif
@@ -1,4 +1,12 @@
 #include "parser.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "fast_math.h"
+#include "optimizer.h"
+#include "power.h"
+#include "resource_limits.h"
 #include "tokenizer.h"
 
 typedef struct {
@@ -6,8 +14,13 @@ typedef struct {
     int idx;
     token token;
     dynamic_array *out_tokens;
+    const symbol_table *symbols;
+    size_t depth;
+    size_t error_index; /* of the token at fault, when not the current one */
 } parser_state;
 
+#define CURRENT_TOKEN SIZE_MAX
+
 static status parse_expression(parser_state *state);
 
 static bool eof(const parser_state *state) {
@@ -42,21 +55,93 @@ static status add_out_token(const parser_state *state, const token token) {
     return dynarr_append(state->out_tokens, &token);
 }
 
-static status parse_function_expression(parser_state *state) {
-    const function_token ft = state->token.function;
-    next(state);
-    if (!is_operator_match(state, LEFT_PAREN)) {
-        return MISSING_LEFT_PARENTHESIS;
+static status add_jump(const parser_state *state, const token_type type, size_t *out_idx) {
+    token jt;
+    jt.type = type;
+    jt.target = 0;
+    *out_idx = state->out_tokens->size;
+    return add_out_token(state, jt);
+}
+
+static void patch_jump(const parser_state *state, const size_t idx) {
+    token jt;
+    dynarr_copy(state->out_tokens, idx, &jt);
+    jt.target = state->out_tokens->size;
+    dynarr_set(state->out_tokens, idx, &jt);
+}
+
+static status add_value(const parser_state *state, const double value) {
+    token vt;
+    vt.type = VALUE;
+    vt.residual = 0;
+    vt.value = value;
+    return add_out_token(state, vt);
+}
+
+static status parse_argument_separator(parser_state *state) {
+    if (!is_operator_match(state, COMMA)) {
+        return WRONG_NUMBER_OF_ARGUMENTS;
     }
-    status st = next_check_eof(state);
+    const status st = next_check_eof(state);
+    if (st != OK) {
+        return st;
+    }
+    if (is_operator_match(state, RIGHT_PAREN)) {
+        return MISSING_FUNCTION_ARGUMENT;
+    }
+    return OK;
+}
+
+/* if(c, a, b) is lowered to jumps, so only the branch taken is evaluated:
+ * c JUMP_IF_FALSE else a JUMP end else: b end: */
+static status parse_if_arguments(parser_state *state) {
+    status st = parse_expression(state);
+    if (st != OK) {
+        return st;
+    }
+    st = parse_argument_separator(state);
     if (st != OK) {
         return st;
     }
+    size_t else_jump;
+    st = add_jump(state, JUMP_IF_FALSE, &else_jump);
+    if (st != OK) {
+        return st;
+    }
+    st = parse_expression(state);
+    if (st != OK) {
+        return st;
+    }
+    st = parse_argument_separator(state);
+    if (st != OK) {
+        return st;
+    }
+    size_t end_jump;
+    st = add_jump(state, JUMP, &end_jump);
+    if (st != OK) {
+        return st;
+    }
+    patch_jump(state, else_jump);
+    st = parse_expression(state);
+    if (st != OK) {
+        return st;
+    }
+    patch_jump(state, end_jump);
+    if (!is_operator_match(state, RIGHT_PAREN)) {
+        return WRONG_NUMBER_OF_ARGUMENTS;
+    }
+    return OK;
+}
+
+static status parse_argument_list(parser_state *state, int *out_count) {
+    status st;
+    int count = 0;
     while (!is_operator_match(state, RIGHT_PAREN)) {
         st = parse_expression(state);
         if (st != OK) {
             return st;
         }
+        ++count;
         if (is_operator_match(state, COMMA)) {
             st = next_check_eof(state);
             if (st != OK) {
@@ -68,16 +153,78 @@ static status parse_function_expression(parser_state *state) {
         }
     }
     next(state);
-    token token;
-    token.type = FUNCTION;
-    token.function = ft;
-    add_out_token(state, token);
+    *out_count = count;
     return OK;
 }
 
-static status parse_primary_expression(parser_state *state) {
+static status parse_function_expression(parser_state *state) {
+    const token ft = state->token;
+    const size_t function_index = state->idx - 1;
+    next(state);
+    if (!is_operator_match(state, LEFT_PAREN)) {
+        return MISSING_LEFT_PARENTHESIS;
+    }
+    status st = next_check_eof(state);
+    if (st != OK) {
+        return st;
+    }
+    if (ft.type == FUNCTION && ft.function == IF) {
+        st = parse_if_arguments(state);
+        if (st == WRONG_NUMBER_OF_ARGUMENTS && state->error_index == CURRENT_TOKEN) {
+            state->error_index = function_index;
+        }
+        if (st != OK) {
+            return st;
+        }
+        next(state);
+        return OK;
+    }
+    int count;
+    st = parse_argument_list(state, &count);
+    if (st != OK) {
+        return st;
+    }
+    const int arity = ft.type == CALL
+                          ? (int) symbols_function(state->symbols, ft.user_function)->num_params
+                          : function_arity(ft.function);
+    if (count != arity) {
+        state->error_index = function_index;
+        return WRONG_NUMBER_OF_ARGUMENTS;
+    }
+    return add_out_token(state, ft);
+}
+
+/* [a, b, c] becomes a b c VECTOR, with a length of 3. */
+static status parse_vector_expression(parser_state *state) {
+    const size_t bracket_index = state->idx - 1;
+    size_t length = 0;
+    do {
+        status st = next_check_eof(state);
+        if (st != OK) {
+            return st;
+        }
+        st = parse_expression(state);
+        if (st != OK) {
+            return st;
+        }
+        length++;
+    } while (is_operator_match(state, COMMA));
+    if (!is_operator_match(state, RIGHT_BRACKET)) {
+        /* the end of input would not say which bracket is open */
+        state->error_index = bracket_index;
+        return UNMATCHED_BRACKET;
+    }
+    next(state);
+    token vt;
+    vt.type = VECTOR;
+    vt.length = length;
+    return add_out_token(state, vt);
+}
+
+static status parse_primary_expression_body(parser_state *state) {
     status st;
-    if (state->token.type == VALUE || state->token.type == CONSTANT) {
+    if (state->token.type == VALUE || state->token.type == CONSTANT || state->token.type == ARGUMENT
+        || state->token.type == VARIABLE) {
         st = add_out_token(state, state->token);
         if (st != OK) {
             return st;
@@ -85,10 +232,11 @@ static status parse_primary_expression(parser_state *state) {
         next(state);
         return OK;
     }
-    if (state->token.type == FUNCTION) {
+    if (state->token.type == FUNCTION || state->token.type == CALL) {
         return parse_function_expression(state);
     }
     if (is_operator_match(state, LEFT_PAREN)) {
+        const size_t paren_index = state->idx - 1;
         st = next_check_eof(state);
         if (st != OK) {
             return st;
@@ -98,14 +246,34 @@ static status parse_primary_expression(parser_state *state) {
             return st;
         }
         if (!is_operator_match(state, RIGHT_PAREN)) {
+            state->error_index = paren_index;
             return UNMATCHED_PARENTHESIS;
         }
         next(state);
         return OK;
     }
+    if (is_operator_match(state, LEFT_BRACKET)) {
+        return parse_vector_expression(state);
+    }
     return UNEXPECTED_OPERATOR;
 }
 
+/* Parentheses, brackets and function arguments are where the parser
+ * recurses, so nesting is bounded here to keep deep input from exhausting
+ * the stack. */
+static status parse_primary_expression(parser_state *state) {
+    const size_t max_depth = active_limits.max_nesting_depth > 0 && active_limits.max_nesting_depth < MAX_NESTING_DEPTH
+                                 ? active_limits.max_nesting_depth
+                                 : MAX_NESTING_DEPTH;
+    if (state->depth >= max_depth) {
+        return NESTING_TOO_DEEP;
+    }
+    state->depth++;
+    const status st = parse_primary_expression_body(state);
+    state->depth--;
+    return st;
+}
+
 static status parse_unary_expression(parser_state *state) {
     status st;
     bool negate = false;
@@ -137,23 +305,50 @@ static status parse_unary_expression(parser_state *state) {
     return OK;
 }
 
+/* Replaces a trailing "n EXPONENTIATION" with a single INTEGER_POWER when
+ * the innermost exponent is a small integer literal, possibly negated. */
+static bool lower_integer_power(const parser_state *state, const size_t exponent_start) {
+    const token *exponent = (const token *) state->out_tokens->elements + exponent_start;
+    const size_t len = state->out_tokens->size - exponent_start;
+    if (exponent[0].type != VALUE || !is_small_integer(exponent[0].value)) {
+        return false;
+    }
+    token pt;
+    pt.type = INTEGER_POWER;
+    if (len == 1) {
+        pt.exponent = (long) exponent[0].value;
+    } else if (len == 2 && exponent[1].type == OPERATOR && exponent[1].operator == NEGATION) {
+        pt.exponent = -(long) exponent[0].value;
+    } else {
+        return false;
+    }
+    dynarr_set(state->out_tokens, exponent_start, &pt);
+    state->out_tokens->size = exponent_start + 1;
+    return true;
+}
+
 static status parse_exponential_expression(parser_state *state) {
     status st = parse_unary_expression(state);
     if (st != OK) {
         return st;
     }
     int count = 0;
+    size_t exponent_start = 0;
     while (is_operator_match(state, EXPONENTIATION)) {
         st = next_check_eof(state);
         if (st != OK) {
             return st;
         }
+        exponent_start = state->out_tokens->size;
         st = parse_unary_expression(state);
         if (st != OK) {
             return st;
         }
         ++count;
     }
+    if (count > 0 && lower_integer_power(state, exponent_start)) {
+        --count;
+    }
     for (int q = 0; q < count; q++) {
         token ot;
         ot.type = OPERATOR;
@@ -216,11 +411,126 @@ static status parse_additive_expression(parser_state *state) {
     return OK;
 }
 
+static bool is_comparison_operator(const parser_state *state) {
+    return is_operator_match(state, LESS) || is_operator_match(state, LESS_OR_EQUAL)
+           || is_operator_match(state, GREATER) || is_operator_match(state, GREATER_OR_EQUAL)
+           || is_operator_match(state, EQUAL) || is_operator_match(state, NOT_EQUAL);
+}
+
+static status parse_comparison_expression(parser_state *state) {
+    status st = parse_additive_expression(state);
+    if (st != OK) {
+        return st;
+    }
+    while (is_comparison_operator(state)) {
+        token ot;
+        ot.type = OPERATOR;
+        ot.operator = state->token.operator;
+        st = next_check_eof(state);
+        if (st != OK) {
+            return st;
+        }
+        st = parse_additive_expression(state);
+        if (st != OK) {
+            return st;
+        }
+        st = add_out_token(state, ot);
+        if (st != OK) {
+            return st;
+        }
+    }
+    return OK;
+}
+
+/* Short-circuit: "a and b" becomes
+ * a JUMP_IF_FALSE false b JUMP_IF_FALSE false 1 JUMP end false: 0 end:
+ * and "or" is the mirror image using JUMP_IF_TRUE. The result is 0 or 1. */
+static status add_short_circuit_tail(const parser_state *state, const size_t first_jump, const token_type jump_type) {
+    size_t second_jump;
+    status st = add_jump(state, jump_type, &second_jump);
+    if (st != OK) {
+        return st;
+    }
+    const bool is_and = jump_type == JUMP_IF_FALSE;
+    st = add_value(state, is_and ? 1.0 : 0.0);
+    if (st != OK) {
+        return st;
+    }
+    size_t end_jump;
+    st = add_jump(state, JUMP, &end_jump);
+    if (st != OK) {
+        return st;
+    }
+    patch_jump(state, first_jump);
+    patch_jump(state, second_jump);
+    st = add_value(state, is_and ? 0.0 : 1.0);
+    if (st != OK) {
+        return st;
+    }
+    patch_jump(state, end_jump);
+    return OK;
+}
+
+static status parse_and_expression(parser_state *state) {
+    status st = parse_comparison_expression(state);
+    if (st != OK) {
+        return st;
+    }
+    while (is_operator_match(state, AND)) {
+        st = next_check_eof(state);
+        if (st != OK) {
+            return st;
+        }
+        size_t first_jump;
+        st = add_jump(state, JUMP_IF_FALSE, &first_jump);
+        if (st != OK) {
+            return st;
+        }
+        st = parse_comparison_expression(state);
+        if (st != OK) {
+            return st;
+        }
+        st = add_short_circuit_tail(state, first_jump, JUMP_IF_FALSE);
+        if (st != OK) {
+            return st;
+        }
+    }
+    return OK;
+}
+
+static status parse_or_expression(parser_state *state) {
+    status st = parse_and_expression(state);
+    if (st != OK) {
+        return st;
+    }
+    while (is_operator_match(state, OR)) {
+        st = next_check_eof(state);
+        if (st != OK) {
+            return st;
+        }
+        size_t first_jump;
+        st = add_jump(state, JUMP_IF_TRUE, &first_jump);
+        if (st != OK) {
+            return st;
+        }
+        st = parse_and_expression(state);
+        if (st != OK) {
+            return st;
+        }
+        st = add_short_circuit_tail(state, first_jump, JUMP_IF_TRUE);
+        if (st != OK) {
+            return st;
+        }
+    }
+    return OK;
+}
+
 static status parse_expression(parser_state *state) {
-    return parse_additive_expression(state);
+    return parse_or_expression(state);
 }
 
-status convert_infix_to_postfix(dynamic_array *in_tokens, dynamic_array **out_tokens) {
+status convert_infix_to_postfix(dynamic_array *in_tokens, const symbol_table *symbols, dynamic_array **out_tokens,
+                                size_t *out_error_index) {
     status st = dynarr_new(sizeof(token), 10, out_tokens);
     if (st != OK) {
         return st;
@@ -230,6 +540,9 @@ status convert_infix_to_postfix(dynamic_array *in_tokens, dynamic_array **out_to
     state.idx = 0;
     state.token.type = END;
     state.out_tokens = *out_tokens;
+    state.symbols = symbols;
+    state.depth = 0;
+    state.error_index = CURRENT_TOKEN;
     st = next_check_eof(&state);
     if (st != OK) {
         goto end;
@@ -244,6 +557,67 @@ status convert_infix_to_postfix(dynamic_array *in_tokens, dynamic_array **out_to
 end:
     if (st != OK) {
         dynarr_free(*out_tokens);
+        *out_tokens = nullptr;
+        if (out_error_index != NULL) {
+            *out_error_index = state.error_index != CURRENT_TOKEN ? state.error_index
+                               : eof(&state)                      ? in_tokens->size
+                                                                  : (size_t) state.idx - 1;
+        }
+    }
+    return st;
+}
+
+/* The token at index, or just past the end of the expression when index
+ * is the number of tokens. */
+static source_span token_span(const char *expression, const dynamic_array *offsets, const size_t index) {
+    const size_t len = strlen(expression);
+    if (index >= offsets->size) {
+        return (source_span) {.offset = len, .length = 1};
+    }
+    const size_t offset = ((const size_t *) offsets->elements)[index];
+    return (source_span) {.offset = offset, .length = token_length(expression, len, offset)};
+}
+
+status compile_expression(const char *expression, const compile_options *options, const symbol_table *symbols,
+                          dynamic_array **out_tokens, source_span *out_span) {
+    dynamic_array *tokens = nullptr;
+    dynamic_array *offsets = nullptr;
+    source_span span = {.offset = 0, .length = 0};
+    status st = tokenize(expression, symbols, &tokens, out_span != NULL && !options->rpn ? &offsets : nullptr,
+                         &span);
+    if (st != OK) {
+        goto end;
+    }
+    if (!options->rpn) {
+        dynamic_array *postfix = nullptr;
+        size_t error_index;
+        st = convert_infix_to_postfix(tokens, symbols, &postfix, &error_index);
+        if (st != OK && st != OUT_OF_MEMORY && offsets != NULL) {
+            span = token_span(expression, offsets, error_index);
+        }
+        dynarr_free(tokens);
+        tokens = postfix;
+        if (st != OK) {
+            goto end;
+        }
+    }
+    if (options->optimize) {
+        st = optimize_program(&tokens, symbols, options->precision);
+    }
+    if (st == OK && options->fast_math_ulps > 0) {
+        use_fast_math(tokens, options->fast_math_ulps);
+    }
+end:
+    if (st != OK && tokens != NULL) {
+        dynarr_free(tokens);
+        tokens = nullptr;
+    }
+    if (offsets != NULL) {
+        dynarr_free(offsets);
+    }
+    if (out_span != NULL) {
+        *out_span = st != OK ? span : (source_span) {.offset = 0, .length = 0};
     }
+    *out_tokens = tokens;
     return st;
 }
@@ -2,8 +2,26 @@
 #define CCALC_PARSER_H
 
 #include "dynarr.h"
+#include "precision.h"
 #include "status.h"
+#include "symbols.h"
 
-status convert_infix_to_postfix(dynamic_array *in_tokens, dynamic_array **out_tokens);
+/* On a syntax error, *out_error_index, when given, is the index of the
+ * token at fault, or the number of tokens for the end of input. */
+status convert_infix_to_postfix(dynamic_array *in_tokens, const symbol_table *symbols, dynamic_array **out_tokens,
+                                size_t *out_error_index);
+/* How expressions are turned into programs. */
+typedef struct {
+    bool rpn; /* expressions are already postfix */
+    bool optimize; /* run optimize_program() */
+    double fast_math_ulps; /* when positive, run use_fast_math() with it */
+    precision precision; /* the programs are evaluated in, for optimize_program() */
+} compile_options;
+
+/* Tokenizes, and converts to postfix and optimizes as the options say.
+ * On an error, *out_span, when given, is where in the expression it was
+ * found. Only then are token offsets kept, in a side array. */
+status compile_expression(const char *expression, const compile_options *options, const symbol_table *symbols,
+                          dynamic_array **out_tokens, source_span *out_span);
 
 #endif
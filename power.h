@@ -0,0 +1,54 @@
+#ifndef CCALC_POWER_H
+#define CCALC_POWER_H
+
+#include <math.h>
+
+/* Integral exponents up to this magnitude use repeated multiplication,
+ * which is faster than pow() and matches x*x*... exactly for small ones. */
+#define MAX_INTEGER_POWER 64
+
+/* Binary exponentiation, with a reciprocal for negative exponents, and
+ * power() using it for small integral exponents. When base^|exponent|
+ * overflows or underflows, its reciprocal would be 0 or infinite where the
+ * true result may still be a subnormal or finite number, so pow() takes
+ * over. Defined once per floating-point type, given its suffix and the
+ * matching pow, trunc and fabs from math.h. */
+#define DEFINE_POWER_FUNCTIONS(type, suffix, pow_function, trunc_function, fabs_function) \
+    static inline type integer_power##suffix(const type x, const long exponent) { \
+        unsigned long n = exponent < 0 ? -(unsigned long) exponent : (unsigned long) exponent; \
+        type base = x; \
+        type result = 1; \
+        while (n > 0) { \
+            if (n & 1) { \
+                result *= base; \
+            } \
+            n >>= 1; \
+            if (n > 0) { \
+                base *= base; \
+            } \
+        } \
+        if (exponent >= 0) { \
+            return result; \
+        } \
+        if (result == 0 || !(fabs_function(result) < (type) INFINITY)) { \
+            return pow_function(x, (type) exponent); \
+        } \
+        return 1 / result; \
+    } \
+    \
+    static inline bool is_small_integer##suffix(const type exponent) { \
+        return exponent == trunc_function(exponent) && fabs_function(exponent) <= MAX_INTEGER_POWER; \
+    } \
+    \
+    static inline type power##suffix(const type base, const type exponent) { \
+        if (is_small_integer##suffix(exponent)) { \
+            return integer_power##suffix(base, (long) exponent); \
+        } \
+        return pow_function(base, exponent); \
+    }
+
+DEFINE_POWER_FUNCTIONS(double, , pow, trunc, fabs)
+DEFINE_POWER_FUNCTIONS(float, _float, powf, truncf, fabsf)
+DEFINE_POWER_FUNCTIONS(long double, _long_double, powl, truncl, fabsl)
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef CCALC_PRECISION_H
+#define CCALC_PRECISION_H
+
+/* The floating-point type expressions are evaluated in. Raw input and
+ * output columns hold doubles whatever the precision. */
+typedef enum {
+    DOUBLE_PRECISION,
+    SINGLE_PRECISION, /* float */
+    EXTENDED_PRECISION, /* long double */
+} precision;
+
+#endif
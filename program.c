@@ -0,0 +1,251 @@
+#include "program.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* File layout: a fixed header followed by the tokens exactly as they are
+ * laid out in memory. Jump targets are token indices, so the blob is
+ * position-independent. Variables are referenced by index, and bound
+ * again in the same order when loading. PROGRAM_VERSION must be bumped
+ * whenever token or any of its enums change. */
+#define PROGRAM_MAGIC "CCB\x1a"
+#define PROGRAM_VERSION 9
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t token_size;
+    uint32_t reserved;
+    uint64_t num_tokens;
+    uint64_t max_stack_depth;
+    uint64_t checksum;
+    uint64_t reserved2;
+} program_header;
+
+static_assert(sizeof(program_header) % alignof(token) == 0, "tokens must be aligned after the header");
+
+static uint64_t checksum(const void *data, const size_t size) {
+    const unsigned char *p = data;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ size;
+    size_t q = 0;
+    for (; q + sizeof(uint64_t) <= size; q += sizeof(uint64_t)) {
+        uint64_t w;
+        memcpy(&w, p + q, sizeof(w));
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    for (; q < size; q++) {
+        h = (h ^ p[q]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* Returns the number of values popped and pushed by a token, or false if
+ * the token can not be part of a stored program. */
+bool program_stack_effect(const token *t, const size_t num_variables, size_t *out_pops, size_t *out_pushes) {
+    *out_pushes = 1;
+    switch (t->type) {
+        case VALUE:
+            *out_pops = 0;
+            return true;
+        case VARIABLE:
+            *out_pops = 0;
+            return t->variable < num_variables;
+        case CONSTANT:
+            *out_pops = 0;
+            return t->constant == E || t->constant == PI;
+        case OPERATOR:
+            if (t->operator == NEGATION) {
+                *out_pops = 1;
+                return true;
+            }
+            *out_pops = 2;
+            return t->operator != LEFT_PAREN && t->operator != RIGHT_PAREN && t->operator != COMMA
+                   && t->operator >= ADDITION && t->operator <= OR;
+        case INTEGER_POWER:
+            *out_pops = 1;
+            return true;
+        case FUNCTION:
+            *out_pops = (size_t) function_arity(t->function);
+            return t->function >= ABS && t->function <= FAST_TANH;
+        case VECTOR:
+            *out_pops = t->length;
+            return t->length > 0;
+        case JUMP:
+            *out_pops = 0;
+            *out_pushes = 0;
+            return true;
+        case JUMP_IF_FALSE:
+        case JUMP_IF_TRUE:
+            *out_pops = 1;
+            *out_pushes = 0;
+            return true;
+        default:
+            return false;
+    }
+}
+
+typedef struct {
+    size_t target;
+    size_t depth;
+} pending_jump;
+
+/* Jumps only go forward, so one pass suffices: the depth at a jump target
+ * must agree with the depth on every path into it. The pending jumps are
+ * few, bounded by the nesting of if/and/or. */
+status program_verify(const token *tokens, const size_t size, const size_t num_variables, size_t *out_max_stack_depth) {
+    dynamic_array *pending;
+    status st = dynarr_new(sizeof(pending_jump), 16, &pending);
+    if (st != OK) {
+        return st;
+    }
+    size_t depth = 0;
+    size_t max_depth = 0;
+    bool reachable = true;
+    for (size_t q = 0; q <= size && st == OK; q++) {
+        for (size_t w = 0; w < pending->size; w++) {
+            pending_jump jump;
+            dynarr_copy(pending, w, &jump);
+            if (jump.target != q) {
+                continue;
+            }
+            if (reachable && jump.depth != depth) {
+                st = INVALID_PROGRAM;
+            }
+            depth = jump.depth;
+            reachable = true;
+            dynarr_copy(pending, pending->size - 1, &jump);
+            dynarr_set(pending, w--, &jump);
+            pending->size--;
+        }
+        if (!reachable) {
+            st = INVALID_PROGRAM;
+        }
+        if (q == size || st != OK) {
+            break;
+        }
+        size_t pops, pushes;
+        if (!program_stack_effect(&tokens[q], num_variables, &pops, &pushes) || depth < pops) {
+            st = INVALID_PROGRAM;
+            break;
+        }
+        depth = depth - pops + pushes;
+        if (depth > max_depth) {
+            max_depth = depth;
+        }
+        if (tokens[q].type == JUMP || tokens[q].type == JUMP_IF_FALSE || tokens[q].type == JUMP_IF_TRUE) {
+            if (tokens[q].target <= q || tokens[q].target > size) {
+                st = INVALID_PROGRAM;
+                break;
+            }
+            pending_jump jump;
+            jump.target = tokens[q].target;
+            jump.depth = depth;
+            st = dynarr_append(pending, &jump);
+            reachable = tokens[q].type != JUMP;
+        }
+    }
+    if (st == OK && depth != 1) {
+        st = INVALID_PROGRAM;
+    }
+    dynarr_free(pending);
+    if (st == OK) {
+        *out_max_stack_depth = max_depth;
+    }
+    return st;
+}
+
+static status write_all(const int fd, const void *data, size_t size) {
+    const char *p = data;
+    while (size > 0) {
+        const ssize_t written = write(fd, p, size);
+        if (written < 0) {
+            return IO_ERROR;
+        }
+        p += written;
+        size -= written;
+    }
+    return OK;
+}
+
+status program_save(dynamic_array *tokens, const size_t num_variables, const char *path) {
+    program_header header;
+    memset(&header, 0, sizeof(header));
+    status st = program_verify(tokens->elements, tokens->size, num_variables, &header.max_stack_depth);
+    if (st != OK) {
+        return st;
+    }
+    memcpy(header.magic, PROGRAM_MAGIC, sizeof(header.magic));
+    header.version = PROGRAM_VERSION;
+    header.token_size = sizeof(token);
+    header.num_tokens = tokens->size;
+    header.checksum = checksum(tokens->elements, tokens->size * sizeof(token));
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return IO_ERROR;
+    }
+    st = write_all(fd, &header, sizeof(header));
+    if (st == OK) {
+        st = write_all(fd, tokens->elements, tokens->size * sizeof(token));
+    }
+    if (close(fd) != 0 && st == OK) {
+        st = IO_ERROR;
+    }
+    return st;
+}
+
+status program_load(const char *path, const size_t num_variables, loaded_program *out) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return IO_ERROR;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+        close(fd);
+        return IO_ERROR;
+    }
+    if (sb.st_size < (off_t) sizeof(program_header)) {
+        close(fd);
+        return INVALID_PROGRAM_FILE;
+    }
+    void *mapping = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return IO_ERROR;
+    }
+    const program_header *header = mapping;
+    const token *tokens = (const token *) (header + 1);
+    status st = OK;
+    if (memcmp(header->magic, PROGRAM_MAGIC, sizeof(header->magic)) != 0
+        || header->version != PROGRAM_VERSION
+        || header->token_size != sizeof(token)
+        || header->num_tokens != (sb.st_size - sizeof(program_header)) / sizeof(token)
+        || (sb.st_size - sizeof(program_header)) % sizeof(token) != 0) {
+        st = INVALID_PROGRAM_FILE;
+    } else if (checksum(tokens, header->num_tokens * sizeof(token)) != header->checksum) {
+        st = CHECKSUM_MISMATCH;
+    } else {
+        size_t max_stack_depth;
+        st = program_verify(tokens, header->num_tokens, num_variables, &max_stack_depth);
+        if (st == OK && max_stack_depth != header->max_stack_depth) {
+            st = INVALID_PROGRAM;
+        }
+    }
+    if (st != OK) {
+        munmap(mapping, sb.st_size);
+        return st;
+    }
+    out->mapping = mapping;
+    out->mapping_size = sb.st_size;
+    dynarr_wrap((void *) tokens, sizeof(token), header->num_tokens, &out->tokens);
+    out->max_stack_depth = header->max_stack_depth;
+    return OK;
+}
+
+void program_unload(loaded_program *program) {
+    munmap(program->mapping, program->mapping_size);
+}
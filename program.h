@@ -0,0 +1,28 @@
+#ifndef CCALC_PROGRAM_H
+#define CCALC_PROGRAM_H
+
+#include "dynarr.h"
+#include "status.h"
+#include "tokenizer.h"
+
+/* A compiled postfix program, as written by program_save() and mapped
+ * into memory by program_load(). The tokens are used in place. */
+typedef struct {
+    void *mapping;
+    size_t mapping_size;
+    dynamic_array tokens;
+    size_t max_stack_depth;
+} loaded_program;
+
+/* The number of values t pops and pushes. False if t is not allowed in a
+ * program with num_variables variables. */
+bool program_stack_effect(const token *t, size_t num_variables, size_t *out_pops, size_t *out_pushes);
+/* Checks that a program can be evaluated without jumping out of bounds or
+ * underflowing the stack, and that it references no more than num_variables
+ * variables. User function calls are not allowed. */
+status program_verify(const token *tokens, size_t size, size_t num_variables, size_t *out_max_stack_depth);
+status program_save(dynamic_array *tokens, size_t num_variables, const char *path);
+status program_load(const char *path, size_t num_variables, loaded_program *out);
+void program_unload(loaded_program *program);
+
+#endif
@@ -0,0 +1,32 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "random.h"
+
+#include <time.h>
+#include <unistd.h>
+
+uint64_t random_seed;
+
+thread_local uint64_t random_row;
+thread_local uint64_t random_draw;
+
+/* The time and process id, through the finalizer of splitmix64, so that
+ * runs started together still get unrelated seeds. */
+uint64_t random_default_seed(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t z = ((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec) ^ (uint64_t) getpid() << 40;
+    z = (z ^ z >> 30) * UINT64_C(0xBF58476D1CE4E5B9);
+    z = (z ^ z >> 27) * UINT64_C(0x94D049BB133111EB);
+    return z ^ z >> 31;
+}
+
+size_t random_draws_in(const token *tokens, const size_t size) {
+    size_t draws = 0;
+    for (size_t q = 0; q < size; q++) {
+        if (tokens[q].type == FUNCTION && is_random_function(tokens[q].function)) {
+            draws++;
+        }
+    }
+    return draws;
+}
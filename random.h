@@ -0,0 +1,95 @@
+#ifndef CCALC_RANDOM_H
+#define CCALC_RANDOM_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "fast_math.h"
+#include "tokenizer.h"
+
+/* rand(), randn() and randint(a, b) draw from Philox4x32-10, a
+ * counter-based generator (Salmon et al., "Parallel random numbers: as
+ * easy as 1, 2, 3", SC 2011). A number is a pure function of the seed, a
+ * row and a draw, so rows can be evaluated in any order, by any thread or
+ * block, and still give the same numbers. */
+
+extern uint64_t random_seed;
+
+/* The row that evaluation on this thread draws for, and the next draw.
+ * Each random token takes a new draw; block evaluation takes it for the
+ * rows random_row up to random_row + count at once. */
+extern thread_local uint64_t random_row;
+extern thread_local uint64_t random_draw;
+
+/* A seed that differs from run to run, for when --seed is not given. */
+uint64_t random_default_seed(void);
+/* The number of draws one evaluation of a straight-line program takes. */
+size_t random_draws_in(const token *tokens, size_t size);
+
+/* Starts drawing for a row, like limits_start() starts an evaluation. */
+static inline void random_start(const uint64_t row) {
+    random_row = row;
+    random_draw = 0;
+}
+
+static inline bool is_random_function(const function_token ft) {
+    return ft == RAND || ft == RANDN || ft == RANDINT;
+}
+
+static inline void philox_round(uint32_t ctr[4], const uint32_t key[2]) {
+    const uint64_t p0 = (uint64_t) 0xD2511F53u * ctr[0];
+    const uint64_t p1 = (uint64_t) 0xCD9E8D57u * ctr[2];
+    const uint32_t c1 = ctr[1];
+    const uint32_t c3 = ctr[3];
+    ctr[0] = (uint32_t) (p1 >> 32) ^ c1 ^ key[0];
+    ctr[1] = (uint32_t) p1;
+    ctr[2] = (uint32_t) (p0 >> 32) ^ c3 ^ key[1];
+    ctr[3] = (uint32_t) p0;
+}
+
+/* 128 random bits for the counter (row, draw). Plain integer arithmetic
+ * without branches, so loops over rows vectorize. */
+static inline void random_bits(const uint64_t row, const uint64_t draw, uint64_t out[2]) {
+    uint32_t ctr[4] = {(uint32_t) row, (uint32_t) (row >> 32), (uint32_t) draw, (uint32_t) (draw >> 32)};
+    uint32_t key[2] = {(uint32_t) random_seed, (uint32_t) (random_seed >> 32)};
+    for (int r = 0; r < 10; r++) {
+        philox_round(ctr, key);
+        key[0] += 0x9E3779B9u;
+        key[1] += 0xBB67AE85u;
+    }
+    out[0] = ctr[0] | (uint64_t) ctr[1] << 32;
+    out[1] = ctr[2] | (uint64_t) ctr[3] << 32;
+}
+
+/* A multiple of 2^-bits in [0, 1), for bits <= 52, made by filling in the
+ * mantissa of a number in [1, 2). With bits no more than the mantissa of
+ * the evaluation type, rounding to it cannot reach 1. */
+static inline double random_fraction(const uint64_t bits, const int num_bits) {
+    return fast_double_from_bits(UINT64_C(0x3FF0000000000000) | bits >> (64 - num_bits) << (52 - num_bits)) - 1.0;
+}
+
+static inline double random_uniform(const uint64_t row, const uint64_t draw, const int num_bits) {
+    uint64_t bits[2];
+    random_bits(row, draw, bits);
+    return random_fraction(bits[0], num_bits);
+}
+
+/* Box-Muller, with 1 - u in (0, 1] so that the logarithm is finite. */
+static inline double random_normal(const uint64_t row, const uint64_t draw) {
+    uint64_t bits[2];
+    random_bits(row, draw, bits);
+    const double u = 1.0 - random_fraction(bits[0], 52);
+    const double v = random_fraction(bits[1], 52);
+    return sqrt(-2.0 * log(u)) * cos(0x1.921fb54442d18p+2 * v);
+}
+
+/* An integer from ceil(a) to floor(b), each equally likely, or NaN when
+ * there is none. */
+static inline double random_integer(const double a, const double b, const uint64_t row, const uint64_t draw) {
+    const double low = ceil(a);
+    const double high = floor(b);
+    const double k = low + floor(random_uniform(row, draw, 52) * (high - low + 1.0));
+    return low <= high ? fmin(k, high) : NAN;
+}
+
+#endif
@@ -34,6 +34,20 @@ test_exact() {
     assert_equals "${EXPECTED}" "${ACTUAL}" "${EXPRESSION}"
 }
 
+test_rpn() {
+    EXPECTED=$1
+    EXPRESSION=$2
+    ACTUAL="$("${CMD}" --rpn "${EXPRESSION}")"
+    assert_equals "${EXPECTED}" "${ACTUAL}" "--rpn ${EXPRESSION}"
+}
+
+test_batch() {
+    EXPECTED=$1
+    INPUT=$2
+    ACTUAL="$(printf "${INPUT}" | "${CMD}" --batch | tr '\n' ' ')"
+    assert_equals "${EXPECTED}" "${ACTUAL}" "--batch ${INPUT}"
+}
+
 # operators
 test_exact "1" "1"
 test_exact "-1" "-1"
@@ -54,6 +68,245 @@ test_exact "8" "2^3"
 test_exact "262144" "4^(3^2)"
 test_exact "262144" "4^3^2"
 test_exact "4096" "(4^3)^2"
+test_exact "0.5" "2^-1"
+test_exact "0.25" "(1+1)^-2"
+test_exact "-8" "(-2)^3"
+test_exact "1" "6.435^3 == 6.435*6.435*6.435"
+test_exact "1" "6.435^(1+2) == 6.435*6.435*6.435"
+test_exact "INF" "0^-1"
+test_exact "9.99988867182683E-321" "1e5^-64"
+test_exact "-9.99999998481684E-316" "(-1e5)^-63"
+test_rpn "9.99988867182683E-321" "1e5 64 neg ^"
+assert_equals "9.99988867182683E-321" "$("${CMD}" --sweep x=1e5:1e5:1 "x^-64")" "block x^-64 below the normal range"
+test_rpn "1" "6.435 3 ^ 6.435 6.435 * 6.435 * =="
+
+# comparisons and conditionals
+test_exact "1" "1<2"
+test_exact "0" "2<2"
+test_exact "1" "2<=2"
+test_exact "0" "1>2"
+test_exact "1" "2>=2"
+test_exact "1" "3==3"
+test_exact "0" "3!=3"
+test_exact "1" "1+1==2"
+test_exact "2" "if(1, 2, 3)"
+test_exact "3" "if(0, 2, 3)"
+test_exact "5" "if(2>1, 5, sqrt(-1))"
+test_exact "7" "1 + if(0, 1, if(1, 6, 2))"
+test_exact "1" "1 and 2"
+test_exact "0" "1 and 0"
+test_exact "0" "0 and 1/0"
+test_exact "1" "0 or 2"
+test_exact "1" "1 or 1/0"
+test_exact "0" "0 or 0"
+test_exact "1" "1<2 and 2<3 or 0"
+test_exact "error: wrong number of function arguments" "if(1, 2)"
+test_exact "error: wrong number of function arguments" "sin(1, 2)"
+test_rpn "7" "1 2 3 * +"
+test_rpn "2" "1 2 3 if"
+test_rpn "1" "1 2 <"
+test_rpn "0" "1 0 and"
+
+# streaming RPN from stdin, across chunk boundaries
+assert_equals "3" "$(echo "1 2 +" | "${CMD}" --rpn)" "--rpn stdin"
+assert_equals "30000" "$( (echo 0; yes "1 +" | head -n 30000) | "${CMD}" --rpn)" "--rpn stdin long"
+assert_equals "300000" "$( (echo 0; yes "10+" | head -n 30000) | tr '\n' ' ' | "${CMD}" --rpn)" "--rpn stdin long line"
+assert_equals "300000" "$( (printf '0 '; yes "10+" | head -n 30000 | tr -d '\n') | "${CMD}" --rpn)" "--rpn stdin without whitespace"
+assert_equals "2000000000" "$( (printf '0 '; yes "1e+5+" | head -n 20000 | tr -d '\n') | "${CMD}" --rpn)" "--rpn stdin exponent signs"
+assert_equals "error: token too long for streaming input" "$(head -c 70000 /dev/zero | tr '\0' '1' | "${CMD}" --rpn)" "--rpn stdin long token"
+
+# user-defined functions
+test_batch "9 " "def sq(x) = x*x\nsq(3)\n"
+test_batch "1 3 " "1\n\n3\n"
+test_batch "42 " "def answer() = 42\nanswer()\n"
+test_batch "3628800 " "def fact(n) = if(n <= 1, 1, n * fact(n - 1))\nfact(10)\n"
+test_batch "12586269025 " "def memo fib(n) = if(n < 2, n, fib(n-1) + fib(n-2))\nfib(50)\n"
+test_batch "7 " "def f(x, y) = x + 2 * y\nf(1, 3)\n"
+test_batch "error: 1:5: name is reserved for a built-in function or constant " "def sin(x) = x\n"
+test_batch "error: 1:5: name is reserved for a built-in function or constant " "def sum(v) = v + 1\n"
+test_batch "error: name is reserved for a built-in function or constant " "def f(norm) = norm\n"
+test_batch "error: function already defined " "def f(x) = x\ndef f(x) = x\n"
+test_batch "error: invalid function definition " "def f(x, x) = x\n"
+test_batch "error: 2:1: wrong number of function arguments " "def f(x) = x\nf(1, 2)\n"
+test_batch "error: function calls nested too deeply " "def f(x) = f(x)\nf(1)\n"
+
+# resource limits
+test_exact "error: invalid exponent" "1e"
+test_exact "INF" "1e999999999999999999999"
+assert_equals "error: too many tokens" "$("${CMD}" --max-tokens 3 "1+2+3")" "--max-tokens"
+assert_equals "6" "$("${CMD}" --max-tokens 5 "1+2+3")" "--max-tokens exact"
+assert_equals "error: input too large" "$("${CMD}" --max-input-bytes 4 "1+2+3")" "--max-input-bytes"
+assert_equals "error: expression nested too deeply" "$("${CMD}" --max-nesting 2 "((1))")" "--max-nesting"
+RAW_FILE=$(mktemp)
+"${CMD}" --raw-output --sweep i=1:40000:1 i > "${RAW_FILE}"
+assert_equals "80001 80001 1 " "$( ("${CMD}" --max-steps 5 --input x="${RAW_FILE}" "x*2+1" | tail -n 1; "${CMD}" --max-steps 5 --sweep x=1:40000:1 "x*2+1" | tail -n 1; "${CMD}" --max-steps 5 --repeat 40000 --aggregate-only --aggregate min "2^0") | sed 's/min = //' | tr '\n' ' ')" "--max-steps per row"
+assert_equals "error: evaluation step limit exceeded error: evaluation step limit exceeded error: evaluation step limit exceeded " "$( ("${CMD}" --max-steps 4 --input x="${RAW_FILE}" "x*2+1"; "${CMD}" --max-steps 4 --sweep x=1:40000:1 "x*2+1"; echo "1*2+1" | "${CMD}" -b --max-steps 4) | tr '\n' ' ')" "--max-steps exceeded per row"
+rm -f "${RAW_FILE}"
+assert_equals "error: 1:5001: expression nested too deeply" "$(awk 'BEGIN { for (i = 0; i < 100000; i++) printf "("; printf "1"; for (i = 0; i < 100000; i++) printf ")"; print "" }' | "${CMD}" -b --max-nesting 0 2>/dev/null)" "--max-nesting 0 keeps a ceiling"
+assert_equals "error: expression nested too deeply" "$("${CMD}" "$(head -c 5000 /dev/zero | tr '\0' '(')1")" "default nesting"
+assert_equals "error: stack too deep" "$("${CMD}" --rpn --max-stack 2 "1 2 3 + +")" "--max-stack"
+assert_equals "error: evaluation step limit exceeded" "$(printf 'def f(n) = if(n < 1, 0, f(n - 1))\nf(1000)\n' | "${CMD}" --batch --max-steps 1000)" "--max-steps"
+assert_equals "error: evaluation deadline exceeded" "$(printf 'def f(n) = if(n < 1, 0, f(n - 1) + f(n - 1))\nf(60)\n' | "${CMD}" --batch --timeout 50)" "--timeout"
+assert_equals "error: invalid option argument" "$("${CMD}" --timeout soon 1)" "--timeout invalid"
+
+# sweeps
+assert_equals "0 1 4 9 16 " "$("${CMD}" --sweep x=0:4:1 "x^2" | tr '\n' ' ')" "--sweep"
+assert_equals "0 0.1 0.2 0.3 " "$("${CMD}" --sweep x=0:0.3:0.1 x | tr '\n' ' ')" "--sweep inclusive stop"
+assert_equals "3 2 1 " "$("${CMD}" --sweep t=3:1:-1 t | tr '\n' ' ')" "--sweep descending"
+assert_equals "1 1.25 1.5 2 2.25 2.5 " "$("${CMD}" --sweep x=1:2:1 --sweep y=0:0.5:0.25 "x + y" | tr '\n' ' ')" "--sweep grid"
+assert_equals "1 16385 98305 100000 " "$("${CMD}" --threads 3 --sweep x=1:100000:1 x | sed -n '1p;16385p;98305p;$p' | tr '\n' ' ')" "--sweep many blocks"
+assert_equals "1 0 " "$("${CMD}" --sweep x=1:2:1 "if(x < 2, 1, 0)" | tr '\n' ' ')" "--sweep if"
+assert_equals "2 3 " "$("${CMD}" --sweep x=1:2:1 --raw-output "x + 1" | "${CMD}" --input y=- y | tr '\n' ' ')" "--sweep --raw-output"
+assert_equals "error: invalid option argument" "$("${CMD}" --sweep x=1:0:1 x)" "--sweep empty"
+assert_equals "error: invalid option argument" "$("${CMD}" --sweep x=0:1:0 x)" "--sweep zero step"
+
+# polynomials rewritten by -O
+test_exact "10" "fma(2, 3, 4)"
+test_exact "5.55111512312578E-17" "fma(0.1, 10, -1)" # double only
+test_rpn "10" "2 3 4 fma"
+assert_equals "8.5 24 71.5 " "$("${CMD}" -O --sweep x=1:3:1 "3*x^3 - 2*x^2 + 0.5*x + 7" | tr '\n' ' ')" "-O --sweep"
+assert_equals "15 9 " "$(printf 'def p(x) = 2*x^2 + 3*x + 1\np(2)\np(2) - p(1)\n' | "${CMD}" -O --batch | tr '\n' ' ')" "-O --batch"
+assert_equals "6 9 12 " "$("${CMD}" -O --sweep x=1:3:1 --sweep y=2:2:1 "(x + 1)*(y + 1)" | tr '\n' ' ')" "-O two variables"
+assert_equals "1594323" "$("${CMD}" -O --sweep x=2:2:1 "(x + 1) * ((x^3 + 1)^6)")" "-O polynomial beside a rewritten part"
+assert_equals "0 0 " "$( ("${CMD}" -O --sweep x=0:0:1 "x*1e308*10"; "${CMD}" -O --precision float --sweep x=0:0:1 "x*1e30*1e10") | tr '\n' ' ')" "-O overflowing coefficient"
+
+# precision
+test_exact "1E+60" "1e60"
+test_exact "-1E+300" "-1e300"
+test_exact "1E-300" "1e-300"
+test_exact "1" "1e-30*1e30"
+test_rpn "1E+60" "1e60 1 *"
+assert_equals "0.333333" "$("${CMD}" --precision float "1/3")" "--precision float"
+assert_equals "0.333333333333333333" "$("${CMD}" --precision long-double "1/3")" "--precision long-double"
+assert_equals "1" "$("${CMD}" --precision long-double "1e16 + 1 - 1e16")" "--precision long-double sum"
+assert_equals "0.1" "$("${CMD}" --precision long-double "0.1")" "--precision long-double literal"
+assert_equals "1E+30 1E-30 1 INF 0 " "$(for e in 1e30 1e-30 1e-30*1e30 1e60 1e-300; do "${CMD}" --precision float "$e"; done | tr '\n' ' ')" "--precision float large and tiny literals"
+assert_equals "1E+60 -1E+300 1E-300 1 9.99999999999997E-311 " "$(for e in 1e60 -1e300 1e-300 1e-30*1e30 1e-310; do "${CMD}" --precision double "$e"; done | tr '\n' ' ')" "--precision double large and tiny literals"
+assert_equals "1E+60 -1E+300 1E-300 1 1E-310 " "$(for e in 1e60 -1e300 1e-300 1e-30*1e30 1e-310; do "${CMD}" --precision long-double "$e"; done | tr '\n' ' ')" "--precision long-double large and tiny literals"
+assert_equals "1E+60" "$("${CMD}" "sum([1e60])")" "vector of a large literal"
+assert_equals "1E+60 1E+60 " "$(for p in double long-double; do "${CMD}" --precision "$p" -O --sweep x=1:1:1 "1e60*x^3 + 2*x^2 + 3*x + 4"; done | tr '\n' ' ')" "-O large coefficient"
+assert_equals "0.333333 0.666667 1 " "$("${CMD}" --precision float --sweep x=1:3:1 "x/3" | tr '\n' ' ')" "--precision float --sweep"
+assert_equals "0.333333 " "$(printf 'def f(x) = x/3\nf(1)\n' | "${CMD}" --precision float --batch | tr '\n' ' ')" "--precision float --batch"
+assert_equals "error: invalid option argument" "$("${CMD}" --precision quad 1)" "--precision quad"
+
+# approximations for --fast-math
+assert_equals "all approximations within bounds" "$("${CMD}" --check-fast-math | tail -1)" "--check-fast-math"
+assert_equals "$("${CMD}" "sin(1) + cos(2) + exp(3) + ln(10) + tanh(0.3)")" "$("${CMD}" --fast-math=4 "sin(1) + cos(2) + exp(3) + ln(10) + tanh(0.3)")" "--fast-math"
+assert_equals "1 1.71828 5.38906 " "$("${CMD}" --fast-math=4 --precision float --sweep x=0:2:1 "sin(x*pi) + exp(x) - x" | tr '\n' ' ')" "--fast-math --sweep"
+assert_equals "0.761594155955765 " "$(printf 'def f(x) = tanh(x)\nf(1)\n' | "${CMD}" --fast-math=2 --batch | tr '\n' ' ')" "--fast-math --batch"
+assert_equals "error: invalid option argument" "$("${CMD}" --fast-math=0 1)" "--fast-math=0"
+assert_equals "error: invalid option argument" "$("${CMD}" --fast-math=x 1)" "--fast-math=x"
+
+# aggregates
+assert_equals "1 2 3 4 count = 4 sum = 10 mean = 2.5 min = 1 max = 4 stddev = 1.29099444873581 p0 = 1 p100 = 4 " "$(printf '1\n2\n3\n4\n' | "${CMD}" -b --aggregate count,sum,mean,min,max,stddev,p0,p100 | tr '\n' ' ')" "--aggregate --batch"
+assert_equals "sum = 1 " "$(printf '1e16\n1\n-1e16\n' | "${CMD}" -b --aggregate-only --aggregate sum | tr '\n' ' ')" "--aggregate compensated sum"
+assert_equals "sum = 500000500000 mean = 500000.5 " "$("${CMD}" --sweep x=1:1000000:1 --aggregate-only --aggregate sum,mean x | tr '\n' ' ')" "--aggregate --sweep"
+assert_equals "$("${CMD}" --threads 1 --sweep x=0:10:0.0001 --aggregate-only --aggregate sum,stddev,p90 "sin(x)")" "$("${CMD}" --threads 3 --sweep x=0:10:0.0001 --aggregate-only --aggregate sum,stddev,p90 "sin(x)")" "--aggregate merged across threads"
+assert_equals "p50 = 504028.297055243 " "$("${CMD}" --sweep x=1:1000000:1 --aggregate-only --aggregate p50 x | tr '\n' ' ')" "--aggregate quantile within 1%"
+assert_equals "count = 2 sum = NAN " "$(printf '1\nsqrt(-1)\n' | "${CMD}" -b --aggregate-only --aggregate count,sum | tr '\n' ' ')" "--aggregate NaN"
+assert_equals "sum = INF mean = 1.25E+308 stddev = 3.53553390593274E+307 " "$("${CMD}" --aggregate sum,mean,stddev --aggregate-only --sweep x=0:1:1 "1e308*(x/2+1)" | tr '\n' ' ')" "--aggregate overflowing sum"
+assert_equals "mean = 5.00005E+307 stddev = 2.88676577966877E+307 " "$("${CMD}" --aggregate mean,stddev --aggregate-only --threads 3 --sweep x=1:100000:1 "x*1e303" | tr '\n' ' ')" "--aggregate overflowing sum merged"
+assert_equals "mean = -INF stddev = NAN " "$(printf '1\n-1/0\n' | "${CMD}" -b --aggregate-only --aggregate mean,stddev | tr '\n' ' ')" "--aggregate infinity"
+assert_equals "mean = NAN " "$(printf '1/0\n-1/0\n' | "${CMD}" -b --aggregate-only --aggregate mean | tr '\n' ' ')" "--aggregate infinities of both signs"
+assert_equals "error: invalid option argument" "$("${CMD}" --aggregate median 1)" "--aggregate unknown"
+assert_equals "error: invalid option argument" "$("${CMD}" --aggregate-only 1)" "--aggregate-only alone"
+
+# batch I/O
+BATCH_INPUT="$(awk 'BEGIN { for (i = 1; i <= 100000; i++) print i "*2+1"; printf "sqrt(" }'; printf '2)')"
+BATCH_SYNC="$(printf '%s' "${BATCH_INPUT}" | "${CMD}" -b --io sync | cksum)"
+assert_equals "${BATCH_SYNC}" "$(printf '%s' "${BATCH_INPUT}" | "${CMD}" -b --io threads | cksum)" "--io threads"
+assert_equals "${BATCH_SYNC}" "$(printf '%s' "${BATCH_INPUT}" | "${CMD}" -b --io io-uring | cksum)" "--io io-uring"
+assert_equals "3 1.4142135623731 " "$(printf '%s' "${BATCH_INPUT}" | "${CMD}" -b --io io-uring | sed -n '1p;$p' | tr '\n' ' ')" "--io first and last line"
+assert_equals "1000001 " "$(awk 'BEGIN { for (i = 0; i < 1000000; i++) printf "1+"; print "1" }' | "${CMD}" -b --io io-uring --threads 1 | tr '\n' ' ')" "--io line longer than a block"
+assert_equals "error: invalid option argument" "$("${CMD}" --io bogus 1)" "--io unknown"
+
+# vectors
+assert_equals "[3, 5, 7]" "$("${CMD}" "[1, 2, 3] * 2 + 1")" "vector element-wise"
+assert_equals "32" "$("${CMD}" "dot([1, 2, 3], [4, 5, 6])")" "vector dot"
+assert_equals "5" "$("${CMD}" "norm([3, 4])")" "vector norm"
+assert_equals "[7, 12, 10]" "$("${CMD}" "sum([1, 2, 3]) + [1, 2 * 3, sqrt(16)]")" "vector sum broadcast"
+assert_equals "error: vectors differ in length" "$("${CMD}" "[1, 2] + [1, 2, 3]")" "vector length mismatch"
+assert_equals "error: vector where a number is expected" "$("${CMD}" "[[1], 2]")" "vector nested"
+assert_equals "error: unmatched bracket" "$("${CMD}" "[1, 2")" "vector unmatched bracket"
+assert_equals "[1, 2]" "$("${CMD}" --precision long-double "[1, 2] * exp(1000) / exp(1000)")" "vector long double beyond double range"
+VECTOR_FILE=$(mktemp)
+"${CMD}" --raw-output --sweep i=1:5000:1 "i" > "${VECTOR_FILE}"
+assert_equals "25005000" "$("${CMD}" --vector v="${VECTOR_FILE}" "sum(v * 2 + 1) - 5000")" "--vector sum across chunks"
+assert_equals "[2, 4, 6] 3.5 " "$(printf '[1, 2, 3] * 2\n7 / 2\n' | "${CMD}" -b | tr '\n' ' ')" "vector batch"
+assert_equals "error: invalid option argument" "$("${CMD}" --vector v="${VECTOR_FILE}" --input w="${VECTOR_FILE}" "v + w")" "--vector with --input"
+rm -f "${VECTOR_FILE}"
+
+# random numbers
+assert_equals "$("${CMD}" --seed 42 "rand()")" "$("${CMD}" --seed 42 "rand()")" "--seed reproducible"
+assert_equals "sum = 100000" "$("${CMD}" --seed 1 --repeat 100000 --aggregate-only --aggregate sum "rand() >= 0 and rand() < 1")" "rand range"
+assert_equals "sum = 100000" "$("${CMD}" --seed 1 --precision float --repeat 100000 --aggregate-only --aggregate sum "rand() < 1")" "rand range float"
+assert_equals "min = 1 max = 6 " "$("${CMD}" --seed 1 --repeat 100000 --aggregate-only --aggregate min,max "randint(1, 6)" | tr '\n' ' ')" "randint range"
+assert_equals "NAN" "$("${CMD}" "randint(3, 2)")" "randint empty range"
+assert_equals "$("${CMD}" --seed 7 --threads 1 --repeat 100000 "rand() + randn()" | cksum)" "$("${CMD}" --seed 7 --threads 3 --repeat 100000 "rand() + randn()" | cksum)" "--repeat independent of threads"
+assert_equals "$("${CMD}" --seed 5 --repeat 1000 "rand() * randint(0, 9)")" "$("${CMD}" --seed 5 --repeat 1000 "if(1, rand() * randint(0, 9), 0)")" "rand blocks match rows"
+assert_equals "$("${CMD}" --seed 9 "rand()")" "$(printf 'rand()\n' | "${CMD}" --seed 9 -b)" "rand batch"
+assert_equals "mean = 3.13208 " "$("${CMD}" --seed 1 --repeat 100000 --aggregate-only --aggregate mean "4 * (rand()^2 + rand()^2 <= 1)" | tr '\n' ' ')" "--repeat Monte Carlo"
+assert_equals "2 " "$("${CMD}" --seed 3 --sweep x=1:3:1 --repeat 100 --aggregate-only --aggregate mean "x + randn() * 0" | tr '\n' ' ' | sed 's/mean = //')" "--repeat with --sweep"
+assert_equals "error: invalid option argument" "$("${CMD}" --repeat 0 "rand()")" "--repeat 0"
+assert_equals "error: wrong number of function arguments" "$("${CMD}" "rand(1)")" "rand arity"
+
+# error positions
+test_batch "3 error: 3:5: unexpected character " "1 + 2\n\n1 + \$ 2\n"
+test_batch "error: 1:15: unexpected end of input " "def f(x) = x +\n"
+test_batch "error: 1:4: unexpected end of input " "2 *\n"
+test_batch "error: 1:1: wrong number of function arguments " "if(1, 2)\n"
+test_batch "error: 1:9: wrong number of function arguments " "1 + 2 * fma(1, 2)\n"
+assert_equals "1:1: (1 + 2|     ^" "$(printf '(1 + 2\n' | "${CMD}" --batch 2>&1 >/dev/null | tr '\n' '|' | sed 's/|$//')" "--batch caret under an unmatched parenthesis"
+assert_equals "1:5: 2 * foo|         ^^^" "$(printf '2 * foo\n' | "${CMD}" --batch 2>&1 >/dev/null | tr '\n' '|' | sed 's/|$//')" "--batch caret under a name"
+LONG_LINE="$(printf '1 + %.0s' $(seq 1 500))"
+assert_equals "1:2001: ...1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + |                                               ^" "$(printf '%s\n' "${LONG_LINE}" | "${CMD}" --batch 2>&1 >/dev/null | tr '\n' '|' | sed 's/|$//')" "--batch caret in a long line"
+assert_equals "error: 1:2005: unmatched parenthesis" "$(printf '%s2 * (3 + 4\n' "${LONG_LINE}" | "${CMD}" --batch 2>/dev/null)" "--batch unmatched parenthesis in a long line"
+test_batch "2 error: 2:5: unmatched bracket " "1 + 1\n2 * [1, [2, 3]\n"
+
+# large expressions split across threads
+EXPRESSION_FILE=$(mktemp)
+(yes "sin(0.5) * 0.25 + cos(0.125) / 3 +" | head -n 20000; echo 1) > "${EXPRESSION_FILE}"
+assert_equals "9012.77880788743" "$("${CMD}" --threads 1 < "${EXPRESSION_FILE}")" "--threads 1"
+assert_equals "$("${CMD}" --threads 1 --raw-output < "${EXPRESSION_FILE}" | od -An -tx8)" "$("${CMD}" --threads 4 --raw-output < "${EXPRESSION_FILE}" | od -An -tx8)" "--threads bit-identical"
+assert_equals "9012.77880788743" "$("${CMD}" --threads 3 < "${EXPRESSION_FILE}")" "--threads 3"
+rm -f "${EXPRESSION_FILE}"
+
+# spreadsheet mode
+SHEET_FILE=$(mktemp)
+printf '# a model\nrevenue = price * qty\nprice = 12\nqty = 3\n\ncost = 20\nmargin = revenue - cost\n' > "${SHEET_FILE}"
+assert_equals "revenue = 36 price = 12 qty = 3 cost = 20 margin = 16 # recomputed 5 of 5 cells " "$("${CMD}" --sheet "${SHEET_FILE}" < /dev/null | tr '\n' ' ')" "--sheet"
+assert_equals "revenue = 48 qty = 4 margin = 28 # recomputed 3 of 5 cells " "$(echo 'qty = 4' | "${CMD}" --sheet "${SHEET_FILE}" --threads 2 | tail -n +7 | tr '\n' ' ')" "--sheet update"
+assert_equals "cost = 30 margin = 6 # recomputed 2 of 5 cells " "$(echo 'cost = 30' | "${CMD}" --sheet "${SHEET_FILE}" | tail -n +7 | tr '\n' ' ')" "--sheet update leaf"
+assert_equals "error: formulas depend on each other in a cycle" "$(echo 'price = margin' | "${CMD}" --sheet "${SHEET_FILE}" | tail -n +7)" "--sheet update cycle"
+assert_equals "error: no such cell" "$(echo 'volume = 1' | "${CMD}" --sheet "${SHEET_FILE}" | tail -n +7)" "--sheet unknown cell"
+printf 'a = b + 1\nb = c + 1\nc = a + 1\n' > "${SHEET_FILE}"
+assert_equals "error: formulas depend on each other in a cycle" "$("${CMD}" --sheet "${SHEET_FILE}" < /dev/null)" "--sheet cycle"
+printf 'a = 1\nb == 2\n' > "${SHEET_FILE}"
+assert_equals "error: invalid formula, expected name = expression" "$("${CMD}" --sheet "${SHEET_FILE}" < /dev/null)" "--sheet invalid"
+rm -f "${SHEET_FILE}"
+
+# compiled programs
+PROGRAM_FILE=$(mktemp)
+"${CMD}" --compile "if(2 > 1, 3 * 4, sqrt(-1)) + 1" -o "${PROGRAM_FILE}"
+assert_equals "13" "$("${CMD}" --load "${PROGRAM_FILE}")" "--load"
+"${CMD}" --rpn --compile "2 3 ^ 1 -" -o "${PROGRAM_FILE}"
+assert_equals "7" "$("${CMD}" --load "${PROGRAM_FILE}")" "--rpn --load"
+"${CMD}" -O --compile "x^2/2 + x + 1" --input x=/dev/null -o "${PROGRAM_FILE}"
+assert_equals "2.5 " "$("${CMD}" --sweep x=1:1:1 --load "${PROGRAM_FILE}" | tr '\n' ' ')" "-O --load"
+printf "garbage" > "${PROGRAM_FILE}"
+assert_equals "error: not a compiled program, or compiled by another version" "$("${CMD}" --load "${PROGRAM_FILE}")" "--load garbage"
+rm -f "${PROGRAM_FILE}"
+
+# raw binary columns
+COLUMN_FILE=$(mktemp)
+printf '\0\0\0\0\0\0\360\77\0\0\0\0\0\0\0\100' > "${COLUMN_FILE}"
+assert_equals "10 20 " "$("${CMD}" --input x="${COLUMN_FILE}" "x * 10" | tr '\n' ' ')" "--input"
+assert_equals "2 4 " "$("${CMD}" --input x="${COLUMN_FILE}" --input y=- "x + y" < "${COLUMN_FILE}" | tr '\n' ' ')" "--input stdin"
+assert_equals "2 3 " "$("${CMD}" --input x="${COLUMN_FILE}" --raw-output "x + 1" | "${CMD}" --input y=- y | tr '\n' ' ')" "--raw-output"
+assert_equals "0 1 " "$("${CMD}" --input x="${COLUMN_FILE}" "if(x > 1, 1, 0)" | tr '\n' ' ')" "--input if"
+printf '\0\0\0' >> "${COLUMN_FILE}"
+assert_equals "error: input column is not a whole number of doubles" "$("${CMD}" --input x="${COLUMN_FILE}" x)" "--input truncated"
+rm -f "${COLUMN_FILE}"
 
 # the use of "round(1000* ... )" is for coping with rounding errors
 
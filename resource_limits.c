@@ -0,0 +1,65 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "resource_limits.h"
+
+#include <time.h>
+
+/* Steps between looks at the clock. */
+#define DEADLINE_CHECK_INTERVAL 4096
+
+resource_limits active_limits = {
+    /* the parser recurses on nesting, so there is always a ceiling, and
+     * MAX_NESTING_DEPTH caps whatever is set */
+    .max_nesting_depth = 1000,
+};
+
+thread_local uint64_t steps_taken;
+thread_local uint64_t next_budget_check = UINT64_MAX;
+static thread_local uint64_t step_budget;
+static thread_local uint64_t deadline_ns;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t next_check_after(const uint64_t steps) {
+    uint64_t next = active_limits.timeout_ms > 0 ? steps + DEADLINE_CHECK_INTERVAL : UINT64_MAX;
+    if (step_budget > 0 && step_budget + 1 < next) {
+        next = step_budget + 1;
+    }
+    return next;
+}
+
+/* a * b, or UINT64_MAX - 1 where that overflows, so that the budget
+ * plus one still fits */
+static uint64_t scaled(const uint64_t a, const uint64_t b) {
+    return b != 0 && a > (UINT64_MAX - 1) / b ? UINT64_MAX - 1 : a * b;
+}
+
+void limits_start(void) {
+    limits_start_rows(1);
+}
+
+void limits_start_rows(const uint64_t rows) {
+    steps_taken = 0;
+    step_budget = scaled(active_limits.max_steps, rows);
+    if (active_limits.timeout_ms > 0) {
+        const uint64_t now = now_ns();
+        const uint64_t budget_ns = scaled(scaled(active_limits.timeout_ms, 1000000), rows);
+        deadline_ns = budget_ns < UINT64_MAX - now ? now + budget_ns : UINT64_MAX;
+    }
+    next_budget_check = next_check_after(0);
+}
+
+status limits_check_budget(void) {
+    if (step_budget > 0 && steps_taken > step_budget) {
+        return STEP_LIMIT_EXCEEDED;
+    }
+    if (active_limits.timeout_ms > 0 && now_ns() >= deadline_ns) {
+        return DEADLINE_EXCEEDED;
+    }
+    next_budget_check = next_check_after(steps_taken);
+    return OK;
+}
@@ -0,0 +1,46 @@
+#ifndef CCALC_RESOURCE_LIMITS_H
+#define CCALC_RESOURCE_LIMITS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "status.h"
+
+/* The parser recurses on nesting, and deeper than this could overflow
+ * the stack, so max_nesting_depth is capped here, also when it is 0. */
+#define MAX_NESTING_DEPTH 5000
+
+/* Resource limits for evaluating untrusted input. 0 means unlimited,
+ * but for max_nesting_depth, which MAX_NESTING_DEPTH always caps. */
+typedef struct {
+    size_t max_input_bytes;
+    size_t max_tokens;
+    size_t max_nesting_depth;
+    size_t max_stack_depth;
+    uint64_t max_steps;
+    uint64_t timeout_ms;
+} resource_limits;
+
+extern resource_limits active_limits;
+
+/* Step accounting is per thread. next_budget_check is the step count at
+ * which limits_check_budget() must look at the step limit and the clock
+ * again, so the common path is a single comparison. */
+extern thread_local uint64_t steps_taken;
+extern thread_local uint64_t next_budget_check;
+
+/* Resets the step count and starts the clock for a new evaluation of one
+ * row. The limits apply per row, so rows evaluated together as a block
+ * share rows times the limits. */
+void limits_start(void);
+void limits_start_rows(uint64_t rows);
+status limits_check_budget(void);
+
+static inline status limits_step(const uint64_t steps) {
+    steps_taken += steps;
+    if (steps_taken >= next_budget_check) {
+        return limits_check_budget();
+    }
+    return OK;
+}
+
+#endif
@@ -0,0 +1,97 @@
+#include "rpn_stream.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "resource_limits.h"
+#include "stack_calculator.h"
+#include "tokenizer.h"
+
+#define CHUNK_SIZE 65536
+
+typedef struct {
+    dynamic_array *stack;
+    const symbol_table *symbols;
+    size_t num_tokens;
+} stream_state;
+
+static status apply_token(const token *token, const size_t offset, void *context) {
+    (void) offset;
+    stream_state *state = context;
+    if (active_limits.max_tokens > 0 && ++state->num_tokens > active_limits.max_tokens) {
+        return TOO_MANY_TOKENS;
+    }
+    return stack_apply(state->stack, state->symbols, token);
+}
+
+/* Whether a token ends right before buffer[len]: after whitespace, or
+ * after a one-character operator, which nothing continues. + and - may be
+ * the sign of an exponent, as in 1e+5, so they count only when not after
+ * an e. */
+static bool is_token_boundary(const char *buffer, const size_t len) {
+    const char c = buffer[len - 1];
+    if (isspace(c) || c != '\0' && strchr("*/%^(),[]", c) != NULL) {
+        return true;
+    }
+    return (c == '+' || c == '-') && (len < 2 || buffer[len - 2] != 'e' && buffer[len - 2] != 'E');
+}
+
+/* Length of the prefix that is safe to tokenize: up to the last token
+ * boundary, since a token touching the end may continue in the next
+ * chunk. Input like "1 2+3*" therefore needs no whitespace to stream. */
+static size_t complete_prefix(const char *buffer, const size_t filled) {
+    size_t len = filled;
+    while (len > 0 && !is_token_boundary(buffer, len)) {
+        len--;
+    }
+    return len;
+}
+
+status rpn_stream_calculate(FILE *in, const symbol_table *symbols, double *out_number) {
+    char *buffer = malloc(CHUNK_SIZE);
+    if (buffer == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    stream_state state;
+    state.symbols = symbols;
+    state.num_tokens = 0;
+    size_t total_bytes = 0;
+    status st = stack_new(&state.stack);
+    if (st != OK) {
+        free(buffer);
+        return st;
+    }
+    size_t filled = 0;
+    for (;;) {
+        const size_t n = fread(buffer + filled, 1, CHUNK_SIZE - filled, in);
+        filled += n;
+        total_bytes += n;
+        if (active_limits.max_input_bytes > 0 && total_bytes > active_limits.max_input_bytes) {
+            st = INPUT_TOO_LARGE;
+            break;
+        }
+        const bool at_end = filled < CHUNK_SIZE;
+        if (at_end && ferror(in)) {
+            st = IO_ERROR;
+            break;
+        }
+        const size_t len = at_end ? filled : complete_prefix(buffer, filled);
+        if (len == 0 && !at_end) {
+            st = TOKEN_TOO_LONG;
+            break;
+        }
+        st = tokenize_each(buffer, len, symbols, apply_token, &state, nullptr);
+        if (st != OK || at_end) {
+            break;
+        }
+        memmove(buffer, buffer + len, filled - len);
+        filled -= len;
+    }
+    if (st == OK) {
+        st = stack_result(state.stack, out_number);
+    }
+    dynarr_free(state.stack);
+    free(buffer);
+    return st;
+}
@@ -0,0 +1,12 @@
+#ifndef CCALC_RPN_STREAM_H
+#define CCALC_RPN_STREAM_H
+
+#include <stdio.h>
+#include "status.h"
+#include "symbols.h"
+
+/* Evaluates RPN read from in, applying each token as soon as it is
+ * scanned. Memory use is one input chunk plus the value stack. */
+status rpn_stream_calculate(FILE *in, const symbol_table *symbols, double *out_number);
+
+#endif
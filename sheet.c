@@ -0,0 +1,438 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "sheet.h"
+
+#include <ctype.h>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.h"
+#include "random.h"
+#include "resource_limits.h"
+#include "stack_calculator.h"
+#include "tokenizer.h"
+
+static const char *skip_whitespace(const char *s) {
+    while (isspace(*s)) {
+        s++;
+    }
+    return s;
+}
+
+bool is_sheet_comment(const char *line) {
+    line = skip_whitespace(line);
+    return *line == '\0' || *line == '#';
+}
+
+/* Splits "name = expression" into a fresh copy of the name and a pointer
+ * to the expression. */
+static status scan_formula(const char *line, char **out_name, const char **out_expression) {
+    const char *s = skip_whitespace(line);
+    const char *start = s;
+    if (*s != '_' && !isalpha(*s)) {
+        return INVALID_FORMULA;
+    }
+    while (*s == '_' || isalnum(*s)) {
+        s++;
+    }
+    const char *end = s;
+    s = skip_whitespace(s);
+    if (*s != '=' || s[1] == '=') {
+        return INVALID_FORMULA;
+    }
+    *out_name = strndup(start, end - start);
+    if (*out_name == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    *out_expression = s + 1;
+    return OK;
+}
+
+static bool contains(const dynamic_array *arr, const size_t value) {
+    const size_t *elements = arr->elements;
+    for (size_t q = 0; q < arr->size; q++) {
+        if (elements[q] == value) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void remove_value(dynamic_array *arr, const size_t value) {
+    size_t *elements = arr->elements;
+    for (size_t q = 0; q < arr->size; q++) {
+        if (elements[q] == value) {
+            elements[q] = elements[--arr->size];
+            return;
+        }
+    }
+}
+
+static status compile_formula(const sheet *sheet, const char *expression,
+                              dynamic_array **out_tokens, dynamic_array **out_dependencies) {
+    status st = compile_expression(expression, &sheet->options, sheet->symbols, out_tokens, nullptr);
+    if (st != OK) {
+        return st;
+    }
+    st = dynarr_new(sizeof(size_t), 4, out_dependencies);
+    if (st != OK) {
+        dynarr_free(*out_tokens);
+        return st;
+    }
+    const token *tokens = (*out_tokens)->elements;
+    for (size_t q = 0; q < (*out_tokens)->size && st == OK; q++) {
+        if (tokens[q].type == VARIABLE && !contains(*out_dependencies, tokens[q].variable)) {
+            st = dynarr_append(*out_dependencies, &tokens[q].variable);
+        }
+    }
+    if (st != OK) {
+        dynarr_free(*out_tokens);
+        dynarr_free(*out_dependencies);
+    }
+    return st;
+}
+
+static status link_dependents(sheet *sheet, const size_t idx) {
+    const dynamic_array *dependencies = sheet->cells[idx].dependencies;
+    const size_t *elements = dependencies->elements;
+    for (size_t q = 0; q < dependencies->size; q++) {
+        const status st = dynarr_append(sheet->cells[elements[q]].dependents, &idx);
+        if (st != OK) {
+            return st;
+        }
+    }
+    return OK;
+}
+
+static void unlink_dependents(sheet *sheet, const size_t idx) {
+    const dynamic_array *dependencies = sheet->cells[idx].dependencies;
+    const size_t *elements = dependencies->elements;
+    for (size_t q = 0; q < dependencies->size; q++) {
+        remove_value(sheet->cells[elements[q]].dependents, idx);
+    }
+}
+
+/* Kahn's algorithm: if peeling off cells without unprocessed dependencies
+ * does not reach every cell, the rest form at least one cycle. */
+static status check_acyclic(const sheet *sheet) {
+    size_t *in_degree = malloc(sheet->num_cells * sizeof(size_t));
+    size_t *queue = malloc(sheet->num_cells * sizeof(size_t));
+    if (in_degree == NULL || queue == NULL) {
+        free(in_degree);
+        free(queue);
+        return OUT_OF_MEMORY;
+    }
+    size_t tail = 0;
+    for (size_t q = 0; q < sheet->num_cells; q++) {
+        in_degree[q] = sheet->cells[q].dependencies->size;
+        if (in_degree[q] == 0) {
+            queue[tail++] = q;
+        }
+    }
+    for (size_t head = 0; head < tail; head++) {
+        const dynamic_array *dependents = sheet->cells[queue[head]].dependents;
+        const size_t *elements = dependents->elements;
+        for (size_t q = 0; q < dependents->size; q++) {
+            if (--in_degree[elements[q]] == 0) {
+                queue[tail++] = elements[q];
+            }
+        }
+    }
+    free(in_degree);
+    free(queue);
+    return tail == sheet->num_cells ? OK : CYCLIC_DEPENDENCY;
+}
+
+static status read_lines(FILE *in, dynamic_array *lines) {
+    char *line = nullptr;
+    size_t line_capacity = 0;
+    status st = OK;
+    while (getline(&line, &line_capacity, in) != -1) {
+        if (is_sheet_comment(line)) {
+            continue;
+        }
+        char *copy = strdup(line);
+        if (copy == NULL) {
+            st = OUT_OF_MEMORY;
+            break;
+        }
+        st = dynarr_append(lines, &copy);
+        if (st != OK) {
+            free(copy);
+            break;
+        }
+    }
+    free(line);
+    return st;
+}
+
+static void free_lines(dynamic_array *lines) {
+    for (size_t q = 0; q < lines->size; q++) {
+        char *line;
+        dynarr_copy(lines, q, &line);
+        free(line);
+    }
+    dynarr_free(lines);
+}
+
+/* Names are registered before any formula is compiled, so formulas may
+ * refer to cells defined further down. */
+static status declare_cells(sheet *sheet, dynamic_array *lines, const char **expressions) {
+    for (size_t q = 0; q < lines->size; q++) {
+        const char *line;
+        dynarr_copy(lines, q, &line);
+        char *name;
+        status st = scan_formula(line, &name, &expressions[q]);
+        if (st != OK) {
+            return st;
+        }
+        size_t idx;
+        st = is_reserved_identifier(name) ? RESERVED_NAME : symbols_add_variable(sheet->symbols, name, &idx);
+        free(name);
+        if (st != OK) {
+            return st;
+        }
+    }
+    return OK;
+}
+
+static status define_cells(sheet *sheet, const char **expressions) {
+    for (size_t q = 0; q < sheet->num_cells; q++) {
+        cell *cell = &sheet->cells[q];
+        status st = dynarr_new(sizeof(size_t), 4, &cell->dependents);
+        if (st != OK) {
+            return st;
+        }
+        st = compile_formula(sheet, expressions[q], &cell->tokens, &cell->dependencies);
+        if (st != OK) {
+            return st;
+        }
+    }
+    for (size_t q = 0; q < sheet->num_cells; q++) {
+        const status st = link_dependents(sheet, q);
+        if (st != OK) {
+            return st;
+        }
+    }
+    return check_acyclic(sheet);
+}
+
+status sheet_load(FILE *in, const compile_options *options, const precision precision, sheet **out) {
+    dynamic_array *lines = nullptr;
+    const char **expressions = nullptr;
+    sheet *result = calloc(1, sizeof(sheet));
+    if (result == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    result->options = *options;
+    result->precision = precision;
+    status st = symbols_new(&result->symbols);
+    if (st != OK) {
+        goto end;
+    }
+    st = dynarr_new(sizeof(char *), 64, &lines);
+    if (st != OK) {
+        goto end;
+    }
+    st = read_lines(in, lines);
+    if (st != OK) {
+        goto end;
+    }
+    expressions = calloc(lines->size + 1, sizeof(char *));
+    result->cells = calloc(lines->size + 1, sizeof(cell));
+    result->values = calloc(lines->size + 1, sizeof(double));
+    if (expressions == NULL || result->cells == NULL || result->values == NULL) {
+        st = OUT_OF_MEMORY;
+        goto end;
+    }
+    result->num_cells = lines->size;
+    st = declare_cells(result, lines, expressions);
+    if (st != OK) {
+        goto end;
+    }
+    st = define_cells(result, expressions);
+end:
+    if (lines != NULL) {
+        free_lines(lines);
+    }
+    free(expressions);
+    if (st != OK) {
+        sheet_free(result);
+        return st;
+    }
+    *out = result;
+    return OK;
+}
+
+void sheet_free(sheet *sheet) {
+    if (sheet->cells != NULL) {
+        for (size_t q = 0; q < sheet->num_cells; q++) {
+            cell *cell = &sheet->cells[q];
+            if (cell->tokens != NULL) {
+                dynarr_free(cell->tokens);
+            }
+            if (cell->dependencies != NULL) {
+                dynarr_free(cell->dependencies);
+            }
+            if (cell->dependents != NULL) {
+                dynarr_free(cell->dependents);
+            }
+        }
+    }
+    if (sheet->symbols != NULL) {
+        symbols_free(sheet->symbols);
+    }
+    free(sheet->cells);
+    free(sheet->values);
+    free(sheet);
+}
+
+static void evaluate_cell(work_pool *pool, const size_t item, void *context) {
+    sheet *sheet = context;
+    cell *current = &sheet->cells[item];
+    limits_start();
+    /* each cell has a row of its own, whichever thread evaluates it */
+    random_start(item);
+    long double value;
+    current->status = stack_calculate_at(sheet->precision, current->tokens, sheet->symbols, sheet->values, &value);
+    sheet->values[item] = current->status == OK ? (double) value : NAN;
+    const size_t *dependents = current->dependents->elements;
+    for (size_t q = 0; q < current->dependents->size; q++) {
+        cell *dependent = &sheet->cells[dependents[q]];
+        if (dependent->dirty && atomic_fetch_sub(&dependent->pending, 1) == 1) {
+            pool_push(pool, dependents[q]);
+        }
+    }
+}
+
+/* Evaluates the dirty cells. A cell becomes ready when its last dirty
+ * dependency has been evaluated, so independent cells run in parallel. */
+static status recompute_dirty(sheet *sheet, work_pool *pool, size_t *out_recomputed) {
+    size_t *ready = malloc((sheet->num_cells + 1) * sizeof(size_t));
+    if (ready == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    size_t num_ready = 0;
+    size_t num_dirty = 0;
+    for (size_t q = 0; q < sheet->num_cells; q++) {
+        cell *cell = &sheet->cells[q];
+        if (!cell->dirty) {
+            continue;
+        }
+        num_dirty++;
+        size_t pending = 0;
+        const size_t *dependencies = cell->dependencies->elements;
+        for (size_t k = 0; k < cell->dependencies->size; k++) {
+            pending += sheet->cells[dependencies[k]].dirty;
+        }
+        atomic_store(&cell->pending, pending);
+        if (pending == 0) {
+            ready[num_ready++] = q;
+        }
+    }
+    const status st = pool_run(pool, ready, num_ready, num_dirty, evaluate_cell, sheet);
+    free(ready);
+    *out_recomputed = num_dirty;
+    return st;
+}
+
+status sheet_recompute_all(sheet *sheet, work_pool *pool, size_t *out_recomputed) {
+    for (size_t q = 0; q < sheet->num_cells; q++) {
+        sheet->cells[q].dirty = true;
+    }
+    return recompute_dirty(sheet, pool, out_recomputed);
+}
+
+/* Marks idx and everything downstream of it as dirty, and nothing else. */
+static status mark_downstream(sheet *sheet, const size_t idx) {
+    for (size_t q = 0; q < sheet->num_cells; q++) {
+        sheet->cells[q].dirty = false;
+    }
+    size_t *stack = malloc(sheet->num_cells * sizeof(size_t));
+    if (stack == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    size_t depth = 0;
+    sheet->cells[idx].dirty = true;
+    stack[depth++] = idx;
+    while (depth > 0) {
+        const dynamic_array *dependents = sheet->cells[stack[--depth]].dependents;
+        const size_t *elements = dependents->elements;
+        for (size_t q = 0; q < dependents->size; q++) {
+            if (!sheet->cells[elements[q]].dirty) {
+                sheet->cells[elements[q]].dirty = true;
+                stack[depth++] = elements[q];
+            }
+        }
+    }
+    free(stack);
+    return OK;
+}
+
+status sheet_update(sheet *sheet, const char *line, work_pool *pool, size_t *out_recomputed) {
+    char *name;
+    const char *expression;
+    status st = scan_formula(line, &name, &expression);
+    if (st != OK) {
+        return st;
+    }
+    size_t idx;
+    const bool found = symbols_find_variable(sheet->symbols, name, &idx);
+    free(name);
+    if (!found) {
+        return UNKNOWN_CELL;
+    }
+    dynamic_array *tokens;
+    dynamic_array *dependencies;
+    st = compile_formula(sheet, expression, &tokens, &dependencies);
+    if (st != OK) {
+        return st;
+    }
+    /* the cells downstream of idx do not depend on its formula, so if the
+     * new formula reads any of them, the update would close a cycle */
+    st = mark_downstream(sheet, idx);
+    const size_t *elements = dependencies->elements;
+    for (size_t q = 0; q < dependencies->size && st == OK; q++) {
+        if (sheet->cells[elements[q]].dirty) {
+            st = CYCLIC_DEPENDENCY;
+        }
+    }
+    if (st != OK) {
+        for (size_t q = 0; q < sheet->num_cells; q++) {
+            sheet->cells[q].dirty = false;
+        }
+        dynarr_free(tokens);
+        dynarr_free(dependencies);
+        return st;
+    }
+    cell *cell = &sheet->cells[idx];
+    unlink_dependents(sheet, idx);
+    dynarr_free(cell->tokens);
+    dynarr_free(cell->dependencies);
+    cell->tokens = tokens;
+    cell->dependencies = dependencies;
+    st = link_dependents(sheet, idx);
+    if (st != OK) {
+        return st;
+    }
+    return recompute_dirty(sheet, pool, out_recomputed);
+}
+
+void sheet_print(const sheet *sheet, FILE *out) {
+    for (size_t q = 0; q < sheet->num_cells; q++) {
+        const cell *cell = &sheet->cells[q];
+        if (!cell->dirty) {
+            continue;
+        }
+        const char *name;
+        dynarr_copy(sheet->symbols->variables, q, &name);
+        if (cell->status != OK) {
+            fprintf(out, "%s = error: %s\n", name, status_messages[cell->status]);
+        } else {
+            fprintf(out, "%s = %.*G\n", name, sheet->precision == SINGLE_PRECISION ? FLT_DIG : 15,
+                    sheet->values[q]);
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef CCALC_SHEET_H
+#define CCALC_SHEET_H
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include "dynarr.h"
+#include "parser.h"
+#include "precision.h"
+#include "status.h"
+#include "symbols.h"
+#include "work_pool.h"
+
+/* A named formula. Its value lives in the sheet's values array, at the
+ * index of its VARIABLE token. */
+typedef struct {
+    dynamic_array *tokens;
+    dynamic_array *dependencies; /* size_t, distinct cells the formula reads */
+    dynamic_array *dependents; /* size_t, cells whose formulas read this one */
+    status status;
+    bool dirty;
+    atomic_size_t pending; /* dirty dependencies not yet evaluated */
+} cell;
+
+/* Named formulas, one "name = expression" per line, that may refer to
+ * each other in any order as long as there is no cycle. Cells are
+ * evaluated in the sheet's precision, and kept as doubles. */
+typedef struct {
+    symbol_table *symbols;
+    compile_options options;
+    precision precision;
+    size_t num_cells;
+    cell *cells;
+    double *values;
+} sheet;
+
+status sheet_load(FILE *in, const compile_options *options, precision precision, sheet **out);
+void sheet_free(sheet *sheet);
+/* Evaluates every cell. */
+status sheet_recompute_all(sheet *sheet, work_pool *pool, size_t *out_recomputed);
+/* Replaces one formula, given as "name = expression", and evaluates it
+ * and the cells downstream of it. */
+status sheet_update(sheet *sheet, const char *line, work_pool *pool, size_t *out_recomputed);
+/* Prints the cells evaluated by the last recompute, in definition order. */
+void sheet_print(const sheet *sheet, FILE *out);
+bool is_sheet_comment(const char *line);
+
+#endif
@@ -2,8 +2,29 @@
 #define CCALC_STACK_CALCULATOR_H
 
 #include "dynarr.h"
+#include "precision.h"
 #include "status.h"
+#include "symbols.h"
+#include "tokenizer.h"
 
-status stack_calculate(dynamic_array *tokens, double *out_number);
+/* variables holds the values of VARIABLE tokens, and may be nullptr when
+ * there are none. */
+status stack_calculate(dynamic_array *tokens, const symbol_table *symbols, const double *variables, double *out_number);
+status stack_calculate_float(dynamic_array *tokens, const symbol_table *symbols, const double *variables,
+                             float *out_number);
+status stack_calculate_long_double(dynamic_array *tokens, const symbol_table *symbols, const double *variables,
+                                   long double *out_number);
+/* Evaluates in the given precision, and widens the result. */
+status stack_calculate_at(precision precision, dynamic_array *tokens, const symbol_table *symbols,
+                          const double *variables, long double *out_number);
+/* Evaluates each of the subprograms tokens[starts[q]] to tokens[ends[q]],
+ * inclusive, on its own, writing one result per subprogram to out. */
+status stack_calculate_spans(dynamic_array *tokens, const symbol_table *symbols, const double *variables,
+                             const size_t *starts, const size_t *ends, size_t num_spans, double *out);
+
+/* For streaming RPN: apply one token at a time to a stack of values. */
+status stack_new(dynamic_array **out_stack);
+status stack_apply(dynamic_array *stack, const symbol_table *symbols, const token *token);
+status stack_result(dynamic_array *stack, double *out_number);
 
 #endif
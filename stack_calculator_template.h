@@ -0,0 +1,484 @@
+/* The stack evaluator, instantiated by stack_calculator.c once per
+ * precision. Before including this file, define NUMBER as the value type,
+ * TYPED(name) to name the instance's functions, LITERAL(token) to
+ * convert a VALUE token, and RANDOM_BITS to the bits of rand() that NUMBER
+ * holds exactly. Math functions come from <tgmath.h>, so they follow
+ * NUMBER. No include guard, on purpose. */
+
+static status TYPED(push)(dynamic_array *stack, const NUMBER number) {
+    if (active_limits.max_stack_depth > 0 && stack->size >= active_limits.max_stack_depth) {
+        return STACK_TOO_DEEP;
+    }
+    return dynarr_append(stack, &number);
+}
+
+static status TYPED(pop)(dynamic_array *stack, NUMBER *out_number) {
+    if (stack->size == 0) {
+        return STACK_UNDERFLOW;
+    }
+    dynarr_copy(stack, stack->size - 1, out_number);
+    stack->size--;
+    return OK;
+}
+
+static status TYPED(pop_last)(dynamic_array *stack, NUMBER *out_number) {
+    const status st = TYPED(pop)(stack, out_number);
+    if (st != OK) {
+        return st;
+    }
+    if (stack->size > 0) {
+        return STACK_NOT_EMPTY;
+    }
+    return OK;
+}
+
+static status TYPED(negate)(dynamic_array *stack) {
+    NUMBER operand;
+    const status st = TYPED(pop)(stack, &operand);
+    if (st != OK) {
+        return st;
+    }
+    return TYPED(push)(stack, -operand);
+}
+
+static status TYPED(pop_two)(dynamic_array *stack, NUMBER *out_operand1, NUMBER *out_operand2) {
+    const status st = TYPED(pop)(stack, out_operand2);
+    if (st != OK) {
+        return st;
+    }
+    return TYPED(pop)(stack, out_operand1);
+}
+
+static status TYPED(add)(dynamic_array *stack) {
+    NUMBER operand1, operand2;
+    const status st = TYPED(pop_two)(stack, &operand1, &operand2);
+    if (st != OK) {
+        return st;
+    }
+    return TYPED(push)(stack, operand1 + operand2);
+}
+
+static status TYPED(subtract)(dynamic_array *stack) {
+    NUMBER operand1, operand2;
+    const status st = TYPED(pop_two)(stack, &operand1, &operand2);
+    if (st != OK) {
+        return st;
+    }
+    return TYPED(push)(stack, operand1 - operand2);
+}
+
+static status TYPED(multiply)(dynamic_array *stack) {
+    NUMBER operand1, operand2;
+    const status st = TYPED(pop_two)(stack, &operand1, &operand2);
+    if (st != OK) {
+        return st;
+    }
+    return TYPED(push)(stack, operand1 * operand2);
+}
+
+static status TYPED(divide)(dynamic_array *stack) {
+    NUMBER operand1, operand2;
+    const status st = TYPED(pop_two)(stack, &operand1, &operand2);
+    if (st != OK) {
+        return st;
+    }
+    return TYPED(push)(stack, operand1 / operand2);
+}
+
+static status TYPED(modulus)(dynamic_array *stack) {
+    NUMBER operand1, operand2;
+    const status st = TYPED(pop_two)(stack, &operand1, &operand2);
+    if (st != OK) {
+        return st;
+    }
+    return TYPED(push)(stack, fmod(operand1, operand2));
+}
+
+static status TYPED(exponentiate)(dynamic_array *stack) {
+    NUMBER operand1, operand2;
+    const status st = TYPED(pop_two)(stack, &operand1, &operand2);
+    if (st != OK) {
+        return st;
+    }
+    return TYPED(push)(stack, TYPED(power)(operand1, operand2));
+}
+
+static status TYPED(raise_to_integer)(dynamic_array *stack, const long exponent) {
+    NUMBER operand;
+    const status st = TYPED(pop)(stack, &operand);
+    if (st != OK) {
+        return st;
+    }
+    return TYPED(push)(stack, TYPED(integer_power)(operand, exponent));
+}
+
+static status TYPED(compare)(dynamic_array *stack, const operator_token ot) {
+    NUMBER operand1, operand2;
+    const status st = TYPED(pop_two)(stack, &operand1, &operand2);
+    if (st != OK) {
+        return st;
+    }
+    bool result;
+    switch (ot) {
+        case LESS:
+            result = operand1 < operand2;
+            break;
+        case LESS_OR_EQUAL:
+            result = operand1 <= operand2;
+            break;
+        case GREATER:
+            result = operand1 > operand2;
+            break;
+        case GREATER_OR_EQUAL:
+            result = operand1 >= operand2;
+            break;
+        case EQUAL:
+            result = operand1 == operand2;
+            break;
+        case NOT_EQUAL:
+            result = operand1 != operand2;
+            break;
+        case AND:
+            result = operand1 != 0.0 && operand2 != 0.0;
+            break;
+        case OR:
+            result = operand1 != 0.0 || operand2 != 0.0;
+            break;
+        default:
+            return UNHANDLED_OPERATOR;
+    }
+    return TYPED(push)(stack, result ? 1.0 : 0.0);
+}
+
+/* Eager selection, for RPN input. Infix if() is lowered to jumps by the parser. */
+static status TYPED(choose)(dynamic_array *stack) {
+    NUMBER when_false;
+    status st = TYPED(pop)(stack, &when_false);
+    if (st != OK) {
+        return st;
+    }
+    NUMBER when_true, condition;
+    st = TYPED(pop_two)(stack, &condition, &when_true);
+    if (st != OK) {
+        return st;
+    }
+    return TYPED(push)(stack, condition != 0.0 ? when_true : when_false);
+}
+
+static status TYPED(fused_multiply_add)(dynamic_array *stack) {
+    NUMBER addend;
+    status st = TYPED(pop)(stack, &addend);
+    if (st != OK) {
+        return st;
+    }
+    NUMBER x, y;
+    st = TYPED(pop_two)(stack, &x, &y);
+    if (st != OK) {
+        return st;
+    }
+    return TYPED(push)(stack, fma(x, y, addend));
+}
+
+static status TYPED(draw_integer)(dynamic_array *stack) {
+    NUMBER low, high;
+    const status st = TYPED(pop_two)(stack, &low, &high);
+    if (st != OK) {
+        return st;
+    }
+    return TYPED(push)(stack, (NUMBER) random_integer((double) low, (double) high, random_row, random_draw++));
+}
+
+/* Memo tables hold doubles. Arguments and results that do not convert
+ * exactly are neither looked up nor stored, so a hit is always exact. */
+static bool TYPED(memo_get)(const user_function *function, const NUMBER *args, NUMBER *out_result) {
+    double keys[function->num_params + 1];
+    for (size_t q = 0; q < function->num_params; q++) {
+        keys[q] = (double) args[q];
+        if ((NUMBER) keys[q] != args[q]) {
+            return false;
+        }
+    }
+    double result;
+    if (!memo_lookup(function->memo, keys, &result)) {
+        return false;
+    }
+    *out_result = (NUMBER) result;
+    return true;
+}
+
+static void TYPED(memo_put)(const user_function *function, const NUMBER *args, const NUMBER result) {
+    double keys[function->num_params + 1];
+    for (size_t q = 0; q < function->num_params; q++) {
+        keys[q] = (double) args[q];
+        if ((NUMBER) keys[q] != args[q]) {
+            return;
+        }
+    }
+    if ((NUMBER) (double) result != result && !isnan(result)) {
+        return;
+    }
+    memo_store(function->memo, keys, (double) result);
+}
+
+/* Arguments stay on the value stack, with base indexing the first one.
+ * A memoized call that hits the cache never enters the function body. */
+static status TYPED(call)(dynamic_array *stack, dynamic_array *frames, const user_function *function,
+                   dynamic_array **tokens, size_t *idx, size_t *base) {
+    if (stack->size < function->num_params) {
+        return STACK_UNDERFLOW;
+    }
+    const size_t args_base = stack->size - function->num_params;
+    NUMBER result;
+    if (function->memo != NULL && TYPED(memo_get)(function, (NUMBER *) stack->elements + args_base, &result)) {
+        stack->size = args_base;
+        return TYPED(push)(stack, result);
+    }
+    if (frames->size >= MAX_CALL_DEPTH) {
+        return CALL_DEPTH_EXCEEDED;
+    }
+    call_frame frame;
+    frame.return_tokens = *tokens;
+    frame.return_idx = *idx;
+    frame.return_base = *base;
+    frame.function = function;
+    const status st = dynarr_append(frames, &frame);
+    if (st != OK) {
+        return st;
+    }
+    *tokens = function->body;
+    *idx = 0;
+    *base = args_base;
+    return OK;
+}
+
+static status TYPED(return_from_call)(dynamic_array *stack, dynamic_array *frames,
+                               dynamic_array **tokens, size_t *idx, size_t *base) {
+    call_frame frame;
+    dynarr_copy(frames, frames->size - 1, &frame);
+    frames->size--;
+    NUMBER result;
+    const status st = TYPED(pop)(stack, &result);
+    if (st != OK) {
+        return st;
+    }
+    if (stack->size != *base + frame.function->num_params) {
+        return STACK_NOT_EMPTY;
+    }
+    if (frame.function->memo != NULL) {
+        TYPED(memo_put)(frame.function, (NUMBER *) stack->elements + *base, result);
+    }
+    stack->size = *base;
+    *tokens = frame.return_tokens;
+    *idx = frame.return_idx;
+    *base = frame.return_base;
+    return TYPED(push)(stack, result);
+}
+
+/* Runs tokens on top of whatever is already on the stack. */
+static status TYPED(run)(dynamic_array *stack, dynamic_array *tokens, const symbol_table *symbols, const double *variables) {
+    status st = OK;
+    dynamic_array *frames = nullptr; /* allocated on the first call */
+    size_t q = 0;
+    size_t base = 0;
+    while (st == OK && (q < tokens->size || frames != NULL && frames->size > 0)) {
+        if (q >= tokens->size) {
+            st = TYPED(return_from_call)(stack, frames, &tokens, &q, &base);
+            continue;
+        }
+        st = limits_step(1);
+        if (st != OK) {
+            break;
+        }
+        token token;
+        dynarr_copy(tokens, q++, &token);
+        if (token.type == VALUE) {
+            st = TYPED(push)(stack, LITERAL(token));
+        } else if (token.type == OPERATOR) {
+            switch (token.operator) {
+                case ADDITION:
+                    st = TYPED(add)(stack);
+                    break;
+                case SUBTRACTION:
+                    st = TYPED(subtract)(stack);
+                    break;
+                case MULTIPLICATION:
+                    st = TYPED(multiply)(stack);
+                    break;
+                case DIVISION:
+                    st = TYPED(divide)(stack);
+                    break;
+                case MODULUS:
+                    st = TYPED(modulus)(stack);
+                    break;
+                case NEGATION:
+                    st = TYPED(negate)(stack);
+                    break;
+                case EXPONENTIATION:
+                    st = TYPED(exponentiate)(stack);
+                    break;
+                case LESS:
+                case LESS_OR_EQUAL:
+                case GREATER:
+                case GREATER_OR_EQUAL:
+                case EQUAL:
+                case NOT_EQUAL:
+                case AND:
+                case OR:
+                    st = TYPED(compare)(stack, token.operator);
+                    break;
+                default:
+                    st = UNHANDLED_OPERATOR;
+            }
+        } else if (token.type == FUNCTION && token.function == IF) {
+            st = TYPED(choose)(stack);
+        } else if (token.type == FUNCTION && token.function == FMA) {
+            st = TYPED(fused_multiply_add)(stack);
+        } else if (token.type == FUNCTION && token.function == DOT) {
+            st = TYPED(multiply)(stack);
+        } else if (token.type == FUNCTION && token.function == RAND) {
+            st = TYPED(push)(stack, (NUMBER) random_uniform(random_row, random_draw++, RANDOM_BITS));
+        } else if (token.type == FUNCTION && token.function == RANDN) {
+            st = TYPED(push)(stack, (NUMBER) random_normal(random_row, random_draw++));
+        } else if (token.type == FUNCTION && token.function == RANDINT) {
+            st = TYPED(draw_integer)(stack);
+        } else if (token.type == FUNCTION) {
+            NUMBER n;
+            st = TYPED(pop)(stack, &n);
+            if (st == OK) {
+                switch (token.function) {
+                    case ABS:
+                        st = TYPED(push)(stack, fabs(n));
+                        break;
+                    case ACOS:
+                        st = TYPED(push)(stack, acos(n));
+                        break;
+                    case ASIN:
+                        st = TYPED(push)(stack, asin(n));
+                        break;
+                    case ATAN:
+                        st = TYPED(push)(stack, atan(n));
+                        break;
+                    case COS:
+                        st = TYPED(push)(stack, cos(n));
+                        break;
+                    case COSH:
+                        st = TYPED(push)(stack, cosh(n));
+                        break;
+                    case EXP:
+                        st = TYPED(push)(stack, exp(n));
+                        break;
+                    case LN:
+                        st = TYPED(push)(stack, log(n));
+                        break;
+                    case LOG:
+                        st = TYPED(push)(stack, log10(n));
+                        break;
+                    case ROUND:
+                        st = TYPED(push)(stack, round(n));
+                        break;
+                    case SIN:
+                        st = TYPED(push)(stack, sin(n));
+                        break;
+                    case SINH:
+                        st = TYPED(push)(stack, sinh(n));
+                        break;
+                    case SQRT:
+                        st = TYPED(push)(stack, sqrt(n));
+                        break;
+                    case TAN:
+                        st = TYPED(push)(stack, tan(n));
+                        break;
+                    case TANH:
+                        st = TYPED(push)(stack, tanh(n));
+                        break;
+                    case TRUNC:
+                        st = TYPED(push)(stack, trunc(n));
+                        break;
+                    case NEG:
+                        st = TYPED(push)(stack, -n);
+                        break;
+                    case NORM:
+                        st = TYPED(push)(stack, fabs(n));
+                        break;
+                    case SUM:
+                        st = TYPED(push)(stack, n);
+                        break;
+                    case FAST_SIN:
+                        st = TYPED(push)(stack, (NUMBER) fast_sin((double) n));
+                        break;
+                    case FAST_COS:
+                        st = TYPED(push)(stack, (NUMBER) fast_cos((double) n));
+                        break;
+                    case FAST_EXP:
+                        st = TYPED(push)(stack, (NUMBER) fast_exp((double) n));
+                        break;
+                    case FAST_LN:
+                        st = TYPED(push)(stack, (NUMBER) fast_ln((double) n));
+                        break;
+                    case FAST_TANH:
+                        st = TYPED(push)(stack, (NUMBER) fast_tanh((double) n));
+                        break;
+                    default:
+                        st = UNHANDLED_FUNCTION;
+                }
+            }
+        } else if (token.type == CONSTANT) {
+            switch (token.constant) {
+                case E:
+                    st = TYPED(push)(stack, (NUMBER) E_LONG_DOUBLE);
+                    break;
+                case PI:
+                    st = TYPED(push)(stack, (NUMBER) PI_LONG_DOUBLE);
+                    break;
+                default:
+                    st = UNKNOWN_CONSTANT;
+            }
+        } else if (token.type == JUMP) {
+            q = token.target;
+        } else if (token.type == JUMP_IF_FALSE || token.type == JUMP_IF_TRUE) {
+            NUMBER condition;
+            st = TYPED(pop)(stack, &condition);
+            if (st == OK && (condition != 0.0) == (token.type == JUMP_IF_TRUE)) {
+                q = token.target;
+            }
+        } else if (token.type == ARGUMENT) {
+            NUMBER argument;
+            dynarr_copy(stack, base + token.argument, &argument);
+            st = TYPED(push)(stack, argument);
+        } else if (token.type == INTEGER_POWER) {
+            st = TYPED(raise_to_integer)(stack, token.exponent);
+        } else if (token.type == VARIABLE) {
+            st = TYPED(push)(stack, (NUMBER) variables[token.variable]);
+        } else if (token.type == VECTOR) {
+            st = UNEXPECTED_VECTOR;
+        } else if (token.type == CALL) {
+            if (frames == NULL) {
+                st = dynarr_new(sizeof(call_frame), 16, &frames);
+                if (st != OK) {
+                    break;
+                }
+            }
+            st = TYPED(call)(stack, frames, symbols_function(symbols, token.user_function), &tokens, &q, &base);
+        } else {
+            st = UNHANDLED_TOKEN_TYPE;
+        }
+    }
+    if (frames != NULL) {
+        dynarr_free(frames);
+    }
+    return st;
+}
+
+status TYPED(stack_calculate)(dynamic_array *tokens, const symbol_table *symbols, const double *variables, NUMBER *out_number) {
+    dynamic_array *stack;
+    status st = dynarr_new(sizeof(NUMBER), INITIAL_STACK_CAPACITY, &stack);
+    if (st != OK) {
+        return st;
+    }
+    st = TYPED(run)(stack, tokens, symbols, variables);
+    if (st == OK) {
+        st = TYPED(pop_last)(stack, out_number);
+    }
+    dynarr_free(stack);
+    return st;
+}
@@ -18,4 +18,31 @@ const char *status_messages[] = {
     "unexpected operator",
     "missing ( after function name",
     "missing function argument after comma",
+    "wrong number of function arguments",
+    "function calls nested too deeply",
+    "invalid function definition",
+    "function already defined",
+    "input/output error",
+    "not a compiled program, or compiled by another version",
+    "compiled program is corrupt (checksum mismatch)",
+    "invalid program",
+    "missing argument for option",
+    "name already defined",
+    "input columns differ in length",
+    "invalid option argument",
+    "input column is not a whole number of doubles",
+    "token too long for streaming input",
+    "input too large",
+    "too many tokens",
+    "expression nested too deeply",
+    "stack too deep",
+    "evaluation step limit exceeded",
+    "evaluation deadline exceeded",
+    "invalid formula, expected name = expression",
+    "formulas depend on each other in a cycle",
+    "no such cell",
+    "unmatched bracket",
+    "vectors differ in length",
+    "vector where a number is expected",
+    "name is reserved for a built-in function or constant",
 };
@@ -1,6 +1,8 @@
 #ifndef CCALC_STATUS_H
 #define CCALC_STATUS_H
 
+#include <stddef.h>
+
 typedef enum {
     OK,
     OUT_OF_MEMORY,
@@ -19,8 +21,42 @@ typedef enum {
     UNEXPECTED_OPERATOR,
     MISSING_LEFT_PARENTHESIS,
     MISSING_FUNCTION_ARGUMENT,
+    WRONG_NUMBER_OF_ARGUMENTS,
+    CALL_DEPTH_EXCEEDED,
+    INVALID_DEFINITION,
+    FUNCTION_ALREADY_DEFINED,
+    IO_ERROR,
+    INVALID_PROGRAM_FILE,
+    CHECKSUM_MISMATCH,
+    INVALID_PROGRAM,
+    MISSING_OPTION_ARGUMENT,
+    NAME_ALREADY_DEFINED,
+    COLUMN_LENGTH_MISMATCH,
+    INVALID_OPTION_ARGUMENT,
+    INVALID_COLUMN_DATA,
+    TOKEN_TOO_LONG,
+    INPUT_TOO_LARGE,
+    TOO_MANY_TOKENS,
+    NESTING_TOO_DEEP,
+    STACK_TOO_DEEP,
+    STEP_LIMIT_EXCEEDED,
+    DEADLINE_EXCEEDED,
+    INVALID_FORMULA,
+    CYCLIC_DEPENDENCY,
+    UNKNOWN_CELL,
+    UNMATCHED_BRACKET,
+    VECTOR_LENGTH_MISMATCH,
+    UNEXPECTED_VECTOR,
+    RESERVED_NAME,
 } status;
 
+/* Where in its source an error was found: length bytes from offset. A
+ * length of 0 means no position is known, as for errors in evaluation. */
+typedef struct {
+    size_t offset;
+    size_t length;
+} source_span;
+
 extern const char *status_messages[];
 
 #endif
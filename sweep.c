@@ -0,0 +1,219 @@
+#include "sweep.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block_calculator.h"
+#include "random.h"
+#include "resource_limits.h"
+#include "tokenizer.h"
+
+/* Rows per work item. Each window hands every worker two items. */
+#define SWEEP_CHUNK 16384
+
+typedef struct {
+    precision precision;
+    dynamic_array *tokens;
+    const symbol_table *symbols;
+    const sweep_range *ranges;
+    size_t num_ranges;
+    size_t first_row;
+    size_t num_rows;
+    double *inputs; /* per item, one SWEEP_CHUNK column per range */
+    double *results;
+    status *statuses;
+    aggregates **partials; /* per item, when aggregating */
+} sweep_window;
+
+static status parse_number(const char *s, const char **end, double *out) {
+    char *number_end;
+    *out = strtod(s, &number_end);
+    if (number_end == s || !isfinite(*out)) {
+        return INVALID_OPTION_ARGUMENT;
+    }
+    *end = number_end;
+    return OK;
+}
+
+static status parse_range(const char *s, sweep_range *out) {
+    double start, stop, step;
+    status st = parse_number(s, &s, &start);
+    if (st != OK || *s != ':') {
+        return INVALID_OPTION_ARGUMENT;
+    }
+    st = parse_number(s + 1, &s, &stop);
+    if (st != OK || *s != ':') {
+        return INVALID_OPTION_ARGUMENT;
+    }
+    st = parse_number(s + 1, &s, &step);
+    if (st != OK || *s != '\0') {
+        return INVALID_OPTION_ARGUMENT;
+    }
+    const double span = (stop - start) / step;
+    if (step == 0 || !(span >= 0) || span >= (double) SIZE_MAX) {
+        return INVALID_OPTION_ARGUMENT;
+    }
+    out->start = start;
+    out->step = step;
+    /* tolerate the rounding in e.g. 0:1:0.1, which must include 1 */
+    out->count = (size_t) floor(span + 1e-9) + 1;
+    return OK;
+}
+
+status sweep_parse(const char *spec, symbol_table *symbols, sweep_range *out) {
+    const char *eq = strchr(spec, '=');
+    if (eq == NULL || eq == spec) {
+        return INVALID_OPTION_ARGUMENT;
+    }
+    status st = parse_range(eq + 1, out);
+    if (st != OK) {
+        return st;
+    }
+    char *name = strndup(spec, eq - spec);
+    if (name == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    size_t idx;
+    st = is_reserved_identifier(name) ? RESERVED_NAME : symbols_add_variable(symbols, name, &idx);
+    free(name);
+    return st;
+}
+
+/* Values are computed as start + i * step rather than accumulated, so
+ * rounding errors do not build up over long ranges. */
+static void fill_inputs(const sweep_range *ranges, const size_t num_ranges,
+                        const size_t first_row, const size_t count, double *inputs) {
+    size_t digits[num_ranges];
+    size_t row = first_row;
+    for (size_t k = num_ranges; k-- > 0;) {
+        digits[k] = row % ranges[k].count;
+        row /= ranges[k].count;
+    }
+    if (num_ranges == 1) {
+        for (size_t q = 0; q < count; q++) {
+            inputs[q] = ranges[0].start + (double) (digits[0] + q) * ranges[0].step;
+        }
+        return;
+    }
+    for (size_t q = 0; q < count; q++) {
+        for (size_t k = 0; k < num_ranges; k++) {
+            inputs[k * SWEEP_CHUNK + q] = ranges[k].start + (double) digits[k] * ranges[k].step;
+        }
+        for (size_t k = num_ranges; k-- > 0;) {
+            if (++digits[k] < ranges[k].count) {
+                break;
+            }
+            digits[k] = 0;
+        }
+    }
+}
+
+static void evaluate_chunk(work_pool *pool, const size_t item, void *context) {
+    (void) pool;
+    sweep_window *window = context;
+    const size_t offset = item * SWEEP_CHUNK;
+    const size_t count = window->num_rows - offset < SWEEP_CHUNK ? window->num_rows - offset : SWEEP_CHUNK;
+    double *inputs = window->inputs + item * window->num_ranges * SWEEP_CHUNK;
+    fill_inputs(window->ranges, window->num_ranges, window->first_row + offset, count, inputs);
+    const double *columns[window->num_ranges];
+    for (size_t k = 0; k < window->num_ranges; k++) {
+        columns[k] = inputs + k * SWEEP_CHUNK;
+    }
+    limits_start_rows(count);
+    random_start(window->first_row + offset);
+    status st = block_calculate(window->precision, window->tokens, window->symbols, columns, window->num_ranges, count,
+                                window->results + offset);
+    if (st == OK && window->partials != NULL) {
+        aggregates_reset(window->partials[item]);
+        st = aggregates_add(window->partials[item], window->results + offset, count);
+    }
+    window->statuses[item] = st;
+}
+
+static status new_partials(const aggregates *like, const size_t num_slots, aggregates ***out) {
+    aggregates **partials = calloc(num_slots, sizeof(aggregates *));
+    if (partials == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    *out = partials;
+    for (size_t q = 0; q < num_slots; q++) {
+        const status st = aggregates_new(aggregates_has_quantiles(like), &partials[q]);
+        if (st != OK) {
+            return st;
+        }
+    }
+    return OK;
+}
+
+/* The grid is evaluated one window of chunks at a time, spread over the
+ * pool, and each window is written out before the next one starts. Each
+ * chunk is aggregated by the worker that evaluated it, and the partial
+ * aggregates are merged in row order, so that the result does not depend
+ * on the number of threads. */
+status sweep_run(const precision precision, dynamic_array *tokens, const symbol_table *symbols,
+                 const sweep_range *ranges, const size_t num_ranges, work_pool *pool, aggregates *aggregate,
+                 const result_writer write, void *write_context) {
+    size_t total = 1;
+    for (size_t k = 0; k < num_ranges; k++) {
+        if (ranges[k].count > SIZE_MAX / SWEEP_CHUNK / total) {
+            return INPUT_TOO_LARGE;
+        }
+        total *= ranges[k].count;
+    }
+    const size_t num_slots = 2 * pool_num_threads(pool);
+    sweep_window window = {
+        .precision = precision,
+        .tokens = tokens,
+        .symbols = symbols,
+        .ranges = ranges,
+        .num_ranges = num_ranges,
+        .inputs = malloc(num_slots * num_ranges * SWEEP_CHUNK * sizeof(double)),
+        .results = malloc(num_slots * SWEEP_CHUNK * sizeof(double)),
+        .statuses = malloc(num_slots * sizeof(status)),
+        .partials = nullptr,
+    };
+    size_t *items = malloc(num_slots * sizeof(size_t));
+    status st = OK;
+    if (window.inputs == NULL || window.results == NULL || window.statuses == NULL || items == NULL) {
+        st = OUT_OF_MEMORY;
+        goto end;
+    }
+    if (aggregate != NULL) {
+        st = new_partials(aggregate, num_slots, &window.partials);
+        if (st != OK) {
+            goto end;
+        }
+    }
+    for (size_t q = 0; q < num_slots; q++) {
+        items[q] = q;
+    }
+    for (size_t first_row = 0; first_row < total && st == OK; first_row += num_slots * SWEEP_CHUNK) {
+        window.first_row = first_row;
+        window.num_rows = total - first_row < num_slots * SWEEP_CHUNK ? total - first_row : num_slots * SWEEP_CHUNK;
+        const size_t num_items = (window.num_rows + SWEEP_CHUNK - 1) / SWEEP_CHUNK;
+        st = pool_run(pool, items, num_items, num_items, evaluate_chunk, &window);
+        for (size_t q = 0; q < num_items && st == OK; q++) {
+            st = window.statuses[q];
+        }
+        for (size_t q = 0; q < num_items && st == OK && aggregate != NULL; q++) {
+            st = aggregates_merge(aggregate, window.partials[q]);
+        }
+        if (st == OK && write != NULL) {
+            st = write(window.results, window.num_rows, write_context);
+        }
+    }
+end:
+    if (window.partials != NULL) {
+        for (size_t q = 0; q < num_slots; q++) {
+            aggregates_free(window.partials[q]);
+        }
+        free(window.partials);
+    }
+    free(window.inputs);
+    free(window.results);
+    free(window.statuses);
+    free(items);
+    return st;
+}
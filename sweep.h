@@ -0,0 +1,31 @@
+#ifndef CCALC_SWEEP_H
+#define CCALC_SWEEP_H
+
+#include <stddef.h>
+#include "aggregate.h"
+#include "dynarr.h"
+#include "precision.h"
+#include "status.h"
+#include "symbols.h"
+#include "work_pool.h"
+
+/* count values start, start + step, ... up to and including stop. */
+typedef struct {
+    double start;
+    double step;
+    size_t count;
+} sweep_range;
+
+/* Receives the results of consecutive rows, in order. */
+typedef status (*result_writer)(double *results, size_t count, void *context);
+
+/* Parses NAME=START:STOP:STEP, and binds NAME as the next variable. */
+status sweep_parse(const char *spec, symbol_table *symbols, sweep_range *out);
+/* Evaluates tokens over the grid spanned by the ranges, with the last
+ * range varying fastest, and VARIABLE k taking values from ranges[k].
+ * Results are added to aggregate, unless it is NULL, and written unless
+ * write is NULL. */
+status sweep_run(precision precision, dynamic_array *tokens, const symbol_table *symbols, const sweep_range *ranges,
+                 size_t num_ranges, work_pool *pool, aggregates *aggregate, result_writer write, void *write_context);
+
+#endif
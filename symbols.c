@@ -0,0 +1,164 @@
+#include "symbols.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define INITIAL_VARIABLE_SLOTS 16
+
+status symbols_new(symbol_table **out) {
+    *out = malloc(sizeof(symbol_table));
+    if (*out == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    status st = dynarr_new(sizeof(user_function), 10, &(*out)->functions);
+    if (st != OK) {
+        free(*out);
+        *out = nullptr;
+        return st;
+    }
+    st = dynarr_new(sizeof(char *), 10, &(*out)->variables);
+    if (st != OK) {
+        dynarr_free((*out)->functions);
+        free(*out);
+        *out = nullptr;
+        return st;
+    }
+    (*out)->parameters = nullptr;
+    (*out)->variable_slots = nullptr;
+    (*out)->num_variable_slots = 0;
+    return OK;
+}
+
+void symbols_free(symbol_table *symbols) {
+    for (size_t q = 0; q < symbols->functions->size; q++) {
+        user_function function;
+        dynarr_copy(symbols->functions, q, &function);
+        free(function.name);
+        if (function.body != NULL) {
+            dynarr_free(function.body);
+        }
+        if (function.memo != NULL) {
+            memo_free(function.memo);
+        }
+    }
+    dynarr_free(symbols->functions);
+    for (size_t q = 0; q < symbols->variables->size; q++) {
+        char *name;
+        dynarr_copy(symbols->variables, q, &name);
+        free(name);
+    }
+    dynarr_free(symbols->variables);
+    free(symbols->variable_slots);
+    free(symbols);
+}
+
+bool symbols_find_function(const symbol_table *symbols, const char *name, size_t *out_idx) {
+    for (size_t q = 0; q < symbols->functions->size; q++) {
+        if (strcasecmp(symbols_function(symbols, q)->name, name) == 0) {
+            *out_idx = q;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Case-insensitive, like every name lookup. */
+static size_t hash_name(const char *name) {
+    size_t hash = 14695981039346656037u;
+    for (; *name != '\0'; name++) {
+        hash = (hash ^ (unsigned char) tolower((unsigned char) *name)) * 1099511628211u;
+    }
+    return hash;
+}
+
+static const char *variable_name(const symbol_table *symbols, const size_t idx) {
+    return ((const char **) symbols->variables->elements)[idx];
+}
+
+static void insert_variable_slot(symbol_table *symbols, const size_t idx) {
+    const size_t mask = symbols->num_variable_slots - 1;
+    size_t slot = hash_name(variable_name(symbols, idx)) & mask;
+    while (symbols->variable_slots[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    symbols->variable_slots[slot] = idx + 1;
+}
+
+/* Keeps the index at most half full. */
+static status grow_variable_slots(symbol_table *symbols) {
+    const size_t num_slots = symbols->num_variable_slots == 0
+                                 ? INITIAL_VARIABLE_SLOTS
+                                 : symbols->num_variable_slots * 2;
+    size_t *slots = calloc(num_slots, sizeof(size_t));
+    if (slots == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    free(symbols->variable_slots);
+    symbols->variable_slots = slots;
+    symbols->num_variable_slots = num_slots;
+    for (size_t q = 0; q < symbols->variables->size; q++) {
+        insert_variable_slot(symbols, q);
+    }
+    return OK;
+}
+
+status symbols_add_variable(symbol_table *symbols, const char *name, size_t *out_idx) {
+    size_t idx;
+    if (symbols_find_variable(symbols, name, &idx) || symbols_find_function(symbols, name, &idx)) {
+        return NAME_ALREADY_DEFINED;
+    }
+    if (2 * (symbols->variables->size + 1) > symbols->num_variable_slots) {
+        const status st = grow_variable_slots(symbols);
+        if (st != OK) {
+            return st;
+        }
+    }
+    char *copy = strdup(name);
+    if (copy == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    const status st = dynarr_append(symbols->variables, &copy);
+    if (st != OK) {
+        free(copy);
+        return st;
+    }
+    *out_idx = symbols->variables->size - 1;
+    insert_variable_slot(symbols, *out_idx);
+    return OK;
+}
+
+bool symbols_find_variable(const symbol_table *symbols, const char *name, size_t *out_idx) {
+    if (symbols->num_variable_slots == 0) {
+        return false;
+    }
+    const size_t mask = symbols->num_variable_slots - 1;
+    for (size_t slot = hash_name(name) & mask; symbols->variable_slots[slot] != 0; slot = (slot + 1) & mask) {
+        const size_t idx = symbols->variable_slots[slot] - 1;
+        if (strcasecmp(variable_name(symbols, idx), name) == 0) {
+            *out_idx = idx;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool symbols_find_parameter(const symbol_table *symbols, const char *name, size_t *out_idx) {
+    if (symbols->parameters == NULL) {
+        return false;
+    }
+    for (size_t q = 0; q < symbols->parameters->size; q++) {
+        const char *parameter;
+        dynarr_copy((dynamic_array *) symbols->parameters, q, &parameter);
+        if (strcasecmp(parameter, name) == 0) {
+            *out_idx = q;
+            return true;
+        }
+    }
+    return false;
+}
+
+const user_function *symbols_function(const symbol_table *symbols, const size_t idx) {
+    return (const user_function *) symbols->functions->elements + idx;
+}
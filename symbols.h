@@ -0,0 +1,33 @@
+#ifndef CCALC_SYMBOLS_H
+#define CCALC_SYMBOLS_H
+
+#include "dynarr.h"
+#include "memo.h"
+#include "status.h"
+
+typedef struct {
+    char *name;
+    size_t num_params;
+    dynamic_array *body; /* postfix tokens, parameters as ARGUMENT tokens */
+    memo_table *memo; /* nullptr unless defined with the memo attribute */
+} user_function;
+
+typedef struct {
+    dynamic_array *functions; /* user_function */
+    dynamic_array *variables; /* char *, names of the VARIABLE token indices */
+    /* open-addressing index into variables, holding idx + 1, 0 when empty */
+    size_t *variable_slots;
+    size_t num_variable_slots; /* a power of two */
+    /* names of the parameters of the function being defined, or nullptr */
+    const dynamic_array *parameters;
+} symbol_table;
+
+status symbols_new(symbol_table **out);
+void symbols_free(symbol_table *symbols);
+bool symbols_find_function(const symbol_table *symbols, const char *name, size_t *out_idx);
+status symbols_add_variable(symbol_table *symbols, const char *name, size_t *out_idx);
+bool symbols_find_variable(const symbol_table *symbols, const char *name, size_t *out_idx);
+bool symbols_find_parameter(const symbol_table *symbols, const char *name, size_t *out_idx);
+const user_function *symbols_function(const symbol_table *symbols, size_t idx);
+
+#endif
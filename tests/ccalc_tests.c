@@ -0,0 +1,850 @@
+#define _POSIX_C_SOURCE 200809L
+
+/* In-process tests. Runs the expression cases of regression-test.sh
+ * without forking, then generates random expression trees and checks
+ * every way of evaluating them against the reference: the fully
+ * parenthesized infix form, evaluated by stack_calculate() one row at a
+ * time. Both run at every precision. Failures print the case number,
+ * which --first reproduces. */
+
+#include <ctype.h>
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "block_calculator.h"
+#include "parallel_calculator.h"
+#include "parser.h"
+#include "program.h"
+#include "random.h"
+#include "rpn_stream.h"
+#include "stack_calculator.h"
+#include "status.h"
+#include "symbols.h"
+#include "vector_calculator.h"
+#include "work_pool.h"
+
+/* Values of x and y that each generated expression is evaluated at. */
+#define NUM_ROWS 8
+#define NUM_VARIABLES 2
+#define MAX_DEPTH 6
+#define MAX_NODES 512
+/* A big expression for parallel_calculate(), and a trip through a
+ * program file, once every this many cases. */
+#define PARALLEL_EVERY 4096
+#define PROGRAM_FILE_EVERY 256
+#define PARALLEL_THREADS 4
+#define MAX_REPORTED_FAILURES 10
+
+static const double row_x[NUM_ROWS] = {0, 1, -1, 0.5, 2.75, -3.25, 1e10, NAN};
+static const double row_y[NUM_ROWS] = {3, -0.0, 0.1, INFINITY, 1, -2, 7, 0.25};
+/* For polynomials, where the optimizer must stay within rounding. */
+static const double polynomial_x[NUM_ROWS] = {0, 1, -1, 0.5, 1.75, -1.25, 2, -2};
+
+typedef enum {
+    NUMBER_NODE,
+    NAMED_NODE, /* constant or variable */
+    RANDOM_NODE,
+    NEGATION_NODE,
+    FUNCTION_NODE,
+    OPERATOR_NODE,
+} node_kind;
+
+typedef struct {
+    node_kind kind;
+    const char *name; /* as written: constant, variable, function or operator */
+    int precedence; /* of operators */
+    double value; /* of numbers */
+    int num_children;
+    int children[3];
+} node;
+
+typedef struct {
+    node nodes[MAX_NODES];
+    int size;
+    bool has_jumps; /* if, and, or, which infix evaluates lazily */
+    bool has_random;
+    bool has_variables;
+    bool has_reductions; /* dot, norm, sum, which reduce vectors */
+} tree;
+
+typedef struct {
+    const char *name;
+    int arity;
+} function_spec;
+
+typedef struct {
+    const char *name;
+    int precedence;
+} operator_spec;
+
+static const double numbers[] = {0, 1, 2, 3, 5, 7, 10, 0.5, 0.1, 2.5, 1000, 1e60, 1e-30};
+static const char *const constants[] = {"pi", "e"};
+static const char *const variables[] = {"x", "y"};
+static const function_spec functions[] = {
+    {"abs", 1}, {"sqrt", 1}, {"sin", 1}, {"cos", 1}, {"atan", 1}, {"exp", 1}, {"ln", 1},
+    {"round", 1}, {"trunc", 1}, {"tanh", 1}, {"neg", 1}, {"norm", 1}, {"sum", 1}, {"dot", 2},
+    {"fma", 3}, {"if", 3}, {"randint", 2},
+};
+/* Lowest binding first. ^ is right-associative, and binds less tightly
+ * than unary minus, so -a^b is (-a)^b. */
+static const operator_spec operators[] = {
+    {"or", 1}, {"and", 2}, {"<", 3}, {"<=", 3}, {">", 3}, {">=", 3}, {"==", 3}, {"!=", 3},
+    {"+", 4}, {"-", 4}, {"*", 5}, {"/", 5}, {"%", 5}, {"^", 6},
+};
+#define POWER_PRECEDENCE 6
+#define UNARY_PRECEDENCE 7
+#define PRIMARY_PRECEDENCE 8
+
+/* Random choices for generating case index come from the counter
+ * (index, draw), so that each case is reproducible on its own. */
+typedef struct {
+    uint64_t index;
+    uint64_t draw;
+    bool allow_jumps;
+    bool allow_random;
+} generator;
+
+typedef struct {
+    char *chars;
+    size_t length;
+    size_t capacity;
+} text;
+
+typedef struct {
+    double values[NUM_ROWS];
+    status statuses[NUM_ROWS];
+} results;
+
+/* Regression cases expect double results. Other precisions must come
+ * within tolerance of them, relative or, below smallest, absolute. */
+typedef struct {
+    precision precision;
+    const char *name;
+    long double epsilon;
+    long double tolerance;
+    long double smallest;
+} precision_spec;
+
+/* The cases print 15 digits, which bounds how close long double gets. */
+static const precision_spec precisions[] = {
+    {DOUBLE_PRECISION, "double", DBL_EPSILON, 0, 0},
+    {SINGLE_PRECISION, "float", FLT_EPSILON, 64 * FLT_EPSILON, FLT_MIN},
+    {EXTENDED_PRECISION, "long double", LDBL_EPSILON, 1e-14L, LDBL_MIN},
+};
+#define NUM_PRECISIONS (sizeof(precisions) / sizeof(precisions[0]))
+
+typedef struct {
+    symbol_table *symbols;
+    work_pool *pool;
+    const precision_spec *precision; /* of the checks being run */
+    char program_path[64];
+    size_t num_failed;
+    size_t num_checks;
+} tester;
+
+static uint64_t next_bits(generator *g) {
+    uint64_t bits[2];
+    random_bits(g->index, g->draw++, bits);
+    return bits[0];
+}
+
+static size_t choose(generator *g, const size_t n) {
+    return (size_t) (next_bits(g) % n);
+}
+
+static int add_node(tree *t, const node *n) {
+    t->nodes[t->size] = *n;
+    return t->size++;
+}
+
+static int generate(generator *g, tree *t, const int depth);
+
+static int generate_leaf(generator *g, tree *t) {
+    node n = {.kind = NUMBER_NODE, .num_children = 0};
+    const size_t kind = choose(g, 10);
+    if (kind < 5) {
+        n.value = numbers[choose(g, sizeof(numbers) / sizeof(numbers[0]))];
+    } else if (kind < 6) {
+        n.kind = NAMED_NODE;
+        n.name = constants[choose(g, 2)];
+    } else if (kind < 9 || !g->allow_random) {
+        n.kind = NAMED_NODE;
+        n.name = variables[choose(g, NUM_VARIABLES)];
+        t->has_variables = true;
+    } else {
+        n.kind = RANDOM_NODE;
+        n.name = choose(g, 2) == 0 ? "rand" : "randn";
+        t->has_random = true;
+    }
+    return add_node(t, &n);
+}
+
+static int generate(generator *g, tree *t, const int depth) {
+    if (depth >= MAX_DEPTH || t->size + 4 >= MAX_NODES || choose(g, MAX_DEPTH) < (size_t) depth) {
+        return generate_leaf(g, t);
+    }
+    node n = {.num_children = 0};
+    const size_t kind = choose(g, 8);
+    if (kind == 0) {
+        n.kind = NEGATION_NODE;
+        n.num_children = 1;
+    } else if (kind < 4) {
+        const function_spec *f;
+        do {
+            f = &functions[choose(g, sizeof(functions) / sizeof(functions[0]))];
+        } while (!g->allow_jumps && strcmp(f->name, "if") == 0
+                 || !g->allow_random && strcmp(f->name, "randint") == 0);
+        n.kind = FUNCTION_NODE;
+        n.name = f->name;
+        n.num_children = f->arity;
+        t->has_jumps |= strcmp(f->name, "if") == 0;
+        t->has_random |= strcmp(f->name, "randint") == 0;
+        t->has_reductions |= strcmp(f->name, "dot") == 0 || strcmp(f->name, "norm") == 0
+                             || strcmp(f->name, "sum") == 0;
+    } else {
+        const operator_spec *o;
+        do {
+            o = &operators[choose(g, sizeof(operators) / sizeof(operators[0]))];
+        } while (!g->allow_jumps && o->precedence <= 2);
+        n.kind = OPERATOR_NODE;
+        n.name = o->name;
+        n.precedence = o->precedence;
+        n.num_children = 2;
+        t->has_jumps |= o->precedence <= 2;
+    }
+    for (int k = 0; k < n.num_children; k++) {
+        n.children[k] = generate(g, t, depth + 1);
+    }
+    return add_node(t, &n);
+}
+
+/* Sums and products of x and small integers, with small powers, which
+ * the optimizer folds into Horner form. */
+static int generate_polynomial(generator *g, tree *t, const int depth) {
+    node n = {.num_children = 0};
+    if (depth >= 4 || choose(g, 4) < (size_t) depth) {
+        if (choose(g, 2) == 0) {
+            n.kind = NAMED_NODE;
+            n.name = "x";
+            t->has_variables = true;
+        } else {
+            n.kind = NUMBER_NODE;
+            n.value = (double) choose(g, 6);
+        }
+        return add_node(t, &n);
+    }
+    const size_t kind = choose(g, 6);
+    if (kind == 0) {
+        n.kind = NEGATION_NODE;
+        n.num_children = 1;
+        n.children[0] = generate_polynomial(g, t, depth + 1);
+        return add_node(t, &n);
+    }
+    n.kind = OPERATOR_NODE;
+    n.num_children = 2;
+    n.children[0] = generate_polynomial(g, t, depth + 1);
+    if (kind == 1) {
+        n.name = "^";
+        n.precedence = POWER_PRECEDENCE;
+        const node exponent = {.kind = NUMBER_NODE, .value = (double) (2 + choose(g, 2))};
+        n.children[1] = add_node(t, &exponent);
+    } else {
+        n.name = kind < 4 ? (kind == 2 ? "+" : "-") : "*";
+        n.precedence = kind < 4 ? 4 : 5;
+        n.children[1] = generate_polynomial(g, t, depth + 1);
+    }
+    return add_node(t, &n);
+}
+
+/* An upper bound on the magnitude of every term of the expanded
+ * polynomial, which bounds the rounding error of any way of evaluating
+ * it. */
+static long double magnitude(const tree *t, const int i, const double x) {
+    const node *n = &t->nodes[i];
+    switch (n->kind) {
+        case NUMBER_NODE:
+            return fabsl((long double) n->value);
+        case NAMED_NODE:
+            return fabsl((long double) x);
+        case NEGATION_NODE:
+            return magnitude(t, n->children[0], x);
+        default:
+            break;
+    }
+    const long double a = magnitude(t, n->children[0], x);
+    const long double b = magnitude(t, n->children[1], x);
+    if (strcmp(n->name, "^") == 0) {
+        return powl(a, t->nodes[n->children[1]].value);
+    }
+    return strcmp(n->name, "*") == 0 ? a * b : a + b;
+}
+
+static void append(text *out, const char *s) {
+    const size_t n = strlen(s);
+    if (out->length + n + 1 > out->capacity) {
+        const size_t capacity = (out->length + n + 1) * 2;
+        char *grown = realloc(out->chars, capacity);
+        if (grown == NULL) {
+            fputs("out of memory\n", stderr);
+            exit(2);
+        }
+        out->chars = grown;
+        out->capacity = capacity;
+    }
+    memcpy(out->chars + out->length, s, n + 1);
+    out->length += n;
+}
+
+static void append_number(text *out, const double value) {
+    char s[32];
+    snprintf(s, sizeof(s), "%.17g", value);
+    append(out, s);
+}
+
+static int precedence_of(const node *n) {
+    if (n->kind == OPERATOR_NODE) {
+        return n->precedence;
+    }
+    return n->kind == NEGATION_NODE ? UNARY_PRECEDENCE : PRIMARY_PRECEDENCE;
+}
+
+static void write_infix(const tree *t, int i, bool minimal, text *out);
+
+static void write_operand(const tree *t, const int i, const bool minimal, const bool needs_parentheses, text *out) {
+    if (minimal && needs_parentheses) {
+        append(out, "(");
+    }
+    write_infix(t, i, minimal, out);
+    if (minimal && needs_parentheses) {
+        append(out, ")");
+    }
+}
+
+/* Fully parenthesized, or with only the parentheses that precedence and
+ * associativity call for. Both must compile to the same program. */
+static void write_infix(const tree *t, const int i, const bool minimal, text *out) {
+    const node *n = &t->nodes[i];
+    const bool grouped = !minimal && (n->kind == NEGATION_NODE || n->kind == OPERATOR_NODE);
+    if (grouped) {
+        append(out, "(");
+    }
+    switch (n->kind) {
+        case NUMBER_NODE:
+            append_number(out, n->value);
+            break;
+        case NAMED_NODE:
+            append(out, n->name);
+            break;
+        case RANDOM_NODE:
+            append(out, n->name);
+            append(out, "()");
+            break;
+        case NEGATION_NODE:
+            append(out, "-");
+            write_operand(t, n->children[0], minimal,
+                          precedence_of(&t->nodes[n->children[0]]) < PRIMARY_PRECEDENCE, out);
+            break;
+        case FUNCTION_NODE:
+            append(out, n->name);
+            append(out, "(");
+            for (int k = 0; k < n->num_children; k++) {
+                if (k > 0) {
+                    append(out, ", ");
+                }
+                write_infix(t, n->children[k], minimal, out);
+            }
+            append(out, ")");
+            break;
+        case OPERATOR_NODE: {
+            const int left = precedence_of(&t->nodes[n->children[0]]);
+            const int right = precedence_of(&t->nodes[n->children[1]]);
+            const bool is_power = n->precedence == POWER_PRECEDENCE;
+            write_operand(t, n->children[0], minimal, is_power ? left <= n->precedence : left < n->precedence, out);
+            append(out, " ");
+            append(out, n->name);
+            append(out, " ");
+            write_operand(t, n->children[1], minimal, is_power ? right < n->precedence : right <= n->precedence,
+                          out);
+            break;
+        }
+    }
+    if (grouped) {
+        append(out, ")");
+    }
+}
+
+/* Negation is written as neg, and if() evaluates both branches. */
+static void write_rpn(const tree *t, const int i, text *out) {
+    const node *n = &t->nodes[i];
+    for (int k = 0; k < n->num_children; k++) {
+        write_rpn(t, n->children[k], out);
+        append(out, " ");
+    }
+    if (n->kind == NUMBER_NODE) {
+        append_number(out, n->value);
+    } else {
+        append(out, n->kind == NEGATION_NODE ? "neg" : n->name);
+    }
+}
+
+static bool same_value(const double a, const double b) {
+    return isnan(a) && isnan(b) || memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+static void report(tester *ts, const uint64_t index, const char *engine, const char *detail, const char *expression) {
+    ts->num_failed++;
+    if (ts->num_failed <= MAX_REPORTED_FAILURES) {
+        printf("case %llu, %s in %s: %s\n    %s\n", (unsigned long long) index, engine, ts->precision->name, detail,
+               expression);
+    }
+}
+
+static void compare_rows(tester *ts, const uint64_t index, const char *engine, const results *expected,
+                         const results *actual, const bool *rows, const char *expression) {
+    ts->num_checks++;
+    for (int r = 0; r < NUM_ROWS; r++) {
+        if (rows != NULL && !rows[r]) {
+            continue;
+        }
+        if (expected->statuses[r] != actual->statuses[r]
+            || expected->statuses[r] == OK && !same_value(expected->values[r], actual->values[r])) {
+            char detail[256];
+            snprintf(detail, sizeof(detail), "row %d: expected %.17g (%s), got %.17g (%s)", r, expected->values[r],
+                     status_messages[expected->statuses[r]], actual->values[r], status_messages[actual->statuses[r]]);
+            report(ts, index, engine, detail, expression);
+            return;
+        }
+    }
+}
+
+/* The reference: one row at a time, each drawing for its own row. */
+static void evaluate_rows(const precision precision, dynamic_array *tokens, const symbol_table *symbols,
+                          const double *x, const double *y, results *out) {
+    for (int r = 0; r < NUM_ROWS; r++) {
+        const double values[NUM_VARIABLES] = {x[r], y[r]};
+        long double value = NAN;
+        random_start(r);
+        out->statuses[r] = stack_calculate_at(precision, tokens, symbols, values, &value);
+        out->values[r] = (double) value;
+    }
+}
+
+static status compile(tester *ts, const char *expression, const bool rpn, const bool optimize,
+                      dynamic_array **out) {
+    const compile_options options = {.rpn = rpn, .optimize = optimize, .fast_math_ulps = 0};
+    return compile_expression(expression, &options, ts->symbols, out, nullptr);
+}
+
+static status collect_elements(double *elements, const size_t count, void *context) {
+    results *out = context;
+    memcpy(out->values, elements, count * sizeof(double));
+    return OK;
+}
+
+static void check_block(tester *ts, const uint64_t index, dynamic_array *tokens, const results *expected,
+                        const char *expression) {
+    const double *columns[NUM_VARIABLES] = {row_x, row_y};
+    results actual;
+    random_start(0);
+    const status st = block_calculate(ts->precision->precision, tokens, ts->symbols, columns, NUM_VARIABLES,
+                                      NUM_ROWS, actual.values);
+    for (int r = 0; r < NUM_ROWS; r++) {
+        actual.statuses[r] = st;
+    }
+    compare_rows(ts, index, "block_calculate", expected, &actual, nullptr, expression);
+}
+
+/* x and y as vectors of all rows. A result that is a number is the
+ * reference's first row. */
+static void check_vector(tester *ts, const uint64_t index, dynamic_array *tokens, const results *expected,
+                         const char *expression) {
+    const double *const elements[NUM_VARIABLES] = {row_x, row_y};
+    const size_t lengths[NUM_VARIABLES] = {NUM_ROWS, NUM_ROWS};
+    const vector_bindings vectors = {.elements = elements, .lengths = lengths, .count = NUM_VARIABLES};
+    results actual;
+    vector_result result;
+    random_start(0);
+    const status st = vector_calculate(ts->precision->precision, tokens, ts->symbols, &vectors, collect_elements,
+                                       &actual, &result);
+    for (int r = 0; r < NUM_ROWS; r++) {
+        actual.statuses[r] = st;
+    }
+    const bool first_row[NUM_ROWS] = {true};
+    if (st == OK && !result.is_vector) {
+        actual.values[0] = (double) result.number;
+    }
+    compare_rows(ts, index, "vector_calculate", expected, &actual, result.is_vector ? nullptr : first_row,
+                 expression);
+}
+
+static void check_rpn_stream(tester *ts, const uint64_t index, const char *rpn, const results *expected) {
+    FILE *in = fmemopen((void *) rpn, strlen(rpn), "r");
+    if (in == NULL) {
+        report(ts, index, "rpn_stream_calculate", "fmemopen failed", rpn);
+        return;
+    }
+    results actual;
+    random_start(0);
+    actual.values[0] = NAN;
+    actual.statuses[0] = rpn_stream_calculate(in, ts->symbols, &actual.values[0]);
+    fclose(in);
+    const bool first_row[NUM_ROWS] = {true};
+    compare_rows(ts, index, "rpn_stream_calculate", expected, &actual, first_row, rpn);
+}
+
+static void check_program_file(tester *ts, const uint64_t index, dynamic_array *tokens, const results *expected,
+                               const char *expression) {
+    loaded_program program;
+    status st = program_save(tokens, NUM_VARIABLES, ts->program_path);
+    if (st == OK) {
+        st = program_load(ts->program_path, NUM_VARIABLES, &program);
+    }
+    if (st != OK) {
+        report(ts, index, "program_save/program_load", status_messages[st], expression);
+        return;
+    }
+    results actual;
+    evaluate_rows(ts->precision->precision, &program.tokens, ts->symbols, row_x, row_y, &actual);
+    program_unload(&program);
+    compare_rows(ts, index, "program_load", expected, &actual, nullptr, expression);
+}
+
+static void check_generated(tester *ts, const uint64_t index) {
+    generator g = {.index = index, .draw = 0};
+    g.allow_random = choose(&g, 4) == 0;
+    g.allow_jumps = !g.allow_random;
+    tree t = {.size = 0};
+    const int root = generate(&g, &t, 0);
+    text full = {0}, minimal = {0}, rpn = {0};
+    write_infix(&t, root, false, &full);
+    write_infix(&t, root, true, &minimal);
+    write_rpn(&t, root, &rpn);
+    dynamic_array *reference = nullptr, *with_minimal = nullptr, *with_rpn = nullptr;
+    status st = compile(ts, full.chars, false, false, &reference);
+    if (st != OK) {
+        report(ts, index, "compile", status_messages[st], full.chars);
+        goto end;
+    }
+    st = compile(ts, minimal.chars, false, false, &with_minimal);
+    if (st != OK) {
+        report(ts, index, "compile minimal parentheses", status_messages[st], minimal.chars);
+    }
+    /* if() in RPN evaluates both branches, and so draws more numbers */
+    if (!t.has_jumps || !t.has_random) {
+        st = compile(ts, rpn.chars, true, false, &with_rpn);
+        if (st != OK) {
+            report(ts, index, "compile rpn", status_messages[st], rpn.chars);
+        }
+    }
+    /* Engines must agree bit for bit at every precision. Across precisions
+     * only rounding differs, which round(), % and comparisons make
+     * arbitrarily large, so that is left to the polynomials. */
+    for (size_t p = 0; p < NUM_PRECISIONS; p++) {
+        ts->precision = &precisions[p];
+        results expected, actual;
+        evaluate_rows(ts->precision->precision, reference, ts->symbols, row_x, row_y, &expected);
+        if (with_minimal != NULL) {
+            evaluate_rows(ts->precision->precision, with_minimal, ts->symbols, row_x, row_y, &actual);
+            compare_rows(ts, index, "minimal parentheses", &expected, &actual, nullptr, minimal.chars);
+        }
+        if (with_rpn != NULL) {
+            evaluate_rows(ts->precision->precision, with_rpn, ts->symbols, row_x, row_y, &actual);
+            compare_rows(ts, index, "rpn", &expected, &actual, nullptr, rpn.chars);
+        }
+        check_block(ts, index, reference, &expected, full.chars);
+        /* vectors take straight-line programs, broadcast rand(), and reduce
+         * over elements rather than rows */
+        if (!t.has_jumps && !t.has_random && !t.has_reductions) {
+            check_vector(ts, index, reference, &expected, full.chars);
+        }
+        /* streaming is double only */
+        if (!t.has_variables && ts->precision->precision == DOUBLE_PRECISION) {
+            check_rpn_stream(ts, index, rpn.chars, &expected);
+        }
+        if (index % PROGRAM_FILE_EVERY == 0) {
+            check_program_file(ts, index, reference, &expected, full.chars);
+        }
+    }
+    ts->precision = &precisions[0];
+end:
+    if (reference != NULL) {
+        dynarr_free(reference);
+    }
+    if (with_minimal != NULL) {
+        dynarr_free(with_minimal);
+    }
+    if (with_rpn != NULL) {
+        dynarr_free(with_rpn);
+    }
+    free(full.chars);
+    free(minimal.chars);
+    free(rpn.chars);
+}
+
+static bool within_bound(const results *expected, const results *actual, const int r, const long double bound) {
+    return expected->statuses[r] == OK && actual->statuses[r] == OK
+           && fabsl((long double) actual->values[r] - expected->values[r]) <= bound;
+}
+
+static void report_bound(tester *ts, const uint64_t index, const char *engine, const results *expected,
+                         const results *actual, const int r, const long double bound, const char *expression) {
+    char detail[256];
+    snprintf(detail, sizeof(detail), "x = %g: expected %.17g (%s), got %.17g (%s), bound %Lg", polynomial_x[r],
+             expected->values[r], status_messages[expected->statuses[r]], actual->values[r],
+             status_messages[actual->statuses[r]], bound);
+    report(ts, index, engine, detail, expression);
+}
+
+/* The optimizer rewrites polynomials, which changes rounding only. At
+ * every precision, the optimized program must stay within a bound on
+ * that rounding of the plain one, and the plain one within the rounding
+ * of it and of double of the double result. */
+static void check_optimized(tester *ts, const uint64_t index) {
+    generator g = {.index = index, .draw = UINT64_C(1) << 32};
+    tree t = {.size = 0};
+    const int root = generate_polynomial(&g, &t, 0);
+    text full = {0};
+    write_infix(&t, root, false, &full);
+    dynamic_array *reference = nullptr, *optimized = nullptr;
+    status st = compile(ts, full.chars, false, false, &reference);
+    if (st == OK) {
+        st = compile(ts, full.chars, false, true, &optimized);
+    }
+    if (st != OK) {
+        report(ts, index, "compile -O", status_messages[st], full.chars);
+        goto end;
+    }
+    results in_double, expected, actual;
+    evaluate_rows(DOUBLE_PRECISION, reference, ts->symbols, polynomial_x, row_y, &in_double);
+    for (size_t p = 0; p < NUM_PRECISIONS; p++) {
+        ts->precision = &precisions[p];
+        evaluate_rows(ts->precision->precision, reference, ts->symbols, polynomial_x, row_y, &expected);
+        evaluate_rows(ts->precision->precision, optimized, ts->symbols, polynomial_x, row_y, &actual);
+        ts->num_checks++;
+        for (int r = 0; r < NUM_ROWS; r++) {
+            const long double m = magnitude(&t, root, polynomial_x[r]);
+            const long double bound = 64 * ts->precision->epsilon * m;
+            if (!within_bound(&expected, &actual, r, bound)) {
+                report_bound(ts, index, "optimize_program", &expected, &actual, r, bound, full.chars);
+                break;
+            }
+            const long double double_bound = 64 * (ts->precision->epsilon + DBL_EPSILON) * m;
+            if (!within_bound(&in_double, &expected, r, double_bound)) {
+                report_bound(ts, index, "plain against double", &in_double, &expected, r, double_bound, full.chars);
+                break;
+            }
+        }
+    }
+    ts->precision = &precisions[0];
+end:
+    if (reference != NULL) {
+        dynarr_free(reference);
+    }
+    if (optimized != NULL) {
+        dynarr_free(optimized);
+    }
+    free(full.chars);
+}
+
+/* A sum of straight-line trees, big enough to be split across threads,
+ * which must give a bit-identical result. */
+static void check_parallel(tester *ts, const uint64_t index) {
+    generator g = {.index = index, .draw = UINT64_C(2) << 32, .allow_jumps = false, .allow_random = false};
+    text sum = {0};
+    size_t num_tokens = 0;
+    while (num_tokens < 80000) {
+        tree t = {.size = 0};
+        const int root = generate(&g, &t, 2);
+        if (sum.length > 0) {
+            append(&sum, " + ");
+        }
+        write_infix(&t, root, false, &sum);
+        num_tokens += t.size + 1;
+    }
+    dynamic_array *tokens;
+    status st = compile(ts, sum.chars, false, false, &tokens);
+    if (st != OK) {
+        report(ts, index, "compile parallel", status_messages[st], "(a sum of trees)");
+        free(sum.chars);
+        return;
+    }
+    const double values[NUM_VARIABLES] = {row_x[3], row_y[3]};
+    results expected, actual;
+    expected.statuses[0] = stack_calculate(tokens, ts->symbols, values, &expected.values[0]);
+    actual.statuses[0] = parallel_calculate(tokens, ts->symbols, values, NUM_VARIABLES, ts->pool, &actual.values[0]);
+    const bool first_row[NUM_ROWS] = {true};
+    compare_rows(ts, index, "parallel_calculate", &expected, &actual, first_row, "(a sum of trees)");
+    dynarr_free(tokens);
+    free(sum.chars);
+}
+
+/* The next "..." argument of a line, without escapes, as the cases use. */
+static bool next_argument(const char **s, char *out, const size_t size) {
+    const char *start = strchr(*s, '"');
+    const char *end = start != NULL ? strchr(start + 1, '"') : nullptr;
+    if (end == NULL || (size_t) (end - start) > size) {
+        return false;
+    }
+    memcpy(out, start + 1, end - start - 1);
+    out[end - start - 1] = '\0';
+    *s = end + 1;
+    return true;
+}
+
+/* Whether actual is expected, rounded to the precision, within its
+ * tolerance. Errors and other text must match exactly. */
+static bool is_close(const precision_spec *p, const char *expected, const long double actual) {
+    char *end;
+    long double e = strtold(expected, &end);
+    if (*end != '\0' || end == expected) {
+        return false;
+    }
+    if (p->precision == SINGLE_PRECISION) {
+        e = (float) e;
+    }
+    if (isnan(e) || isnan(actual) || isinf(e) || isinf(actual)) {
+        return isnan(e) && isnan(actual) || e == actual;
+    }
+    const long double error = fabsl(actual - e);
+    return error <= p->tolerance * fabsl(e) || error <= p->smallest;
+}
+
+/* A test_exact or test_rpn case at one precision, printed as calc prints
+ * double. Lines marked "# double only" expect what double rounding gives. */
+static void run_regression_case(tester *ts, const size_t count, const bool rpn, const char *expected,
+                                const char *expression) {
+    dynamic_array *tokens;
+    long double result = NAN;
+    random_start(0);
+    status st = compile(ts, expression, rpn, false, &tokens);
+    if (st == OK) {
+        st = stack_calculate_at(ts->precision->precision, tokens, ts->symbols, nullptr, &result);
+        dynarr_free(tokens);
+    }
+    char actual[1100];
+    if (st == OK) {
+        snprintf(actual, sizeof(actual), "%.15LG", (long double) (double) result);
+    } else {
+        snprintf(actual, sizeof(actual), "error: %s", status_messages[st]);
+    }
+    if (strcmp(actual, expected) == 0
+        || st == OK && ts->precision->precision != DOUBLE_PRECISION && is_close(ts->precision, expected, result)) {
+        return;
+    }
+    char detail[2300];
+    if (st == OK) {
+        snprintf(detail, sizeof(detail), "expected '%s', got '%.21LG'", expected, result);
+    } else {
+        snprintf(detail, sizeof(detail), "expected '%s', got '%s'", expected, actual);
+    }
+    report(ts, count, rpn ? "regression --rpn" : "regression", detail, expression);
+}
+
+/* test_exact and test_rpn lines, evaluated at every precision. */
+static status run_regression_cases(tester *ts, const char *path, size_t *out_count) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        return IO_ERROR;
+    }
+    char line[4096];
+    size_t count = 0;
+    while (fgets(line, sizeof(line), in) != NULL) {
+        const bool rpn = strncmp(line, "test_rpn \"", strlen("test_rpn \"")) == 0;
+        if (!rpn && strncmp(line, "test_exact \"", strlen("test_exact \"")) != 0) {
+            continue;
+        }
+        char expected[1024], expression[2048];
+        const char *s = line;
+        if (!next_argument(&s, expected, sizeof(expected)) || !next_argument(&s, expression, sizeof(expression))) {
+            continue;
+        }
+        count++;
+        const size_t num_precisions = strstr(s, "# double only") != NULL ? 1 : NUM_PRECISIONS;
+        for (size_t p = 0; p < num_precisions; p++) {
+            ts->precision = &precisions[p];
+            run_regression_case(ts, count, rpn, expected, expression);
+        }
+    }
+    ts->precision = &precisions[0];
+    fclose(in);
+    *out_count = count;
+    return OK;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(void) {
+    printf("usage: ccalc_tests [--cases N] [--first N] [--seed N] [--regression FILE]\n"
+           "\n"
+           "Evaluates the test_exact and test_rpn cases of FILE, normally\n"
+           "regression-test.sh, then N generated expressions (default: 200000),\n"
+           "numbered from --first on, in every engine.\n");
+}
+
+int main(const int argc, const char *argv[]) {
+    uint64_t num_cases = 200000;
+    uint64_t first = 0;
+    const char *regression_path = nullptr;
+    random_seed = 1;
+    for (int q = 1; q < argc; q++) {
+        const bool has_value = q + 1 < argc && isdigit((unsigned char) argv[q + 1][0]);
+        if (strcmp(argv[q], "--cases") == 0 && has_value) {
+            num_cases = strtoull(argv[++q], nullptr, 10);
+        } else if (strcmp(argv[q], "--first") == 0 && has_value) {
+            first = strtoull(argv[++q], nullptr, 10);
+        } else if (strcmp(argv[q], "--seed") == 0 && has_value) {
+            random_seed = strtoull(argv[++q], nullptr, 10);
+        } else if (strcmp(argv[q], "--regression") == 0 && q + 1 < argc) {
+            regression_path = argv[++q];
+        } else {
+            usage();
+            return strcmp(argv[q], "-h") == 0 || strcmp(argv[q], "--help") == 0 ? 0 : 2;
+        }
+    }
+    tester ts = {.precision = &precisions[0], .num_failed = 0, .num_checks = 0};
+    size_t idx;
+    status st = symbols_new(&ts.symbols);
+    for (int k = 0; k < NUM_VARIABLES && st == OK; k++) {
+        st = symbols_add_variable(ts.symbols, variables[k], &idx);
+    }
+    if (st == OK) {
+        st = pool_new(PARALLEL_THREADS, &ts.pool);
+    }
+    snprintf(ts.program_path, sizeof(ts.program_path), "/tmp/ccalc_tests_%ld.ccb", (long) getpid());
+    if (st == OK && regression_path != NULL) {
+        size_t count = 0;
+        st = run_regression_cases(&ts, regression_path, &count);
+        printf("%zu regression cases, %zu failed\n", count, ts.num_failed);
+    }
+    if (st != OK) {
+        printf("error: %s\n", status_messages[st]);
+        return 2;
+    }
+    const size_t regression_failures = ts.num_failed;
+    const double start = now_seconds();
+    for (uint64_t index = first; index < first + num_cases; index++) {
+        check_generated(&ts, index);
+        check_optimized(&ts, index);
+        if (index % PARALLEL_EVERY == PARALLEL_EVERY - 1) {
+            check_parallel(&ts, index);
+        }
+    }
+    const double seconds = now_seconds() - start;
+    printf("%llu generated cases, %zu checks in %.2f s (%.0f cases per minute), %zu failed\n",
+           (unsigned long long) num_cases, ts.num_checks, seconds, num_cases / (seconds > 0 ? seconds : 1) * 60,
+           ts.num_failed - regression_failures);
+    unlink(ts.program_path);
+    pool_free(ts.pool);
+    symbols_free(ts.symbols);
+    return ts.num_failed == 0 ? 0 : 1;
+}
@@ -6,14 +6,19 @@
 #include <string.h>
 #include <strings.h>
 
+#include "resource_limits.h"
+
+#define MAX_DECIMAL_EXPONENT 100000
+
 typedef struct {
     const char *s;
-    int idx;
-    size_t max_identifier_length;
+    size_t idx;
+    size_t len;
+    const symbol_table *symbols;
 } tokenizer_state;
 
 static char curr_char(const tokenizer_state *state) {
-    if (state->idx >= strlen(state->s)) {
+    if (state->idx >= state->len) {
         return '\0';
     }
     return state->s[state->idx];
@@ -21,7 +26,7 @@ static char curr_char(const tokenizer_state *state) {
 
 static char next_char(tokenizer_state *state) {
     state->idx++;
-    if (state->idx >= strlen(state->s)) {
+    if (state->idx >= state->len) {
         return '\0';
     }
     return state->s[state->idx];
@@ -37,9 +42,10 @@ static void skip_whitespace(tokenizer_state *state) {
     }
 }
 
-static status scan_number(tokenizer_state *state, double *out_number) {
-    double number = 0.0;
-    double divider = 0.1;
+/* Scans in long double, so the literal is accurate at every precision. */
+static status scan_number(tokenizer_state *state, long double *out_number) {
+    long double number = 0.0L;
+    long double divider = 0.1L;
     bool dot_seen = false;
     for (;;) {
         char c = curr_char(state);
@@ -53,9 +59,9 @@ static status scan_number(tokenizer_state *state, double *out_number) {
             if (c == '\0') {
                 return INVALID_EXPONENT;
             }
-            double sign = 1.0;
+            long double sign = 1.0L;
             if (c == '-') {
-                sign = -1.0;
+                sign = -1.0L;
                 c = next_char(state);
                 if (c == '\0') {
                     return INVALID_EXPONENT;
@@ -66,20 +72,27 @@ static status scan_number(tokenizer_state *state, double *out_number) {
                     return INVALID_EXPONENT;
                 }
             }
-            double exp;
-            const status st = scan_number(state, &exp);
-            if (st != OK) {
-                return st;
+            if (c < '0' || c > '9') {
+                return INVALID_EXPONENT;
             }
-            number *= pow(10.0, sign * exp);
+            /* beyond MAX_DECIMAL_EXPONENT the result is 0 or infinite anyway,
+             * so absurdly long exponents cost no more than their digits */
+            long exp = 0;
+            while (c >= '0' && c <= '9') {
+                if (exp < MAX_DECIMAL_EXPONENT) {
+                    exp = exp * 10 + (c - '0');
+                }
+                c = next_char(state);
+            }
+            number *= powl(10.0L, sign * (long double) exp);
             break;
         } else if (c >= '0' && c <= '9') {
             const int digit = c - '0';
             if (dot_seen) {
                 number += digit * divider;
-                divider /= 10.0;
+                divider /= 10.0L;
             } else {
-                number = number * 10.0 + digit;
+                number = number * 10.0L + digit;
             }
         } else {
             break;
@@ -90,14 +103,23 @@ static status scan_number(tokenizer_state *state, double *out_number) {
     return OK;
 }
 
-static void scan_identifier(tokenizer_state *state, char *identifier) {
-    int idx = 0;
+static void skip_identifier(tokenizer_state *state) {
+    const size_t start = state->idx;
     char c = curr_char(state);
-    while (c != '\0' && (c >= 'a' && c <= 'z' || c >= 'A' && c <= 'Z')) {
-        identifier[idx++] = c;
+    while (c != '\0' && (c == '_' || c >= 'a' && c <= 'z' || c >= 'A' && c <= 'Z'
+                         || state->idx > start && c >= '0' && c <= '9')) {
         c = next_char(state);
     }
-    identifier[idx] = '\0';
+}
+
+static status scan_identifier(tokenizer_state *state, char **out_identifier) {
+    const size_t start = state->idx;
+    skip_identifier(state);
+    *out_identifier = strndup(state->s + start, state->idx - start);
+    if (*out_identifier == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    return OK;
 }
 
 static status to_function_or_constant_token(const char *identifier, token *token) {
@@ -186,6 +208,56 @@ static status to_function_or_constant_token(const char *identifier, token *token
         token->function = NEG;
         return OK;
     }
+    if (strcasecmp(identifier, "IF") == 0) {
+        token->type = FUNCTION;
+        token->function = IF;
+        return OK;
+    }
+    if (strcasecmp(identifier, "FMA") == 0) {
+        token->type = FUNCTION;
+        token->function = FMA;
+        return OK;
+    }
+    if (strcasecmp(identifier, "DOT") == 0) {
+        token->type = FUNCTION;
+        token->function = DOT;
+        return OK;
+    }
+    if (strcasecmp(identifier, "NORM") == 0) {
+        token->type = FUNCTION;
+        token->function = NORM;
+        return OK;
+    }
+    if (strcasecmp(identifier, "SUM") == 0) {
+        token->type = FUNCTION;
+        token->function = SUM;
+        return OK;
+    }
+    if (strcasecmp(identifier, "RAND") == 0) {
+        token->type = FUNCTION;
+        token->function = RAND;
+        return OK;
+    }
+    if (strcasecmp(identifier, "RANDN") == 0) {
+        token->type = FUNCTION;
+        token->function = RANDN;
+        return OK;
+    }
+    if (strcasecmp(identifier, "RANDINT") == 0) {
+        token->type = FUNCTION;
+        token->function = RANDINT;
+        return OK;
+    }
+    if (strcasecmp(identifier, "AND") == 0) {
+        token->type = OPERATOR;
+        token->operator = AND;
+        return OK;
+    }
+    if (strcasecmp(identifier, "OR") == 0) {
+        token->type = OPERATOR;
+        token->operator = OR;
+        return OK;
+    }
     if (strcasecmp(identifier, "E") == 0) {
         token->type = CONSTANT;
         token->constant = E;
@@ -199,31 +271,90 @@ static status to_function_or_constant_token(const char *identifier, token *token
     return UNKNOWN_FUNCTION_OR_CONSTANT;
 }
 
+token value_token(const long double number) {
+    token vt;
+    vt.type = VALUE;
+    vt.value = (double) number;
+    vt.residual = 0;
+    if (isfinite(vt.value) && vt.value != 0) {
+        const int exponent = ilogb(vt.value);
+        const long double rest = number - vt.value;
+        const float residual = (float) ldexpl(rest, -exponent);
+        if (ldexpl(residual, exponent) == rest) {
+            vt.residual = residual;
+        }
+    }
+    return vt;
+}
+
+bool is_reserved_identifier(const char *identifier) {
+    token token;
+    return to_function_or_constant_token(identifier, &token) == OK;
+}
+
+int function_arity(const function_token ft) {
+    switch (ft) {
+        case IF:
+        case FMA:
+            return 3;
+        case DOT:
+        case RANDINT:
+            return 2;
+        case RAND:
+        case RANDN:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+static status to_user_symbol_token(const symbol_table *symbols, const char *identifier, token *token) {
+    size_t idx;
+    if (symbols_find_parameter(symbols, identifier, &idx)) {
+        token->type = ARGUMENT;
+        token->argument = idx;
+        return OK;
+    }
+    if (symbols_find_variable(symbols, identifier, &idx)) {
+        token->type = VARIABLE;
+        token->variable = idx;
+        return OK;
+    }
+    if (symbols_find_function(symbols, identifier, &idx)) {
+        token->type = CALL;
+        token->user_function = idx;
+        return OK;
+    }
+    return UNKNOWN_FUNCTION_OR_CONSTANT;
+}
+
+/* Scans the token at the current character, which is not whitespace. */
 static status next_token(tokenizer_state *state, token *out_token) {
     status st;
-    skip_whitespace(state);
     const char c = curr_char(state);
     if (c == '\0') {
         out_token->type = END;
         return OK;
     }
     if (c == '.' || c >= '0' && c <= '9') {
-        double number;
+        long double number;
         st = scan_number(state, &number);
         if (st != OK) {
             return st;
         }
-        out_token->type = VALUE;
-        out_token->value = number;
+        *out_token = value_token(number);
         return OK;
     }
     if (c == '_' || c >= 'a' && c <= 'z' || c >= 'A' && c <= 'Z') {
-        char *identifier = malloc(state->max_identifier_length + 1);
-        if (identifier == NULL) {
-            return OUT_OF_MEMORY;
+        char *identifier;
+        st = scan_identifier(state, &identifier);
+        if (st != OK) {
+            return st;
         }
-        scan_identifier(state, identifier);
         st = to_function_or_constant_token(identifier, out_token);
+        if (st == UNKNOWN_FUNCTION_OR_CONSTANT) {
+            st = to_user_symbol_token(state->symbols, identifier, out_token);
+        }
         free(identifier);
         if (st != OK) {
             return st;
@@ -260,33 +391,131 @@ static status next_token(tokenizer_state *state, token *out_token) {
         case ',':
             out_token->operator = COMMA;
             return OK;
+        case '[':
+            out_token->operator = LEFT_BRACKET;
+            return OK;
+        case ']':
+            out_token->operator = RIGHT_BRACKET;
+            return OK;
+        case '<':
+            if (curr_char(state) == '=') {
+                next_char(state);
+                out_token->operator = LESS_OR_EQUAL;
+            } else {
+                out_token->operator = LESS;
+            }
+            return OK;
+        case '>':
+            if (curr_char(state) == '=') {
+                next_char(state);
+                out_token->operator = GREATER_OR_EQUAL;
+            } else {
+                out_token->operator = GREATER;
+            }
+            return OK;
+        case '=':
+            if (curr_char(state) != '=') {
+                return UNEXPECTED_CHARACTER;
+            }
+            next_char(state);
+            out_token->operator = EQUAL;
+            return OK;
+        case '!':
+            if (curr_char(state) != '=') {
+                return UNEXPECTED_CHARACTER;
+            }
+            next_char(state);
+            out_token->operator = NOT_EQUAL;
+            return OK;
         default:
             return UNEXPECTED_CHARACTER;
     }
 }
 
-status tokenize(const char *expression, dynamic_array **out_token_array) {
-    status st = dynarr_new(sizeof(token), 10, out_token_array);
-    if (st != OK) {
-        return st;
+status tokenize_each(const char *s, const size_t len, const symbol_table *symbols,
+                     const token_handler on_token, void *context, source_span *out_span) {
+    if (active_limits.max_input_bytes > 0 && len > active_limits.max_input_bytes) {
+        return INPUT_TOO_LARGE;
     }
     tokenizer_state state;
-    state.s = expression;
+    state.s = s;
     state.idx = 0;
-    state.max_identifier_length = strlen(expression);
+    state.len = len;
+    state.symbols = symbols;
+    size_t num_tokens = 0;
     for (;;) {
+        skip_whitespace(&state);
+        const size_t start = state.idx;
         token token;
-        st = next_token(&state, &token);
-        if (st != OK) {
-            return st;
-        }
-        if (token.type == END) {
+        status st = next_token(&state, &token);
+        if (st == OK && token.type == END) {
             break;
         }
-        st = dynarr_append(*out_token_array, &token);
+        if (st == OK && active_limits.max_tokens > 0 && ++num_tokens > active_limits.max_tokens) {
+            st = TOO_MANY_TOKENS;
+        }
+        if (st == OK) {
+            st = on_token(&token, start, context);
+        }
         if (st != OK) {
+            if (out_span != NULL && st != OUT_OF_MEMORY) {
+                out_span->offset = start;
+                out_span->length = state.idx > start ? state.idx - start : 1;
+            }
             return st;
         }
     }
     return OK;
 }
+
+size_t token_length(const char *s, const size_t len, const size_t offset) {
+    tokenizer_state state;
+    state.s = s;
+    state.idx = offset;
+    state.len = len;
+    state.symbols = nullptr;
+    const char c = curr_char(&state);
+    if (c == '.' || c >= '0' && c <= '9') {
+        long double number;
+        scan_number(&state, &number);
+    } else if (c == '_' || c >= 'a' && c <= 'z' || c >= 'A' && c <= 'Z') {
+        skip_identifier(&state);
+    } else if (c != '\0') {
+        next_char(&state);
+        if ((c == '<' || c == '>' || c == '=' || c == '!') && curr_char(&state) == '=') {
+            next_char(&state);
+        }
+    }
+    return state.idx - offset;
+}
+
+typedef struct {
+    dynamic_array *tokens;
+    dynamic_array *offsets; /* or null */
+} token_collector;
+
+static status append_token(const token *token, const size_t offset, void *context) {
+    const token_collector *collector = context;
+    const status st = dynarr_append(collector->tokens, token);
+    if (st == OK && collector->offsets != NULL) {
+        /* sized by tokenize() to never grow */
+        ((size_t *) collector->offsets->elements)[collector->offsets->size++] = offset;
+    }
+    return st;
+}
+
+status tokenize(const char *expression, const symbol_table *symbols, dynamic_array **out_token_array,
+                dynamic_array **out_offsets, source_span *out_span) {
+    const size_t len = strlen(expression);
+    status st = dynarr_new(sizeof(token), 10, out_token_array);
+    /* no more tokens than bytes, so offsets need room for len at most */
+    if (st == OK && out_offsets != NULL) {
+        st = dynarr_new(sizeof(size_t), len + 1, out_offsets);
+    }
+    if (st != OK) {
+        return st;
+    }
+    const token_collector collector = {.tokens = *out_token_array,
+                                       .offsets = out_offsets != NULL ? *out_offsets : nullptr};
+    return tokenize_each(expression, len, symbols, append_token, (void *) &collector, out_span);
+}
@@ -1,8 +1,11 @@
 #ifndef CCALC_TOKENIZER_H
 #define CCALC_TOKENIZER_H
 
+#include <math.h>
+
 #include "dynarr.h"
 #include "status.h"
+#include "symbols.h"
 
 typedef enum {
     ADDITION,
@@ -15,6 +18,16 @@ typedef enum {
     LEFT_PAREN,
     RIGHT_PAREN,
     COMMA,
+    LESS,
+    LESS_OR_EQUAL,
+    GREATER,
+    GREATER_OR_EQUAL,
+    EQUAL,
+    NOT_EQUAL,
+    AND,
+    OR,
+    LEFT_BRACKET,
+    RIGHT_BRACKET,
 } operator_token;
 
 typedef enum {
@@ -35,6 +48,22 @@ typedef enum {
     TANH,
     TRUNC,
     NEG,
+    IF,
+    FMA, /* fma(x, y, z) = x * y + z, rounded once */
+    /* reductions of vectors to numbers; of numbers, x * y, abs(x) and x */
+    DOT,
+    NORM,
+    SUM,
+    /* random numbers: uniform in [0, 1), standard normal, integer in [a, b] */
+    RAND,
+    RANDN,
+    RANDINT,
+    /* approximations, produced by use_fast_math() only */
+    FAST_SIN,
+    FAST_COS,
+    FAST_EXP,
+    FAST_LN,
+    FAST_TANH,
 } function_token;
 
 typedef enum {
@@ -48,19 +77,67 @@ typedef enum {
     FUNCTION,
     CONSTANT,
     VALUE,
+    /* jumps are produced by the parser only, for lazy evaluation. */
+    JUMP,
+    JUMP_IF_FALSE,
+    JUMP_IF_TRUE,
+    CALL, /* of a user-defined function */
+    ARGUMENT, /* parameter reference inside a user-defined function body */
+    VARIABLE, /* input bound outside the expression, like a column */
+    INTEGER_POWER, /* x^n for a small integer constant n, produced by the parser */
+    VECTOR, /* of the length values below it, from [a, b, c] */
 } token_type;
 
 typedef struct {
     token_type type;
+    /* VALUE only: the literal is value + residual * 2^ilogb(value) to long
+     * double precision. Scaling by the exponent of value keeps the residual
+     * in float range at any magnitude. Fits in what would otherwise be
+     * padding. */
+    float residual;
 
     union {
         operator_token operator;
         function_token function;
         constant_token constant;
         double value;
+        size_t target;
+        size_t user_function;
+        size_t argument;
+        size_t variable;
+        long exponent;
+        size_t length;
     };
 } token;
 
-status tokenize(const char *expression, dynamic_array **out_token_array);
+typedef status (*token_handler)(const token *token, size_t offset, void *context);
+
+/* A VALUE token of number. The residual is 0 wherever it would not give
+ * number back exactly. */
+token value_token(long double number);
+
+/* The literal of a VALUE token, for evaluation in long double. */
+static inline long double value_token_literal(const token *t) {
+    if (t->residual == 0) {
+        return t->value;
+    }
+    return (long double) t->value + ldexpl(t->residual, ilogb(t->value));
+}
+
+bool is_reserved_identifier(const char *identifier);
+/* The number of arguments the function takes. */
+int function_arity(function_token ft);
+/* Hands each token of s[0..len) to on_token as soon as it is scanned,
+ * with the offset it starts at. A token running up to len is taken to end
+ * there. On an error, *out_span, when given, is the text at fault. */
+status tokenize_each(const char *s, size_t len, const symbol_table *symbols, token_handler on_token, void *context,
+                     source_span *out_span);
+/* When out_offsets is given, also collects the offset of each token, as
+ * size_t, into a side array, so that token stays compact. */
+status tokenize(const char *expression, const symbol_table *symbols, dynamic_array **out_token_array,
+                dynamic_array **out_offsets, source_span *out_span);
+/* The length of the token at s[offset]. Only offsets are kept, so errors
+ * found after tokenizing scan their token again. */
+size_t token_length(const char *s, size_t len, size_t offset);
 
 #endif
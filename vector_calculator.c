@@ -0,0 +1,340 @@
+#include "vector_calculator.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block_calculator.h"
+#include "program.h"
+#include "random.h"
+#include "stack_calculator.h"
+#include "tokenizer.h"
+
+/* Elements computed at a time, for a reduction or for the result, into a
+ * buffer that stays in cache. */
+#define CHUNK_SIZE 4096
+
+/* A vector read by VARIABLE tokens of the rewritten program. */
+typedef struct {
+    const double *elements;
+    size_t length;
+    bool owned; /* made from a literal, rather than bound */
+} vector_column;
+
+/* A value on the stack while rewriting, computed by the tokens from start
+ * up to where the next value starts. */
+typedef struct {
+    size_t start;
+    bool is_vector;
+    size_t length;
+} operand;
+
+/* Tokens are copied into program one at a time, while tracking the shape
+ * of every value on the stack. Whatever is only needed as a number, like
+ * the elements of a literal or the result of a reduction, is evaluated as
+ * soon as its tokens are complete and replaced by its value. */
+typedef struct {
+    precision precision;
+    const symbol_table *symbols;
+    size_t num_bound;
+    dynamic_array *program; /* token */
+    dynamic_array *operands; /* operand */
+    dynamic_array *columns; /* vector_column, the bound ones first */
+} rewriter;
+
+bool has_vectors(const dynamic_array *tokens, const vector_bindings *vectors) {
+    const token *t = tokens->elements;
+    const size_t num_vectors = vectors != NULL ? vectors->count : 0;
+    for (size_t q = 0; q < tokens->size; q++) {
+        if (t[q].type == VECTOR || t[q].type == VARIABLE && t[q].variable < num_vectors) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Evaluates program[start, end), which computes one number. */
+static status evaluate_number(const rewriter *r, const size_t start, const size_t end, long double *out) {
+    token *t = (token *) r->program->elements + start;
+    if (end - start == 1 && t->type == VALUE) {
+        *out = r->precision == EXTENDED_PRECISION ? value_token_literal(t) : t->value;
+        return OK;
+    }
+    dynamic_array span;
+    dynarr_wrap(t, sizeof(token), end - start, &span);
+    return stack_calculate_at(r->precision, &span, r->symbols, nullptr, out);
+}
+
+/* Replaces program[start, end) by t, moving the operands after it. */
+static void replace_span(const rewriter *r, const size_t start, const size_t end, const token *t, operand *after,
+                         const size_t num_after) {
+    token *tokens = r->program->elements;
+    tokens[start] = *t;
+    memmove(tokens + start + 1, tokens + end, (r->program->size - end) * sizeof(token));
+    const size_t removed = end - start - 1;
+    r->program->size -= removed;
+    for (size_t q = 0; q < num_after; q++) {
+        after[q].start -= removed;
+    }
+}
+
+/* Evaluates the operands that are numbers, other than literals, so that
+ * broadcasting them costs nothing per element, and rand() is one number
+ * rather than one per element. Right to left, so that the operands still
+ * to be visited stay in place. A long double beyond the range of double
+ * does not fit a token, and is left to be computed per element. */
+static status fold_numbers(const rewriter *r, operand *args, const size_t count) {
+    const token *tokens = r->program->elements;
+    for (size_t q = count; q-- > 0;) {
+        const size_t end = q + 1 < count ? args[q + 1].start : r->program->size;
+        if (args[q].is_vector || end - args[q].start == 1 && tokens[args[q].start].type == VALUE) {
+            continue;
+        }
+        long double number;
+        const status st = evaluate_number(r, args[q].start, end, &number);
+        if (st != OK) {
+            return st;
+        }
+        const token vt = value_token(number);
+        if (r->precision == EXTENDED_PRECISION && value_token_literal(&vt) != number && !isnan(number)) {
+            continue;
+        }
+        replace_span(r, args[q].start, end, &vt, args + q + 1, count - q - 1);
+    }
+    return OK;
+}
+
+/* Points each column at its element first, where it has one. */
+static void column_pointers(const rewriter *r, const size_t first, const double **out) {
+    const vector_column *columns = r->columns->elements;
+    for (size_t k = 0; k < r->columns->size; k++) {
+        out[k] = first < columns[k].length ? columns[k].elements + first : columns[k].elements;
+    }
+}
+
+/* Computes the elements of program[start, end of program) a chunk at a
+ * time, into a buffer that stays in cache, and passes each chunk on to
+ * write. Element i draws random numbers for row i, as in one block. */
+static status compute_chunks(const rewriter *r, const size_t start, const size_t length, const result_writer write,
+                             void *context) {
+    dynamic_array span;
+    dynarr_wrap((token *) r->program->elements + start, sizeof(token), r->program->size - start, &span);
+    double *chunk = malloc(CHUNK_SIZE * sizeof(double));
+    const double **columns = malloc((r->columns->size + 1) * sizeof(double *));
+    status st = chunk == NULL || columns == NULL ? OUT_OF_MEMORY : OK;
+    const uint64_t first_row = random_row;
+    const uint64_t first_draw = random_draw;
+    for (size_t first = 0; first < length && st == OK; first += CHUNK_SIZE) {
+        const size_t n = length - first < CHUNK_SIZE ? length - first : CHUNK_SIZE;
+        column_pointers(r, first, columns);
+        random_row = first_row + first;
+        random_draw = first_draw;
+        st = block_calculate(r->precision, &span, r->symbols, columns, r->columns->size, n, chunk);
+        if (st == OK) {
+            st = write(chunk, n, context);
+        }
+    }
+    random_row = first_row;
+    free(chunk);
+    free(columns);
+    return st;
+}
+
+/* Adds a chunk to the long double total in context. Four partial sums let
+ * the additions overlap. */
+static status add_chunk(double *elements, const size_t count, void *context) {
+    double partial[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        for (size_t w = 0; w < 4; w++) {
+            partial[w] += elements[i + w];
+        }
+    }
+    for (; i < count; i++) {
+        partial[0] += elements[i];
+    }
+    *(long double *) context += (long double) (partial[0] + partial[1]) + (partial[2] + partial[3]);
+    return OK;
+}
+
+/* The shape of an element-wise result: a vector if any operand is one,
+ * in which case all vector operands must agree in length. */
+static status broadcast(const operand *args, const size_t count, operand *result) {
+    for (size_t q = 0; q < count; q++) {
+        if (!args[q].is_vector) {
+            continue;
+        }
+        if (result->is_vector && args[q].length != result->length) {
+            return VECTOR_LENGTH_MISMATCH;
+        }
+        result->is_vector = true;
+        result->length = args[q].length;
+    }
+    return OK;
+}
+
+/* [a, b, c]: the elements are evaluated now, into a column that the
+ * program reads like a bound vector. */
+static status materialize(const rewriter *r, const operand *args, const size_t count, operand *result) {
+    for (size_t q = 0; q < count; q++) {
+        if (args[q].is_vector) {
+            return UNEXPECTED_VECTOR;
+        }
+    }
+    double *elements = malloc(count * sizeof(double));
+    if (elements == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    for (size_t q = 0; q < count; q++) {
+        const size_t end = q + 1 < count ? args[q + 1].start : r->program->size;
+        long double number;
+        const status st = evaluate_number(r, args[q].start, end, &number);
+        if (st != OK) {
+            free(elements);
+            return st;
+        }
+        elements[q] = (double) number;
+    }
+    const vector_column column = {.elements = elements, .length = count, .owned = true};
+    const status st = dynarr_append(r->columns, &column);
+    if (st != OK) {
+        free(elements);
+        return st;
+    }
+    token vt;
+    vt.type = VARIABLE;
+    vt.variable = r->columns->size - 1;
+    r->program->size = result->start;
+    result->is_vector = true;
+    result->length = count;
+    return dynarr_append(r->program, &vt);
+}
+
+/* dot(a, b) sums a * b, norm(a) is the square root of the sum of a^2, and
+ * sum(a) sums a. The tokens computing the elements make way for the
+ * result. */
+static status reduce(const rewriter *r, const function_token ft, operand *args, const size_t count,
+                     operand *result) {
+    status st = fold_numbers(r, args, count);
+    if (st == OK && ft == DOT) {
+        token mt;
+        mt.type = OPERATOR;
+        mt.operator = MULTIPLICATION;
+        st = dynarr_append(r->program, &mt);
+    } else if (st == OK && ft == NORM) {
+        token pt;
+        pt.type = INTEGER_POWER;
+        pt.exponent = 2;
+        st = dynarr_append(r->program, &pt);
+    }
+    long double total = 0;
+    if (st == OK) {
+        st = compute_chunks(r, result->start, result->length, add_chunk, &total);
+    }
+    if (st != OK) {
+        return st;
+    }
+    r->program->size = result->start;
+    result->is_vector = false;
+    result->length = 0;
+    const token vt = value_token(ft == NORM ? sqrtl(total) : total);
+    return dynarr_append(r->program, &vt);
+}
+
+static status rewrite_token(rewriter *r, const token *t) {
+    if (t->type == JUMP || t->type == JUMP_IF_FALSE || t->type == JUMP_IF_TRUE || t->type == CALL
+        || t->type == ARGUMENT) {
+        return UNEXPECTED_VECTOR;
+    }
+    size_t pops, pushes;
+    if (!program_stack_effect(t, r->num_bound, &pops, &pushes)) {
+        return INVALID_PROGRAM;
+    }
+    if (r->operands->size < pops) {
+        return STACK_UNDERFLOW;
+    }
+    operand *args = (operand *) r->operands->elements + r->operands->size - pops;
+    operand result = {.start = pops > 0 ? args[0].start : r->program->size, .is_vector = false, .length = 0};
+    status st;
+    if (t->type == VECTOR) {
+        st = materialize(r, args, pops, &result);
+    } else if (t->type == VARIABLE) {
+        result.is_vector = true;
+        result.length = ((const vector_column *) r->columns->elements)[t->variable].length;
+        st = dynarr_append(r->program, t);
+    } else {
+        st = broadcast(args, pops, &result);
+        if (st == OK && result.is_vector && t->type == FUNCTION
+            && (t->function == DOT || t->function == NORM || t->function == SUM)) {
+            st = reduce(r, t->function, args, pops, &result);
+        } else if (st == OK) {
+            if (result.is_vector) {
+                st = fold_numbers(r, args, pops);
+            }
+            if (st == OK) {
+                st = dynarr_append(r->program, t);
+            }
+        }
+    }
+    if (st != OK) {
+        return st;
+    }
+    r->operands->size -= pops;
+    return dynarr_append(r->operands, &result);
+}
+
+status vector_calculate(const precision precision, dynamic_array *tokens, const symbol_table *symbols,
+                        const vector_bindings *vectors, const result_writer write, void *write_context,
+                        vector_result *out) {
+    rewriter r = {.precision = precision, .symbols = symbols, .num_bound = vectors != NULL ? vectors->count : 0};
+    out->is_vector = false;
+    out->number = NAN;
+    out->length = 0;
+    status st = dynarr_new(sizeof(token), tokens->size + 1, &r.program);
+    if (st == OK) {
+        st = dynarr_new(sizeof(operand), 16, &r.operands);
+    }
+    if (st == OK) {
+        st = dynarr_new(sizeof(vector_column), r.num_bound + 1, &r.columns);
+    }
+    for (size_t k = 0; k < r.num_bound && st == OK; k++) {
+        const vector_column column = {.elements = vectors->elements[k], .length = vectors->lengths[k], .owned = false};
+        st = dynarr_append(r.columns, &column);
+    }
+    const token *t = tokens->elements;
+    for (size_t q = 0; q < tokens->size && st == OK; q++) {
+        st = rewrite_token(&r, &t[q]);
+    }
+    if (st != OK) {
+        goto end;
+    }
+    if (r.operands->size != 1) {
+        st = r.operands->size == 0 ? STACK_UNDERFLOW : STACK_NOT_EMPTY;
+        goto end;
+    }
+    const operand *result = r.operands->elements;
+    if (!result->is_vector) {
+        st = stack_calculate_at(precision, r.program, symbols, nullptr, &out->number);
+        goto end;
+    }
+    st = compute_chunks(&r, 0, result->length, write, write_context);
+    out->is_vector = st == OK;
+    out->length = result->length;
+end:
+    if (r.columns != NULL) {
+        const vector_column *c = r.columns->elements;
+        for (size_t k = 0; k < r.columns->size; k++) {
+            if (c[k].owned) {
+                free((double *) c[k].elements);
+            }
+        }
+        dynarr_free(r.columns);
+    }
+    if (r.operands != NULL) {
+        dynarr_free(r.operands);
+    }
+    if (r.program != NULL) {
+        dynarr_free(r.program);
+    }
+    return st;
+}
@@ -0,0 +1,40 @@
+#ifndef CCALC_VECTOR_CALCULATOR_H
+#define CCALC_VECTOR_CALCULATOR_H
+
+#include "dynarr.h"
+#include "precision.h"
+#include "status.h"
+#include "sweep.h"
+#include "symbols.h"
+
+/* Vectors bound to the variables 0 to count - 1, as by --vector. */
+typedef struct {
+    const double *const *elements;
+    const size_t *lengths;
+    size_t count;
+} vector_bindings;
+
+/* A number, or the length of a vector whose elements went to the writer
+ * given to vector_calculate(). */
+typedef struct {
+    bool is_vector;
+    long double number;
+    size_t length;
+} vector_result;
+
+/* Whether tokens hold a vector literal or a variable bound to a vector.
+ * vectors may be nullptr. */
+bool has_vectors(const dynamic_array *tokens, const vector_bindings *vectors);
+/* Evaluates a straight-line program whose values may be vectors.
+ * Operators and functions apply element by element, with numbers
+ * broadcast to every element, and dot, norm and sum reduce vectors to
+ * numbers. Reductions and parts that are numbers are evaluated first;
+ * what is left runs through block_calculate(), so that each element-wise
+ * expression takes one pass over its vectors. The elements of a vector
+ * result are passed to write in order, a chunk at a time, and are never
+ * all in memory at once. */
+status vector_calculate(precision precision, dynamic_array *tokens, const symbol_table *symbols,
+                        const vector_bindings *vectors, result_writer write, void *write_context,
+                        vector_result *out);
+
+#endif
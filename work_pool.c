@@ -0,0 +1,258 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "work_pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+    work_pool *pool;
+    pthread_mutex_t lock;
+    size_t *items;
+    size_t head; /* oldest item, taken by thieves */
+    size_t tail; /* one past the newest item, taken by the owner */
+} work_deque;
+
+struct work_pool {
+    size_t num_threads;
+    pthread_t *threads;
+    work_deque *deques;
+    size_t deque_capacity;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t finished;
+    pthread_cond_t work_ready;
+    unsigned long generation;
+    size_t num_running;
+    bool shutdown;
+    atomic_size_t remaining;
+    /* Idle workers sleep on work_ready. A worker that finds nothing to take
+     * counts itself in num_idle before it checks num_pushed again, and
+     * pool_push() bumps num_pushed before it looks at num_idle, so either
+     * the worker sees the new item or the pusher sees the worker. */
+    atomic_size_t num_pushed;
+    atomic_size_t num_idle;
+    work_function work;
+    void *context;
+};
+
+static thread_local size_t current_worker;
+
+static bool take_newest(work_deque *deque, size_t *out_item) {
+    bool found = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail > deque->head) {
+        *out_item = deque->items[--deque->tail];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool take_oldest(work_deque *deque, size_t *out_item) {
+    bool found = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail > deque->head) {
+        *out_item = deque->items[deque->head++];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool take(work_pool *pool, const size_t self, size_t *out_item) {
+    if (take_newest(&pool->deques[self], out_item)) {
+        return true;
+    }
+    for (size_t q = 1; q < pool->num_threads; q++) {
+        if (take_oldest(&pool->deques[(self + q) % pool->num_threads], out_item)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Sleeps until an item has been pushed since the given count, or the run is
+ * over. */
+static void wait_for_work(work_pool *pool, const size_t pushed) {
+    pthread_mutex_lock(&pool->lock);
+    atomic_fetch_add(&pool->num_idle, 1);
+    while (atomic_load(&pool->remaining) > 0 && atomic_load(&pool->num_pushed) == pushed) {
+        pthread_cond_wait(&pool->work_ready, &pool->lock);
+    }
+    atomic_fetch_sub(&pool->num_idle, 1);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void *worker_main(void *arg) {
+    work_deque *own = arg;
+    work_pool *pool = own->pool;
+    current_worker = own - pool->deques;
+    unsigned long seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->shutdown && pool->generation == seen) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            return nullptr;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        while (atomic_load(&pool->remaining) > 0) {
+            const size_t pushed = atomic_load(&pool->num_pushed);
+            size_t item;
+            if (take(pool, current_worker, &item)) {
+                pool->work(pool, item, pool->context);
+                if (atomic_fetch_sub(&pool->remaining, 1) == 1) {
+                    pthread_mutex_lock(&pool->lock);
+                    pthread_cond_broadcast(&pool->work_ready);
+                    pthread_mutex_unlock(&pool->lock);
+                }
+            } else {
+                wait_for_work(pool, pushed);
+            }
+        }
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->num_running == 0) {
+            pthread_cond_signal(&pool->finished);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void stop_workers(work_pool *pool, const size_t num_started) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t q = 0; q < num_started; q++) {
+        pthread_join(pool->threads[q], nullptr);
+    }
+}
+
+status pool_new(size_t num_threads, work_pool **out) {
+    if (num_threads == 0) {
+        const long online = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = online > 0 ? online : 1;
+    }
+    work_pool *pool = calloc(1, sizeof(work_pool));
+    if (pool == NULL) {
+        return OUT_OF_MEMORY;
+    }
+    pool->num_threads = num_threads;
+    pool->threads = calloc(num_threads, sizeof(pthread_t));
+    pool->deques = calloc(num_threads, sizeof(work_deque));
+    if (pool->threads == NULL || pool->deques == NULL) {
+        free(pool->threads);
+        free(pool->deques);
+        free(pool);
+        return OUT_OF_MEMORY;
+    }
+    pthread_mutex_init(&pool->lock, nullptr);
+    pthread_cond_init(&pool->wake, nullptr);
+    pthread_cond_init(&pool->finished, nullptr);
+    pthread_cond_init(&pool->work_ready, nullptr);
+    atomic_init(&pool->remaining, 0);
+    atomic_init(&pool->num_pushed, 0);
+    atomic_init(&pool->num_idle, 0);
+    for (size_t q = 0; q < num_threads; q++) {
+        pool->deques[q].pool = pool;
+        pthread_mutex_init(&pool->deques[q].lock, nullptr);
+    }
+    for (size_t q = 0; q < num_threads; q++) {
+        if (pthread_create(&pool->threads[q], nullptr, worker_main, &pool->deques[q]) != 0) {
+            stop_workers(pool, q);
+            pool->num_threads = q;
+            pool_free(pool);
+            return OUT_OF_MEMORY;
+        }
+    }
+    *out = pool;
+    return OK;
+}
+
+void pool_free(work_pool *pool) {
+    if (!pool->shutdown) {
+        stop_workers(pool, pool->num_threads);
+    }
+    for (size_t q = 0; q < pool->num_threads; q++) {
+        pthread_mutex_destroy(&pool->deques[q].lock);
+        free(pool->deques[q].items);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->finished);
+    pthread_cond_destroy(&pool->work_ready);
+    free(pool->deques);
+    free(pool->threads);
+    free(pool);
+}
+
+size_t pool_num_threads(const work_pool *pool) {
+    return pool->num_threads;
+}
+
+/* Every item is pushed at most once per run, so no deque ever needs to
+ * hold more than num_items, and the deques never wrap. */
+static status reserve_deques(work_pool *pool, const size_t num_items) {
+    for (size_t q = 0; q < pool->num_threads; q++) {
+        work_deque *deque = &pool->deques[q];
+        if (num_items > pool->deque_capacity) {
+            size_t *items = realloc(deque->items, num_items * sizeof(size_t));
+            if (items == NULL) {
+                return OUT_OF_MEMORY;
+            }
+            deque->items = items;
+        }
+        deque->head = 0;
+        deque->tail = 0;
+    }
+    if (num_items > pool->deque_capacity) {
+        pool->deque_capacity = num_items;
+    }
+    return OK;
+}
+
+status pool_run(work_pool *pool, const size_t *items, const size_t num_initial, const size_t num_items,
+                const work_function work, void *context) {
+    if (num_items == 0) {
+        return OK;
+    }
+    const status st = reserve_deques(pool, num_items);
+    if (st != OK) {
+        return st;
+    }
+    for (size_t q = 0; q < num_initial; q++) {
+        work_deque *deque = &pool->deques[q % pool->num_threads];
+        deque->items[deque->tail++] = items[q];
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->work = work;
+    pool->context = context;
+    atomic_store(&pool->remaining, num_items);
+    pool->num_running = pool->num_threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    while (pool->num_running > 0) {
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return OK;
+}
+
+void pool_push(work_pool *pool, const size_t item) {
+    work_deque *deque = &pool->deques[current_worker];
+    pthread_mutex_lock(&deque->lock);
+    deque->items[deque->tail++] = item;
+    pthread_mutex_unlock(&deque->lock);
+    atomic_fetch_add(&pool->num_pushed, 1);
+    if (atomic_load(&pool->num_idle) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->work_ready);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef CCALC_WORK_POOL_H
+#define CCALC_WORK_POOL_H
+
+#include <stddef.h>
+#include "status.h"
+
+/* A fixed set of worker threads, each with its own deque of work items.
+ * Workers take their newest item first and steal the oldest item from
+ * another worker when they run dry. */
+typedef struct work_pool work_pool;
+
+typedef void (*work_function)(work_pool *pool, size_t item, void *context);
+
+/* num_threads 0 means one per online CPU. */
+status pool_new(size_t num_threads, work_pool **out);
+void pool_free(work_pool *pool);
+size_t pool_num_threads(const work_pool *pool);
+/* Runs work on the given items, and returns once num_items items have been
+ * processed in total, including the ones pushed by the work function. */
+status pool_run(work_pool *pool, const size_t *items, size_t num_initial, size_t num_items,
+                work_function work, void *context);
+/* Only valid from within a work function. */
+void pool_push(work_pool *pool, size_t item);
+
+#endif